@@ -0,0 +1,528 @@
+#define _GNU_SOURCE
+#include <tree_sitter/api.h>
+
+#include "cache.h"
+#include "struct.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/* approximate heap footprint of a tree-sitter node (SubtreeHeapData plus
+ * its slot in the parent's child array) */
+#define SP_TS_CACHE_NODE_BYTES 80
+
+static int
+sp_ts_cache_cmp(const void *f, const void *s)
+{
+  const struct sp_ts_cache_entry *const *first  = f;
+  const struct sp_ts_cache_entry *const *second = s;
+  return strcmp((*first)->path, (*second)->path);
+}
+
+int
+sp_ts_cache_init(struct sp_ts_cache *self, size_t budget)
+{
+  memset(self, 0, sizeof(*self));
+  pthread_mutex_init(&self->lock, NULL);
+  sp_util_sorted_set_init(&self->entries, sizeof(struct sp_ts_cache_entry *),
+                          sp_ts_cache_cmp);
+  sp_ts_parsers_init(&self->parsers);
+  self->budget = budget;
+
+  return 0;
+}
+
+static void
+sp_ts_cache_unlink(struct sp_ts_cache *self, struct sp_ts_cache_entry *entry)
+{
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    self->head = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  } else {
+    self->tail = entry->prev;
+  }
+  entry->prev = entry->next = NULL;
+}
+
+static void
+sp_ts_cache_push_front(struct sp_ts_cache *self,
+                       struct sp_ts_cache_entry *entry)
+{
+  entry->prev = NULL;
+  entry->next = self->head;
+  if (self->head) {
+    self->head->prev = entry;
+  } else {
+    self->tail = entry;
+  }
+  self->head = entry;
+}
+
+/* tree-sitter has no memory accounting, estimate from the node count */
+static size_t
+sp_ts_cache_tree_bytes(TSTree *tree)
+{
+  TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
+  size_t nodes        = 1;
+
+  for (;;) {
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      ++nodes;
+      continue;
+    }
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if (!ts_tree_cursor_goto_parent(&cursor)) {
+        goto Lout;
+      }
+    } //while
+    ++nodes;
+  } //for
+
+Lout:
+  ts_tree_cursor_delete(&cursor);
+  return nodes * SP_TS_CACHE_NODE_BYTES;
+}
+
+void
+sp_ts_decls_free(struct sp_ts_decls *decls)
+{
+  size_t i;
+
+  for (i = 0; i < decls->length; ++i) {
+    free(decls->arr[i].scope);
+    free(decls->arr[i].name);
+    free(decls->arr[i].type);
+    free(decls->arr[i].array_length);
+  } //for
+  free(decls->arr);
+  free(decls);
+}
+
+static void
+sp_ts_cache_entry_free(struct sp_ts_cache_entry *entry)
+{
+  if (entry->decls) {
+    sp_ts_decls_free(entry->decls);
+  }
+  if (entry->tree) {
+    ts_tree_delete(entry->tree);
+  }
+  sp_ts_file_close(&entry->file);
+  free(entry->path);
+  free(entry);
+}
+
+static struct sp_ts_cache_entry *
+sp_ts_cache_find(struct sp_ts_cache *self, const char *path)
+{
+  struct sp_ts_cache_entry needle   = {.path = (char *)(uintptr_t)path};
+  struct sp_ts_cache_entry *pneedle = &needle;
+  struct sp_ts_cache_entry **result;
+
+  result = sp_util_sorted_set_find(&self->entries, &pneedle);
+  return result ? *result : NULL;
+}
+
+/* $self->lock is held, an entry still in use is freed on its release */
+static void
+sp_ts_cache_remove(struct sp_ts_cache *self, struct sp_ts_cache_entry *entry)
+{
+  sp_util_sorted_set_remove(&self->entries, &entry);
+  sp_ts_cache_unlink(self, entry);
+  self->bytes -= entry->bytes;
+  entry->linked = false;
+  if (entry->refs == 0) {
+    sp_ts_cache_entry_free(entry);
+  }
+}
+
+bool
+sp_ts_cache_drop(struct sp_ts_cache *self, const char *path)
+{
+  struct sp_ts_cache_entry *entry = NULL;
+  char *key;
+
+  if (!(key = sp_ts_path_canonical(path))) {
+    return false;
+  }
+  pthread_mutex_lock(&self->lock);
+  if ((entry = sp_ts_cache_find(self, key))) {
+    sp_ts_cache_remove(self, entry);
+  }
+  pthread_mutex_unlock(&self->lock);
+  free(key);
+
+  return entry != NULL;
+}
+
+size_t
+sp_ts_cache_clear(struct sp_ts_cache *self)
+{
+  size_t result;
+
+  pthread_mutex_lock(&self->lock);
+  result = self->entries.length;
+  while (self->entries.length > 0) {
+    sp_ts_cache_remove(
+      self, *(struct sp_ts_cache_entry **)sp_util_sorted_set_at(
+              &self->entries, self->entries.length - 1));
+  } //while
+  pthread_mutex_unlock(&self->lock);
+
+  return result;
+}
+
+static bool
+sp_ts_cache_is_valid(const struct sp_ts_cache_entry *entry,
+                     const struct stat *st)
+{
+  return entry->dev == st->st_dev && entry->ino == st->st_ino &&
+         entry->size == st->st_size &&
+         entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+         entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void
+sp_ts_cache_evict(struct sp_ts_cache *self,
+                  const struct sp_ts_cache_entry *keep)
+{
+  while (self->budget > 0 && self->bytes > self->budget) {
+    struct sp_ts_cache_entry *lru = self->tail;
+    if (lru == keep) {
+      lru = lru->prev;
+    }
+    if (!lru) {
+      /* $keep alone is over budget */
+      break;
+    }
+    sp_ts_cache_remove(self, lru);
+    ++self->evictions;
+  } //while
+}
+
+/* $self->lock is held */
+static struct sp_ts_cache_entry *
+sp_ts_cache_acquire(struct sp_ts_cache_entry *entry, TSTree **tree)
+{
+  if (!(*tree = ts_tree_copy(entry->tree))) {
+    return NULL;
+  }
+  ++entry->refs;
+  return entry;
+}
+
+struct sp_ts_cache_entry *
+sp_ts_cache_get(struct sp_ts_cache *self,
+                const char *path,
+                const struct sp_ts_limits *limits,
+                enum sp_ts_parse_res *parse,
+                TSTree **tree)
+{
+  enum sp_ts_parse_res res        = SP_TS_PARSE_FAILED;
+  struct sp_ts_cache_entry *entry = NULL;
+  struct sp_ts_cache_entry *other;
+  TSParser *parser = NULL;
+  char *key;
+  struct stat st;
+  int fd = -1;
+
+  *tree = NULL;
+  /* ./a.c and a.c are one entry, and one the watcher reports */
+  if (!(key = sp_ts_path_canonical(path))) {
+    goto Lout;
+  }
+  path = key;
+  if (stat(path, &st) == 0) {
+    pthread_mutex_lock(&self->lock);
+    if ((other = sp_ts_cache_find(self, path))) {
+      if (sp_ts_cache_is_valid(other, &st)) {
+        ++self->hits;
+        sp_ts_cache_unlink(self, other);
+        sp_ts_cache_push_front(self, other);
+        entry = sp_ts_cache_acquire(other, tree);
+      } else {
+        sp_ts_cache_remove(self, other);
+      }
+    }
+    pthread_mutex_unlock(&self->lock);
+    if (entry) {
+      res = SP_TS_PARSED;
+      goto Lout;
+    }
+  }
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    fprintf(stderr, "Unable to open '%s': %m\n", path);
+    goto Lout;
+  }
+  /* the identity is taken from what we actually read */
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    fprintf(stderr, "'%s' is not a regular file\n", path);
+    goto Lerr;
+  }
+
+  if (!(entry = calloc(1, sizeof(*entry)))) {
+    goto Lerr;
+  }
+  entry->file.fd = -1;
+  entry->path    = key;
+  key            = NULL;
+  entry->dev   = st.st_dev;
+  entry->ino   = st.st_ino;
+  entry->size  = st.st_size;
+  entry->mtime = st.st_mtim;
+
+  if (fd_file(fd, &entry->file) != 0) {
+    goto Lerr;
+  }
+  /* the mapping outlives the fd */
+  close(fd);
+  fd = -1;
+
+  /* outside of the lock, concurrent misses parse in parallel */
+  if (!(parser = sp_ts_parsers_take(&self->parsers,
+                                    sp_ts_file_language(path)))) {
+    goto Lerr;
+  }
+  res = sp_ts_parse(parser, NULL, entry->file.content, entry->file.length,
+                    limits, &entry->tree);
+  sp_ts_parsers_give(&self->parsers, parser);
+  if (res != SP_TS_PARSED) {
+    goto Lerr;
+  }
+  entry->bytes = sizeof(*entry) + strlen(entry->path) + 1 +
+                 entry->file.length + sp_ts_cache_tree_bytes(entry->tree);
+
+  pthread_mutex_lock(&self->lock);
+  ++self->misses;
+  if ((other = sp_ts_cache_find(self, path))) {
+    if (sp_ts_cache_is_valid(other, &st)) {
+      /* raced with a parse of the same file, keep the one already shared */
+      sp_ts_cache_entry_free(entry);
+      entry = other;
+    } else {
+      sp_ts_cache_remove(self, other);
+    }
+  }
+  if (entry != other) {
+    if (sp_util_sorted_set_insert(&self->entries, &entry)) {
+      sp_ts_cache_push_front(self, entry);
+      entry->linked = true;
+      self->bytes += entry->bytes;
+      sp_ts_cache_evict(self, entry);
+    }
+    /* otherwise not kept, freed on release */
+  }
+  other = entry;
+  if (!(entry = sp_ts_cache_acquire(other, tree)) && !other->linked) {
+    sp_ts_cache_entry_free(other);
+  }
+  pthread_mutex_unlock(&self->lock);
+  if (!entry) {
+    res = SP_TS_PARSE_FAILED;
+  }
+  goto Lout;
+
+Lerr:
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (entry) {
+    sp_ts_cache_entry_free(entry);
+    entry = NULL;
+  }
+Lout:
+  free(key);
+  if (parse) {
+    *parse = res;
+  }
+  return entry;
+}
+
+void
+sp_ts_cache_release(struct sp_ts_cache *self, struct sp_ts_cache_entry *entry)
+{
+  bool unused;
+
+  pthread_mutex_lock(&self->lock);
+  unused = --entry->refs == 0 && !entry->linked;
+  pthread_mutex_unlock(&self->lock);
+
+  if (unused) {
+    sp_ts_cache_entry_free(entry);
+  }
+}
+
+struct sp_ts_decls_builder {
+  struct sp_ts_decls *decls;
+  size_t bytes;
+};
+
+static char *
+sp_ts_decls_strdup(struct sp_ts_decls_builder *self, const char *str)
+{
+  char *result;
+
+  if (!str) {
+    return NULL;
+  }
+  if ((result = strdup(str))) {
+    self->bytes += strlen(str) + 1;
+  }
+  return result;
+}
+
+/* sp_ts_entry_cb */
+static int
+sp_ts_decls_add(void *closure, const struct sp_ts_entry *entry)
+{
+  struct sp_ts_decls_builder *self = closure;
+  struct sp_ts_decls *decls        = self->decls;
+  struct sp_ts_decl *it;
+
+  if (decls->length == decls->capacity) {
+    size_t capacity = decls->capacity ? decls->capacity * 2 : 64;
+    struct sp_ts_decl *tmp;
+
+    if (!(tmp = realloc(decls->arr, capacity * sizeof(*tmp)))) {
+      return -1;
+    }
+    decls->arr      = tmp;
+    decls->capacity = capacity;
+  }
+
+  it = &decls->arr[decls->length++];
+  memset(it, 0, sizeof(*it));
+  it->kind             = entry->kind;
+  it->pointer          = entry->pointer;
+  it->function_pointer = entry->function_pointer;
+  it->line             = entry->line;
+  it->scope            = sp_ts_decls_strdup(self, entry->scope);
+  it->name             = sp_ts_decls_strdup(self, entry->name);
+  it->type             = sp_ts_decls_strdup(self, entry->type);
+  it->array_length     = sp_ts_decls_strdup(self, entry->array_length);
+  if ((entry->name && !it->name) || (entry->scope && !it->scope) ||
+      (entry->type && !it->type) ||
+      (entry->array_length && !it->array_length)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+struct sp_ts_decls *
+sp_ts_decls_new(struct sp_ts_Context *ctx, size_t *bytes)
+{
+  struct sp_ts_decls_builder builder = {0};
+
+  if (!(builder.decls = calloc(1, sizeof(*builder.decls)))) {
+    return NULL;
+  }
+  if (sp_ts_extract(ctx, sp_ts_decls_add, &builder) != 0) {
+    sp_ts_decls_free(builder.decls);
+    return NULL;
+  }
+  builder.bytes += sizeof(*builder.decls) +
+                   builder.decls->capacity * sizeof(*builder.decls->arr);
+  if (bytes) {
+    *bytes = builder.bytes;
+  }
+
+  return builder.decls;
+}
+
+const struct sp_ts_decls *
+sp_ts_cache_decls(struct sp_ts_cache *self,
+                  struct sp_ts_cache_entry *entry,
+                  TSTree *tree)
+{
+  struct sp_ts_Context ctx = {0};
+  struct sp_ts_decls *result;
+  struct sp_ts_decls *decls;
+  size_t bytes;
+
+  pthread_mutex_lock(&self->lock);
+  result = entry->decls;
+  pthread_mutex_unlock(&self->lock);
+  if (result) {
+    return result;
+  }
+
+  /* outside of the lock, a concurrent build of the same entry is dropped */
+  ctx.file   = entry->file;
+  ctx.tree   = tree;
+  ctx.domain = get_domain(entry->path);
+  if (!(decls = sp_ts_decls_new(&ctx, &bytes))) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&self->lock);
+  if (!(result = entry->decls)) {
+    result = entry->decls = decls;
+    decls                 = NULL;
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  if (decls) {
+    sp_ts_decls_free(decls);
+  } else {
+    sp_ts_cache_charge(self, entry, (ssize_t)bytes);
+  }
+
+  return result;
+}
+
+void
+sp_ts_cache_charge(struct sp_ts_cache *self,
+                   struct sp_ts_cache_entry *entry,
+                   ssize_t delta)
+{
+  pthread_mutex_lock(&self->lock);
+  if (delta < 0 && (size_t)-delta > entry->bytes) {
+    delta = -(ssize_t)entry->bytes;
+  }
+  entry->bytes = (size_t)((ssize_t)entry->bytes + delta);
+  if (entry->linked) {
+    self->bytes = (size_t)((ssize_t)self->bytes + delta);
+    sp_ts_cache_evict(self, entry);
+  }
+  pthread_mutex_unlock(&self->lock);
+}
+
+void
+sp_ts_cache_stats(struct sp_ts_cache *self, struct sp_ts_cache_stats *out)
+{
+  pthread_mutex_lock(&self->lock);
+  out->entries   = self->entries.length;
+  out->bytes     = self->bytes;
+  out->budget    = self->budget;
+  out->hits      = self->hits;
+  out->misses    = self->misses;
+  out->evictions = self->evictions;
+  pthread_mutex_unlock(&self->lock);
+}
+
+int
+sp_ts_cache_free(struct sp_ts_cache *self)
+{
+  size_t i;
+  for (i = 0; i < self->entries.length; ++i) {
+    struct sp_ts_cache_entry **it = sp_util_sorted_set_at(&self->entries, i);
+    sp_ts_cache_entry_free(*it);
+  } //for
+  sp_util_sorted_set_free(&self->entries);
+  sp_ts_parsers_free(&self->parsers);
+  pthread_mutex_destroy(&self->lock);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
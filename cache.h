@@ -0,0 +1,149 @@
+#ifndef SP_TS_CACHE_H
+#define SP_TS_CACHE_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "shared.h"
+#include "struct.h"
+#include "sp_util.h"
+#include "pool.h"
+
+/* ======================================== */
+/* Content and parsed tree of on-disk files keyed by path. An entry is reused
+ * as long as (dev, ino, mtime, size) of the path are unchanged, so repeated
+ * requests on unchanged files skip both I/O and parsing.
+ *
+ * The cache may be used from several threads. Parses run outside of its lock,
+ * each on a parser of its own.
+ */
+/* sp_ts_extract() of an entry, owning its strings */
+struct sp_ts_decl {
+  enum sp_ts_entry_kind kind;
+  char *scope;
+  char *name;
+  char *type;
+  uint32_t pointer;
+  char *array_length;
+  bool function_pointer;
+  uint32_t line;
+};
+
+struct sp_ts_decls {
+  struct sp_ts_decl *arr;
+  size_t length;
+  size_t capacity;
+};
+
+/* sp_ts_extract() of $ctx->tree into a new sp_ts_decls, $bytes (may be NULL)
+ * is the memory it holds. NULL if out of memory. */
+struct sp_ts_decls *
+sp_ts_decls_new(struct sp_ts_Context *ctx, size_t *bytes);
+
+void
+sp_ts_decls_free(struct sp_ts_decls *);
+
+struct sp_ts_cache_entry {
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  off_t size;
+
+  struct sp_ts_file file;
+  TSTree *tree;
+  /* built on first use by sp_ts_cache_decls(), NULL until then */
+  struct sp_ts_decls *decls;
+  /* approximate memory held by this entry: content, tree and anything
+   * charged with sp_ts_cache_charge() */
+  size_t bytes;
+
+  /* handed out by sp_ts_cache_get() and not yet released */
+  size_t refs;
+  /* in $entries and the LRU list, an unlinked entry is freed on its last
+   * release */
+  bool linked;
+
+  /* LRU list, $prev is more recently used */
+  struct sp_ts_cache_entry *prev;
+  struct sp_ts_cache_entry *next;
+};
+
+struct sp_ts_cache_stats {
+  size_t entries;
+  size_t bytes;
+  size_t budget;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+struct sp_ts_cache {
+  pthread_mutex_t lock;
+  /* struct sp_ts_cache_entry * sorted by path */
+  struct sp_util_sorted_set entries;
+  struct sp_ts_parsers parsers;
+  /* most/least recently used */
+  struct sp_ts_cache_entry *head;
+  struct sp_ts_cache_entry *tail;
+  /* sum of entry bytes, bounded by $budget unless 0 */
+  size_t bytes;
+  size_t budget;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+int
+sp_ts_cache_init(struct sp_ts_cache *, size_t budget);
+
+/* The returned entry stays valid, also when evicted meanwhile, until it is
+ * handed back with sp_ts_cache_release(). Entries are keyed by
+ * sp_ts_path_canonical() of $path, which is its $path. NULL if $path could
+ * not be read or parsed. A parse is bounded by $limits (may be NULL), why it did not
+ * complete is stored in $parse (may be NULL).
+ *
+ * A tree is not safe to use from two threads at once, $tree gets a copy of
+ * the entry tree (ts_tree_copy(), sharing its nodes) for the caller to
+ * delete. */
+struct sp_ts_cache_entry *
+sp_ts_cache_get(struct sp_ts_cache *,
+                const char *path,
+                const struct sp_ts_limits *limits,
+                enum sp_ts_parse_res *parse,
+                TSTree **tree);
+
+void
+sp_ts_cache_release(struct sp_ts_cache *, struct sp_ts_cache_entry *);
+
+/* The declarations of $entry, extracted from $tree (the copy handed out with
+ * it) the first time and charged to the entry. Valid while $entry is held,
+ * NULL if out of memory. */
+const struct sp_ts_decls *
+sp_ts_cache_decls(struct sp_ts_cache *,
+                  struct sp_ts_cache_entry *,
+                  TSTree *tree);
+
+/* Unmap and forget $path (any spelling of it), false if it was not cached */
+bool
+sp_ts_cache_drop(struct sp_ts_cache *, const char *path);
+
+/* sp_ts_cache_drop() of every entry, the number dropped */
+size_t
+sp_ts_cache_clear(struct sp_ts_cache *);
+
+/* Account $delta bytes of data derived from $entry (an index, ...) against
+ * the budget, may evict other entries. */
+void
+sp_ts_cache_charge(struct sp_ts_cache *,
+                   struct sp_ts_cache_entry *,
+                   ssize_t delta);
+
+void
+sp_ts_cache_stats(struct sp_ts_cache *, struct sp_ts_cache_stats *out);
+
+int
+sp_ts_cache_free(struct sp_ts_cache *);
+
+#endif
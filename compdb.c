@@ -0,0 +1,538 @@
+#define _GNU_SOURCE
+#include "compdb.h"
+
+#include <sys/stat.h>
+#include <jansson.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SP_TS_COMPDB_FILE "compile_commands.json"
+
+enum sp_ts_compdb_list {
+  SP_TS_COMPDB_QUOTE = 0,
+  SP_TS_COMPDB_INCLUDE,
+  SP_TS_COMPDB_SYSTEM,
+  SP_TS_COMPDB_AFTER,
+  SP_TS_COMPDB_LISTS,
+};
+
+/* -Idir and -I dir alike */
+static const struct {
+  const char *flag;
+  enum sp_ts_compdb_list list;
+} sp_ts_compdb_flags[] = {
+  {"-iquote", SP_TS_COMPDB_QUOTE},
+  {"-isystem", SP_TS_COMPDB_SYSTEM},
+  {"-idirafter", SP_TS_COMPDB_AFTER},
+  {"-I", SP_TS_COMPDB_INCLUDE},
+};
+
+static int
+sp_ts_compdb_unit_cmp(const void *f, const void *s)
+{
+  const struct sp_ts_compdb_unit *first  = f;
+  const struct sp_ts_compdb_unit *second = s;
+  return strcmp(first->file, second->file);
+}
+
+static int
+sp_ts_compdb_dir_cmp(const void *f, const void *s)
+{
+  const char *const *first  = f;
+  const char *const *second = s;
+  return strcmp(*first, *second);
+}
+
+/* interned directories compare by address */
+static int
+sp_ts_compdb_paths_cmp(const void *f, const void *s)
+{
+  const struct sp_ts_compdb_paths *first  = *(const void *const *)f;
+  const struct sp_ts_compdb_paths *second = *(const void *const *)s;
+  size_t i;
+
+  if (first->n_quote != second->n_quote) {
+    return first->n_quote < second->n_quote ? -1 : 1;
+  }
+  for (i = 0; i < first->length && i < second->length; ++i) {
+    if (first->dirs[i] != second->dirs[i]) {
+      return (uintptr_t)first->dirs[i] < (uintptr_t)second->dirs[i] ? -1 : 1;
+    }
+  } //for
+  return (first->length > second->length) - (first->length < second->length);
+}
+
+static bool
+sp_ts_compdb_is_file(const char *path)
+{
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/* $path relative to $directory, without symlinks when it exists */
+static char *
+sp_ts_compdb_absolute(const char *directory, const char *path)
+{
+  char *result = NULL;
+  char *real;
+
+  if (path[0] == '/' || !directory) {
+    result = strdup(path);
+  } else if (asprintf(&result, "%s/%s", directory, path) < 0) {
+    result = NULL;
+  }
+  if (result && (real = realpath(result, NULL))) {
+    free(result);
+    result = real;
+  }
+
+  return result;
+}
+
+static const char *
+sp_ts_compdb_dir(struct sp_ts_compdb *self,
+                 const char *directory,
+                 const char *dir)
+{
+  char *path = sp_ts_compdb_absolute(directory, dir);
+  char **it;
+
+  if (!path) {
+    return NULL;
+  }
+  if (!(it = sp_util_sorted_set_insert(&self->dirs, &path))) {
+    free(path);
+    return NULL;
+  }
+  if (*it != path) {
+    /* already interned */
+    free(path);
+  }
+
+  return *it;
+}
+
+static int
+sp_ts_compdb_append(struct sp_ts_compdb_paths *self,
+                    size_t *capacity,
+                    const char *dir)
+{
+  size_t i;
+
+  /* a directory given twice is searched at its first position */
+  for (i = 0; i < self->length; ++i) {
+    if (self->dirs[i] == dir) {
+      return 0;
+    }
+  } //for
+  if (self->length == *capacity) {
+    size_t n = *capacity ? *capacity * 2 : 8;
+    const char **tmp;
+
+    if (!(tmp = realloc(self->dirs, n * sizeof(*tmp)))) {
+      return -1;
+    }
+    self->dirs = tmp;
+    *capacity  = n;
+  }
+  self->dirs[self->length++] = dir;
+
+  return 0;
+}
+
+/* The interned search list of the compiler arguments $argv run in
+ * $directory */
+static const struct sp_ts_compdb_paths *
+sp_ts_compdb_search(struct sp_ts_compdb *self,
+                    const char *directory,
+                    char *const *argv,
+                    size_t argc)
+{
+  const char **lists[SP_TS_COMPDB_LISTS]  = {NULL};
+  size_t lengths[SP_TS_COMPDB_LISTS]      = {0};
+  struct sp_ts_compdb_paths tmp           = {0};
+  struct sp_ts_compdb_paths *paths        = NULL;
+  const struct sp_ts_compdb_paths *result = NULL;
+  struct sp_ts_compdb_paths **it;
+  size_t capacity = 0;
+  size_t i;
+  size_t l;
+
+  if (!(lists[0] = calloc(SP_TS_COMPDB_LISTS * (argc + 1), sizeof(char *)))) {
+    return NULL;
+  }
+  for (l = 1; l < SP_TS_COMPDB_LISTS; ++l) {
+    lists[l] = lists[0] + l * (argc + 1);
+  }
+
+  for (i = 0; i < argc; ++i) {
+    const char *arg = argv[i];
+    size_t f;
+
+    for (f = 0; f < sizeof(sp_ts_compdb_flags) / sizeof(*sp_ts_compdb_flags);
+         ++f) {
+      size_t len = strlen(sp_ts_compdb_flags[f].flag);
+      const char *value;
+      const char *dir;
+
+      if (strncmp(arg, sp_ts_compdb_flags[f].flag, len) != 0) {
+        continue;
+      }
+      /* -Idir or -I dir */
+      value = arg[len] ? arg + len : i + 1 < argc ? argv[++i] : NULL;
+      if (value && (dir = sp_ts_compdb_dir(self, directory, value))) {
+        l                      = sp_ts_compdb_flags[f].list;
+        lists[l][lengths[l]++] = dir;
+      }
+      break;
+    } //for
+  } //for
+
+  for (l = 0; l < SP_TS_COMPDB_LISTS; ++l) {
+    for (i = 0; i < lengths[l]; ++i) {
+      if (sp_ts_compdb_append(&tmp, &capacity, lists[l][i]) != 0) {
+        goto Lout;
+      }
+    } //for
+    if (l == SP_TS_COMPDB_QUOTE) {
+      tmp.n_quote = tmp.length;
+    }
+  } //for
+
+  paths = &tmp;
+  if ((it = sp_util_sorted_set_find(&self->paths, &paths))) {
+    result = *it;
+    goto Lout;
+  }
+  if (!(paths = calloc(1, sizeof(*paths)))) {
+    goto Lout;
+  }
+  *paths = tmp;
+  if (!sp_util_sorted_set_insert(&self->paths, &paths)) {
+    free(paths);
+    goto Lout;
+  }
+  /* owned by the set */
+  tmp.dirs = NULL;
+  result   = paths;
+
+Lout:
+  free(tmp.dirs);
+  free(lists[0]);
+  return result;
+}
+
+/* Shell like split of a "command", '' and "" quoting and \ escapes */
+static char **
+sp_ts_compdb_split(const char *command, size_t *argc)
+{
+  size_t length = strlen(command);
+  char **result = NULL;
+  char *buf     = NULL;
+  char *out;
+  const char *it;
+  size_t n = 0;
+
+  /* at most one argument per two characters */
+  if (!(result = calloc(length / 2 + 2, sizeof(*result))) ||
+      !(buf = malloc(length + 1))) {
+    free(result);
+    return NULL;
+  }
+
+  for (it = command; *it;) {
+    char quote = '\0';
+
+    while (*it == ' ' || *it == '\t' || *it == '\n') {
+      ++it;
+    }
+    if (!*it) {
+      break;
+    }
+
+    out = buf;
+    while (*it && (quote || (*it != ' ' && *it != '\t' && *it != '\n'))) {
+      if (quote && *it == quote) {
+        quote = '\0';
+      } else if (!quote && (*it == '\'' || *it == '"')) {
+        quote = *it;
+      } else if (*it == '\\' && quote != '\'' && it[1]) {
+        *out++ = *++it;
+      } else {
+        *out++ = *it;
+      }
+      ++it;
+    } //while
+    *out = '\0';
+
+    if (!(result[n] = strdup(buf))) {
+      break;
+    }
+    ++n;
+  } //for
+
+  free(buf);
+  *argc = n;
+  return result;
+}
+
+static void
+sp_ts_compdb_argv_free(char **argv, size_t argc)
+{
+  size_t i;
+
+  for (i = 0; i < argc; ++i) {
+    free(argv[i]);
+  }
+  free(argv);
+}
+
+static char **
+sp_ts_compdb_arguments(json_t *entry, size_t *argc)
+{
+  json_t *arguments   = json_object_get(entry, "arguments");
+  const char *command = json_string_value(json_object_get(entry, "command"));
+  char **result;
+  size_t i;
+
+  if (!json_is_array(arguments)) {
+    return command ? sp_ts_compdb_split(command, argc) : NULL;
+  }
+
+  if (!(result = calloc(json_array_size(arguments) + 1, sizeof(*result)))) {
+    return NULL;
+  }
+  *argc = 0;
+  for (i = 0; i < json_array_size(arguments); ++i) {
+    const char *arg = json_string_value(json_array_get(arguments, i));
+    if (arg && (result[*argc] = strdup(arg))) {
+      ++*argc;
+    }
+  } //for
+
+  return result;
+}
+
+/* every interned directory in first use order, for $self->all */
+static int
+sp_ts_compdb_all(struct sp_ts_compdb *self,
+                 const struct sp_ts_compdb_paths *paths,
+                 size_t *capacity)
+{
+  size_t i;
+
+  for (i = 0; i < paths->length; ++i) {
+    if (sp_ts_compdb_append(&self->all, capacity, paths->dirs[i]) != 0) {
+      return -1;
+    }
+  } //for
+
+  return 0;
+}
+
+int
+sp_ts_compdb_init(struct sp_ts_compdb *self)
+{
+  memset(self, 0, sizeof(*self));
+  sp_util_sorted_set_init(&self->units, sizeof(struct sp_ts_compdb_unit),
+                          sp_ts_compdb_unit_cmp);
+  sp_util_sorted_set_init(&self->dirs, sizeof(char *), sp_ts_compdb_dir_cmp);
+  sp_util_sorted_set_init(&self->paths, sizeof(struct sp_ts_compdb_paths *),
+                          sp_ts_compdb_paths_cmp);
+  return 0;
+}
+
+char *
+sp_ts_compdb_locate(const char *dir)
+{
+  char *it = realpath(dir, NULL);
+  char *candidate;
+
+  while (it) {
+    char *slash;
+
+    if (asprintf(&candidate, "%s/%s", strcmp(it, "/") == 0 ? "" : it,
+                 SP_TS_COMPDB_FILE) >= 0) {
+      if (sp_ts_compdb_is_file(candidate)) {
+        free(it);
+        return candidate;
+      }
+      free(candidate);
+    }
+
+    if (!(slash = strrchr(it, '/')) || strcmp(it, "/") == 0) {
+      break;
+    }
+    /* the parent, / itself last */
+    slash[slash == it ? 1 : 0] = '\0';
+  } //while
+  free(it);
+
+  return NULL;
+}
+
+int
+sp_ts_compdb_load(struct sp_ts_compdb *self, const char *path)
+{
+  struct sp_ts_compdb_unit *units = NULL;
+  size_t capacity                 = self->all.length;
+  size_t n_units                  = 0;
+  int res                         = -1;
+  json_error_t error;
+  json_t *root;
+  size_t kept;
+  size_t i;
+
+  if (!(root = json_load_file(path, 0, &error))) {
+    fprintf(stderr, "%s: %s:%d: %s\n", __func__, path, error.line, error.text);
+    return -1;
+  }
+  if (!json_is_array(root)) {
+    fprintf(stderr, "%s: %s: not an array\n", __func__, path);
+    goto Lout;
+  }
+  if (!(units = calloc(json_array_size(root) + 1, sizeof(*units)))) {
+    goto Lout;
+  }
+
+  for (i = 0; i < json_array_size(root); ++i) {
+    json_t *it                     = json_array_get(root, i);
+    struct sp_ts_compdb_unit *unit = &units[n_units];
+    size_t argc                    = 0;
+    const char *directory;
+    const char *file;
+    char **argv;
+
+    directory = json_string_value(json_object_get(it, "directory"));
+    if (!(file = json_string_value(json_object_get(it, "file")))) {
+      continue;
+    }
+    if (!(argv = sp_ts_compdb_arguments(it, &argc))) {
+      continue;
+    }
+    unit->paths = sp_ts_compdb_search(self, directory, argv, argc);
+    sp_ts_compdb_argv_free(argv, argc);
+    if (!unit->paths) {
+      continue;
+    }
+    if (!(unit->file = sp_ts_compdb_absolute(directory, file))) {
+      continue;
+    }
+    if (sp_ts_compdb_all(self, unit->paths, &capacity) != 0) {
+      free(unit->file);
+      continue;
+    }
+    ++n_units;
+  } //for
+
+  /* one per file, merged as one sorted run rather than inserted one by one
+   * into the set */
+  qsort(units, n_units, sizeof(*units), sp_ts_compdb_unit_cmp);
+  for (i = 0, kept = 0; i < n_units; ++i) {
+    if ((kept > 0 && sp_ts_compdb_unit_cmp(&units[kept - 1], &units[i]) == 0) ||
+        sp_util_sorted_set_find(&self->units, &units[i])) {
+      free(units[i].file);
+    } else {
+      units[kept++] = units[i];
+    }
+  } //for
+  if (sp_util_sorted_set_merge(&self->units, units, kept) != 0) {
+    for (i = 0; i < kept; ++i) {
+      free(units[i].file);
+    }
+    goto Lout;
+  }
+  res = 0;
+
+Lout:
+  free(units);
+  json_decref(root);
+  return res;
+}
+
+const struct sp_ts_compdb_unit *
+sp_ts_compdb_unit(const struct sp_ts_compdb *self, const char *file)
+{
+  struct sp_ts_compdb_unit needle = {0};
+  const struct sp_ts_compdb_unit *result;
+
+  if (self->units.length == 0) {
+    return NULL;
+  }
+  if (!(needle.file = realpath(file, NULL)) && !(needle.file = strdup(file))) {
+    return NULL;
+  }
+  result = sp_util_sorted_set_find(&self->units, &needle);
+  free(needle.file);
+
+  return result;
+}
+
+char *
+sp_ts_compdb_resolve(const struct sp_ts_compdb *self,
+                     const struct sp_ts_compdb_unit *unit,
+                     const char *includer,
+                     const char *path,
+                     bool system)
+{
+  const struct sp_ts_compdb_paths *paths = unit ? unit->paths : &self->all;
+  const char *slash                      = strrchr(includer, '/');
+  char *candidate;
+  size_t i;
+
+  if (path[0] == '/') {
+    return sp_ts_compdb_is_file(path) ? strdup(path) : NULL;
+  }
+
+  if (!system) {
+    if (!slash) {
+      candidate = strdup(path);
+    } else if (asprintf(&candidate, "%.*s%s", (int)(slash + 1 - includer),
+                        includer, path) < 0) {
+      candidate = NULL;
+    }
+    if (candidate && sp_ts_compdb_is_file(candidate)) {
+      return candidate;
+    }
+    free(candidate);
+  }
+
+  for (i = system ? paths->n_quote : 0; i < paths->length; ++i) {
+    if (asprintf(&candidate, "%s/%s", paths->dirs[i], path) < 0) {
+      continue;
+    }
+    if (sp_ts_compdb_is_file(candidate)) {
+      return candidate;
+    }
+    free(candidate);
+  } //for
+
+  return NULL;
+}
+
+int
+sp_ts_compdb_free(struct sp_ts_compdb *self)
+{
+  size_t i;
+
+  for (i = 0; i < self->units.length; ++i) {
+    struct sp_ts_compdb_unit *unit = sp_util_sorted_set_at(&self->units, i);
+    free(unit->file);
+  } //for
+  for (i = 0; i < self->dirs.length; ++i) {
+    free(*(char **)sp_util_sorted_set_at(&self->dirs, i));
+  } //for
+  for (i = 0; i < self->paths.length; ++i) {
+    struct sp_ts_compdb_paths **paths = sp_util_sorted_set_at(&self->paths, i);
+    free((*paths)->dirs);
+    free(*paths);
+  } //for
+  sp_util_sorted_set_free(&self->units);
+  sp_util_sorted_set_free(&self->dirs);
+  sp_util_sorted_set_free(&self->paths);
+  free(self->all.dirs);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef SP_TS_COMPDB_H
+#define SP_TS_COMPDB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "sp_util.h"
+
+/* ======================================== */
+/* The translation units of a compile_commands.json and where each of them
+ * looks for its #include:s.
+ *
+ * A unit listed more than once (several configurations of one file) is kept
+ * once. Include directories are interned, and so are the search lists: the
+ * thousands of units of a project built with the same flags share one.
+ */
+struct sp_ts_compdb_paths {
+  /* interned directories in search order, the first $n_quote (-iquote) only
+   * for "" includes, then -I, -isystem and -idirafter */
+  const char **dirs;
+  size_t length;
+  size_t n_quote;
+};
+
+struct sp_ts_compdb_unit {
+  /* absolute and without symlinks when it exists */
+  char *file;
+  const struct sp_ts_compdb_paths *paths;
+};
+
+struct sp_ts_compdb {
+  /* struct sp_ts_compdb_unit sorted by file */
+  struct sp_util_sorted_set units;
+  /* char * sorted, owning */
+  struct sp_util_sorted_set dirs;
+  /* struct sp_ts_compdb_paths * sorted by content, owning */
+  struct sp_util_sorted_set paths;
+  /* the directories of all units, for files without a unit (headers) */
+  struct sp_ts_compdb_paths all;
+};
+
+int
+sp_ts_compdb_init(struct sp_ts_compdb *);
+
+/* compile_commands.json in $dir or the closest parent of it, NULL when there
+ * is none. The result is to be freed. */
+char *
+sp_ts_compdb_locate(const char *dir);
+
+/* Read the compile_commands.json $path, entries with "arguments" or
+ * "command". -1 if it could not be read. */
+int
+sp_ts_compdb_load(struct sp_ts_compdb *, const char *path);
+
+/* The unit of $file (any spelling of it), NULL if it is not one */
+const struct sp_ts_compdb_unit *
+sp_ts_compdb_unit(const struct sp_ts_compdb *, const char *file);
+
+/* The header #include:d as $path from $includer, NULL when it is found in
+ * none of the directories. Searched like the compiler does: next to
+ * $includer for a "" ($system false) include, then the directories of
+ * $unit or, when NULL, of all units. The result is to be freed. */
+char *
+sp_ts_compdb_resolve(const struct sp_ts_compdb *,
+                     const struct sp_ts_compdb_unit *unit,
+                     const char *includer,
+                     const char *path,
+                     bool system);
+
+int
+sp_ts_compdb_free(struct sp_ts_compdb *);
+
+#endif
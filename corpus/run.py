@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""Golden-output and latency corpus for sp_struct_to_string.
+
+For every scope in the fixture files the expected JSON inserts and a latency
+budget are recorded in corpus/golden.json:
+
+  ./corpus/run.py --update          # (re)discover scopes and record goldens
+  ./corpus/run.py                   # verify against corpus/golden.json
+  ./corpus/run.py --factor 5        # allow 5x the recorded budget
+
+A check fails when the output of a request differs from the golden or when
+its median latency exceeds budget * factor.
+
+An entry without "expected" (a scope discovered with --scopes-only) is
+recorded by the check from the binary under test and written back, it is
+reported as "new" rather than verified. Commit golden.json after reviewing
+what was recorded, the next check verifies it. Goldens are only ever taken
+from the --binary given, the script builds nothing.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+GOLDEN = os.path.join(ROOT, "corpus", "golden.json")
+FIXTURES = ["test.c", "test2.c", "test3.cpp", "test_global.c", "cluster.c"]
+
+# budget = max(measured * BUDGET_HEADROOM, BUDGET_MIN_MS) when recording
+BUDGET_HEADROOM = 2.0
+BUDGET_MIN_MS = 5.0
+
+RE_TYPE = re.compile(r"^(typedef\s+)?(struct|union|enum|class)\b")
+RE_FUNC = re.compile(r"^[A-Za-z_][\w\s\*:&<>,]*\(")
+NOT_FUNC = ("if", "for", "while", "switch", "return", "typedef", "struct",
+            "union", "enum", "class", "extern", "#")
+
+
+def discover(file):
+  """Yields (kind, row, column) for the top-level scopes of $file.
+
+  This is a column zero scan, good enough for the fixtures which all follow
+  the .clang-format layout.
+  """
+  with open(os.path.join(ROOT, file), encoding="utf8",
+            errors="replace") as f:
+    lines = f.read().split("\n")
+
+  for row, line in enumerate(lines):
+    if RE_TYPE.match(line):
+      yield ("crunch", row, 0)
+    elif RE_FUNC.match(line) and not line.startswith(NOT_FUNC):
+      # a definition if '{' comes before ';'
+      body = None
+      for i in range(row, min(row + 20, len(lines))):
+        if ";" in lines[i].split("{")[0]:
+          break
+        if "{" in lines[i]:
+          body = i
+          break
+      if body is None:
+        continue
+      end = None
+      for i in range(body + 1, len(lines)):
+        if lines[i].startswith("}"):
+          end = i
+          break
+      yield ("crunch", row, 0)
+      yield ("branches", row, 0)
+      if end is not None and end - 1 > body:
+        yield ("locals", end - 1, 0)
+
+
+def run_one(binary, entry, repeat):
+  cmd = [binary, entry["kind"], os.path.join(ROOT, entry["file"]),
+         str(entry["line"]), str(entry["column"])]
+  samples = []
+  out = None
+  for _ in range(repeat):
+    start = time.perf_counter()
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE,
+                          stderr=subprocess.DEVNULL, timeout=60)
+    samples.append((time.perf_counter() - start) * 1000.0)
+    out = {"exit": proc.returncode, "stdout": proc.stdout.decode("utf8")}
+  samples.sort()
+  try:
+    out["inserts"] = json.loads(out["stdout"])["inserts"]
+    del out["stdout"]
+  except (ValueError, KeyError):
+    pass
+  return out, samples[len(samples) // 2]
+
+
+def record(args, entry):
+  """Records the output and latency budget of $entry from args.binary."""
+  out, median = run_one(args.binary, entry, args.repeat)
+  entry["expected"] = out
+  entry["budget_ms"] = round(max(median * BUDGET_HEADROOM, BUDGET_MIN_MS), 2)
+
+
+def save(entries):
+  with open(GOLDEN, "w", encoding="utf8") as f:
+    json.dump({"entries": entries}, f, indent=1, sort_keys=True)
+    f.write("\n")
+
+
+def update(args):
+  entries = []
+  for file in FIXTURES:
+    for kind, row, column in discover(file):
+      entry = {"file": file, "kind": kind, "line": row, "column": column}
+      if not args.scopes_only:
+        record(args, entry)
+      entries.append(entry)
+  save(entries)
+  print("recorded {} entries in {}".format(len(entries), GOLDEN))
+  return 0
+
+
+def check(args):
+  if not os.path.exists(GOLDEN):
+    print("{} is missing, record it with --update".format(GOLDEN))
+    return 1
+  with open(GOLDEN, encoding="utf8") as f:
+    entries = json.load(f)["entries"]
+
+  failed = 0
+  new = 0
+  for entry in entries:
+    name = "{}:{}:{} {}".format(entry["file"], entry["line"], entry["column"],
+                                entry["kind"])
+    if "expected" not in entry:
+      new += 1
+      record(args, entry)
+      print("new {}: {}".format(name, json.dumps(entry["expected"])))
+      continue
+    out, median = run_one(args.binary, entry, args.repeat)
+    if out != entry["expected"]:
+      failed += 1
+      print("FAIL output {}\n  expected: {}\n  actual:   {}".format(
+        name, json.dumps(entry["expected"]), json.dumps(out)))
+    elif median > entry["budget_ms"] * args.factor:
+      failed += 1
+      print("FAIL latency {}: {:.2f}ms > {:.2f}ms * {}".format(
+        name, median, entry["budget_ms"], args.factor))
+    elif args.verbose:
+      print("ok {} {:.2f}ms".format(name, median))
+
+  if new:
+    save(entries)
+    print("recorded {} new entries in {}, review and commit it".format(
+      new, GOLDEN))
+  print("{}/{} passed".format(len(entries) - failed - new, len(entries) - new))
+  return 1 if failed else 0
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+  parser.add_argument("--binary",
+                      default=os.path.join(ROOT, "sp_struct_to_string"))
+  parser.add_argument("--update", action="store_true",
+                      help="rediscover scopes and record goldens")
+  parser.add_argument("--scopes-only", action="store_true",
+                      help="with --update, only rediscover the scopes")
+  parser.add_argument("--factor", type=float,
+                      default=float(os.environ.get("SP_CORPUS_FACTOR", "3")),
+                      help="allowed multiple of the latency budget")
+  parser.add_argument("--repeat", type=int, default=3,
+                      help="runs per request, the median is used")
+  parser.add_argument("-v", "--verbose", action="store_true")
+  args = parser.parse_args()
+
+  if args.update:
+    return update(args)
+  return check(args)
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+/* libFuzzer harness feeding arbitrary C/C++ text and a cursor position
+ * through the crunch, locals and branches requests.
+ *
+ * Input: [kind:1][row:2][column:2][source...]
+ *   kind & 0x3: 0 crunch, 1 locals, 2 branches, 3 crunch
+ *   kind & 0x4: parse as C++
+ *
+ * Besides crashes, any single run slower than SP_FUZZ_TIMEOUT_MS (default
+ * 250) aborts so the input is saved as a pathological-latency finding. The
+ * memory threshold is libFuzzer's -rss_limit_mb/-malloc_limit_mb, see
+ * `make fuzz-run`. The extraction code is chatty on stderr, -close_fd_mask=2
+ * silences it at the cost of the sanitizer report (the input is kept).
+ *
+ * Build with SP_FUZZ_MAIN to get a replay driver without libFuzzer:
+ *   ./fuzz_struct_replay crash-<sha1>...
+ */
+#include <tree_sitter/api.h>
+
+#include "../shared.h"
+#include "../struct.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SP_FUZZ_HEADER 5
+
+static TSParser *c_parser    = NULL;
+static TSParser *cpp_parser  = NULL;
+static uint64_t max_run_nsec = 250ull * 1000 * 1000;
+
+static uint64_t
+sp_fuzz_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
+
+int
+LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+  const char *timeout;
+  (void)argc;
+  (void)argv;
+
+  c_parser = ts_parser_new();
+  ts_parser_set_language(c_parser, tree_sitter_c());
+  cpp_parser = ts_parser_new();
+  ts_parser_set_language(cpp_parser, tree_sitter_cpp());
+
+  if ((timeout = getenv("SP_FUZZ_TIMEOUT_MS"))) {
+    max_run_nsec = strtoull(timeout, NULL, 10) * 1000 * 1000;
+  }
+
+  return 0;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  static const char *const kinds[] = {"crunch", "locals", "branches",
+                                      "crunch"};
+  struct sp_ts_Context ctx = {0};
+  TSParser *parser;
+  TSPoint pos;
+  uint64_t start;
+  uint64_t elapsed;
+
+  if (size < SP_FUZZ_HEADER || size - SP_FUZZ_HEADER > UINT32_MAX) {
+    return 0;
+  }
+
+  parser     = (data[0] & 0x4) ? cpp_parser : c_parser;
+  pos.row    = (uint32_t)(data[1] | (data[2] << 8));
+  pos.column = (uint32_t)(data[3] | (data[4] << 8));
+
+  /* A private copy, the extraction code indexes into the content */
+  ctx.file.length = size - SP_FUZZ_HEADER;
+  if (!(ctx.file.content = malloc(ctx.file.length + 1))) {
+    return 0;
+  }
+  memcpy(ctx.file.content, data + SP_FUZZ_HEADER, ctx.file.length);
+  ctx.file.content[ctx.file.length] = '\0';
+  ctx.file.fd                       = -1;
+  ctx.domain                        = DEFAULT_DOMAIN;
+
+  start    = sp_fuzz_now();
+  ctx.tree = ts_parser_parse_string(parser, NULL, ctx.file.content,
+                                    (uint32_t)ctx.file.length);
+  if (ctx.tree) {
+    sp_ts_request(&ctx, kinds[data[0] & 0x3], pos);
+    sp_ts_inserts_finish(&ctx.inserts, ctx.file.content, ctx.file.length);
+    ts_tree_delete(ctx.tree);
+  }
+  elapsed = sp_fuzz_now() - start;
+
+  sp_ts_inserts_free(&ctx.inserts);
+  free(ctx.file.content);
+
+  if (elapsed > max_run_nsec) {
+    fprintf(stdout, "==sp_fuzz== run took %llums (limit %llums)\n",
+            (unsigned long long)(elapsed / 1000000),
+            (unsigned long long)(max_run_nsec / 1000000));
+    fflush(stdout);
+    abort();
+  }
+
+  return 0;
+}
+
+#ifdef SP_FUZZ_MAIN
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  LLVMFuzzerInitialize(&argc, &argv);
+  for (i = 1; i < argc; ++i) {
+    struct sp_ts_file file = {0};
+    if (mmap_file(argv[i], &file) != 0) {
+      return EXIT_FAILURE;
+    }
+    LLVMFuzzerTestOneInput((const uint8_t *)file.content, file.length);
+    sp_ts_file_close(&file);
+    fprintf(stdout, "%s: ok\n", argv[i]);
+  }
+
+  return EXIT_SUCCESS;
+}
+#endif
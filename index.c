@@ -0,0 +1,561 @@
+#define _GNU_SOURCE
+#include "index.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* open addressed set of path spellings */
+struct sp_ts_index_seen {
+  char **slots;
+  size_t length;
+  /* a power of 2 */
+  size_t capacity;
+};
+
+struct sp_ts_index_run {
+  struct sp_ts_index *index;
+  struct sp_ts_pool *pool;
+  enum sp_ts_pool_prio prio;
+  const struct sp_ts_limits *limits;
+  /* includes are followed when set */
+  const struct sp_ts_compdb *compdb;
+
+  /* submitted jobs not yet done, $index->files and $seen */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t pending;
+  struct sp_ts_index_seen seen;
+};
+
+struct sp_ts_index_job {
+  struct sp_ts_index_run *run;
+  struct sp_ts_index_file *file;
+  /* whose include paths $file is parsed with, NULL without a compdb */
+  const struct sp_ts_compdb_unit *unit;
+};
+
+static size_t
+sp_ts_index_hash(const char *str)
+{
+  /* FNV-1a */
+  uint64_t result = 14695981039346656037ull;
+  for (; *str; ++str) {
+    result = (result ^ (uint8_t)*str) * 1099511628211ull;
+  }
+  return (size_t)result;
+}
+
+/* 1 when $path was not in $self and now is, 0 if it was and -1 if out of
+ * memory */
+static int
+sp_ts_index_seen_add(struct sp_ts_index_seen *self, const char *path)
+{
+  size_t i;
+
+  if ((self->length + 1) * 2 > self->capacity) {
+    size_t capacity = self->capacity ? self->capacity * 2 : 1024;
+    char **slots;
+
+    if (!(slots = calloc(capacity, sizeof(*slots)))) {
+      return -1;
+    }
+    for (i = 0; i < self->capacity; ++i) {
+      if (self->slots[i]) {
+        size_t at = sp_ts_index_hash(self->slots[i]) & (capacity - 1);
+        while (slots[at]) {
+          at = (at + 1) & (capacity - 1);
+        } //while
+        slots[at] = self->slots[i];
+      }
+    } //for
+    free(self->slots);
+    self->slots    = slots;
+    self->capacity = capacity;
+  }
+
+  for (i = sp_ts_index_hash(path) & (self->capacity - 1); self->slots[i];
+       i = (i + 1) & (self->capacity - 1)) {
+    if (strcmp(self->slots[i], path) == 0) {
+      return 0;
+    }
+  } //for
+  if (!(self->slots[i] = strdup(path))) {
+    return -1;
+  }
+  ++self->length;
+
+  return 1;
+}
+
+static void
+sp_ts_index_seen_free(struct sp_ts_index_seen *self)
+{
+  size_t i;
+
+  for (i = 0; i < self->capacity; ++i) {
+    free(self->slots[i]);
+  }
+  free(self->slots);
+  memset(self, 0, sizeof(*self));
+}
+
+static int
+sp_ts_index_strcmp(const char *first, const char *second)
+{
+  if (!first || !second) {
+    return (first != NULL) - (second != NULL);
+  }
+  return strcmp(first, second);
+}
+
+static int
+sp_ts_index_member_cmp(const void *f, const void *s)
+{
+  const struct sp_ts_index_member *first  = f;
+  const struct sp_ts_index_member *second = s;
+  int res;
+
+  if ((res = strcmp(first->decl->scope, second->decl->scope)) != 0) {
+    return res;
+  }
+  if ((res = sp_ts_index_strcmp(first->decl->name, second->decl->name)) !=
+      0) {
+    return res;
+  }
+  return (first->decl->line > second->decl->line) -
+         (first->decl->line < second->decl->line);
+}
+
+/* the sorted run of $file */
+static int
+sp_ts_index_members(struct sp_ts_index_file *file)
+{
+  size_t i;
+
+  for (i = 0; i < file->decls->length; ++i) {
+    const struct sp_ts_decl *it = &file->decls->arr[i];
+    if (it->scope && (it->kind == SP_TS_FIELD || it->kind == SP_TS_ENUM)) {
+      ++file->n_members;
+    }
+  } //for
+  if (file->n_members == 0) {
+    return 0;
+  }
+  if (!(file->members = calloc(file->n_members, sizeof(*file->members)))) {
+    file->n_members = 0;
+    return -1;
+  }
+
+  file->n_members = 0;
+  for (i = 0; i < file->decls->length; ++i) {
+    const struct sp_ts_decl *it = &file->decls->arr[i];
+    if (it->scope && (it->kind == SP_TS_FIELD || it->kind == SP_TS_ENUM)) {
+      file->members[file->n_members].decl   = it;
+      file->members[file->n_members++].file = file;
+    }
+  } //for
+  qsort(file->members, file->n_members, sizeof(*file->members),
+        sp_ts_index_member_cmp);
+
+  return 0;
+}
+
+static void
+sp_ts_index_done(struct sp_ts_index_run *run)
+{
+  pthread_mutex_lock(&run->lock);
+  if (--run->pending == 0) {
+    pthread_cond_signal(&run->cond);
+  }
+  pthread_mutex_unlock(&run->lock);
+}
+
+static int
+sp_ts_index_submit(struct sp_ts_index_run *run,
+                   char *path,
+                   const struct sp_ts_compdb_unit *unit);
+
+/* sp_ts_include_cb, a header is submitted the first time it is included */
+static int
+sp_ts_index_include(void *closure, const char *path, bool system)
+{
+  struct sp_ts_index_job *job = closure;
+  struct sp_ts_index_run *run = job->run;
+  char *header;
+  char *real;
+  int claimed;
+
+  if (!(header = sp_ts_compdb_resolve(run->compdb, job->unit, job->file->path,
+                                      path, system))) {
+    return 0;
+  }
+  /* most includes are of an already seen spelling, the path is only
+   * normalised for new ones */
+  pthread_mutex_lock(&run->lock);
+  claimed = sp_ts_index_seen_add(&run->seen, header);
+  pthread_mutex_unlock(&run->lock);
+  if (claimed == 1 && (real = realpath(header, NULL))) {
+    if (strcmp(real, header) != 0) {
+      pthread_mutex_lock(&run->lock);
+      claimed = sp_ts_index_seen_add(&run->seen, real);
+      pthread_mutex_unlock(&run->lock);
+    }
+    free(header);
+    header = real;
+  }
+  if (claimed == 1) {
+    /* owned by the index */
+    sp_ts_index_submit(run, header, job->unit);
+  } else {
+    free(header);
+  }
+
+  return 0;
+}
+
+/* sp_ts_pool_fn */
+static void
+sp_ts_index_work(void *arg)
+{
+  struct sp_ts_index_job *job   = arg;
+  struct sp_ts_index_run *run   = job->run;
+  struct sp_ts_index_file *file = job->file;
+  struct sp_ts_Context ctx      = {0};
+  TSParser *parser;
+
+  file->parse = SP_TS_PARSE_FAILED;
+  ctx.file.fd = -1;
+  if (mmap_file(file->path, &ctx.file) != 0) {
+    goto Lout;
+  }
+  if (!(parser = sp_ts_parsers_take(&run->index->parsers,
+                                    sp_ts_file_language(file->path)))) {
+    goto Lout;
+  }
+  file->parse = sp_ts_parse(parser, NULL, ctx.file.content, ctx.file.length,
+                            run->limits, &ctx.tree);
+  sp_ts_parsers_give(&run->index->parsers, parser);
+  if (file->parse != SP_TS_PARSED) {
+    goto Lout;
+  }
+
+  /* the tree is only needed for the extraction, a tree sized index would not
+   * fit a large tree in memory */
+  ctx.domain = get_domain(file->path);
+  if ((file->decls = sp_ts_decls_new(&ctx, NULL))) {
+    if (sp_ts_index_members(file) != 0) {
+      sp_ts_decls_free(file->decls);
+      file->decls = NULL;
+    }
+  }
+  if (run->compdb) {
+    sp_ts_includes(&ctx, sp_ts_index_include, job);
+  }
+  ts_tree_delete(ctx.tree);
+
+Lout:
+  sp_ts_file_close(&ctx.file);
+  sp_ts_index_done(run);
+  free(job);
+}
+
+/* Also from the workers, for the headers they find */
+static int
+sp_ts_index_submit(struct sp_ts_index_run *run,
+                   char *path,
+                   const struct sp_ts_compdb_unit *unit)
+{
+  struct sp_ts_index *self = run->index;
+  struct sp_ts_index_file *file;
+  struct sp_ts_index_job *job;
+
+  if (!(file = calloc(1, sizeof(*file))) || !(job = calloc(1, sizeof(*job)))) {
+    free(file);
+    free(path);
+    return -1;
+  }
+  file->path  = path;
+  file->parse = SP_TS_PARSE_FAILED;
+  job->run    = run;
+  job->file   = file;
+  job->unit   = unit;
+
+  pthread_mutex_lock(&run->lock);
+  if (self->length == self->capacity) {
+    size_t capacity = self->capacity ? self->capacity * 2 : 256;
+    struct sp_ts_index_file **tmp;
+
+    if (!(tmp = realloc(self->files, capacity * sizeof(*tmp)))) {
+      pthread_mutex_unlock(&run->lock);
+      free(job);
+      free(file);
+      free(path);
+      return -1;
+    }
+    self->files    = tmp;
+    self->capacity = capacity;
+  }
+  self->files[self->length++] = file;
+  ++run->pending;
+  pthread_mutex_unlock(&run->lock);
+
+  if (sp_ts_pool_submit(run->pool, run->prio, sp_ts_index_work, job) != 0) {
+    free(job);
+    sp_ts_index_done(run);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Submit the files under $dir while they are found, the workers start on the
+ * first before the walk is done */
+static int
+sp_ts_index_walk(struct sp_ts_index_run *run, const char *dir)
+{
+  struct dirent *it;
+  DIR *d;
+
+  if (!(d = opendir(dir))) {
+    fprintf(stderr, "%s: opendir('%s'): %m\n", __func__, dir);
+    return -1;
+  }
+  while ((it = readdir(d))) {
+    unsigned char type = it->d_type;
+    char *path;
+
+    if (it->d_name[0] == '.') {
+      /* ., .. and hidden, .git and the like */
+      continue;
+    }
+    if (asprintf(&path, "%s/%s", dir, it->d_name) < 0) {
+      continue;
+    }
+    if (type == DT_UNKNOWN) {
+      struct stat st;
+      if (lstat(path, &st) == 0) {
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : 0;
+      }
+    }
+
+    if (type == DT_DIR) {
+      sp_ts_index_walk(run, path);
+    } else if (type == DT_REG &&
+               (is_c_file(it->d_name) || is_cpp_file(it->d_name))) {
+      /* owned by the index */
+      sp_ts_index_submit(run, path, NULL);
+      continue;
+    }
+    free(path);
+  } //while
+  closedir(d);
+
+  return 0;
+}
+
+/* Bottom up merge of the members of earlier runs and the sorted runs of the
+ * files since, log2(files) passes over the members. Equal members keep the
+ * file order. */
+static int
+sp_ts_index_merge(struct sp_ts_index *self)
+{
+  struct sp_ts_index_member *arr = NULL;
+  struct sp_ts_index_member *tmp = NULL;
+  size_t *bounds                 = NULL;
+  size_t n_runs                  = 0;
+  size_t total                   = 0;
+  size_t i;
+  int res = -1;
+
+  total = self->n_members;
+  for (i = 0; i < self->length; ++i) {
+    total += self->files[i]->n_members;
+  }
+  if (total == self->n_members) {
+    return 0;
+  }
+  if (!(arr = malloc(total * sizeof(*arr))) ||
+      !(tmp = malloc(total * sizeof(*tmp))) ||
+      !(bounds = malloc((self->length + 2) * sizeof(*bounds)))) {
+    goto Lout;
+  }
+
+  bounds[0] = 0;
+  if (self->n_members > 0) {
+    /* already merged by an earlier sp_ts_index_dir()/compdb(), its files
+     * come first */
+    memcpy(arr, self->members, self->n_members * sizeof(*arr));
+    bounds[++n_runs] = self->n_members;
+  }
+  for (i = 0; i < self->length; ++i) {
+    struct sp_ts_index_file *file = self->files[i];
+    if (file->n_members > 0) {
+      memcpy(arr + bounds[n_runs], file->members,
+             file->n_members * sizeof(*arr));
+      bounds[n_runs + 1] = bounds[n_runs] + file->n_members;
+      ++n_runs;
+    }
+  } //for
+
+  while (n_runs > 1) {
+    size_t merged = 0;
+
+    for (i = 0; i < n_runs; i += 2) {
+      size_t f     = bounds[i];
+      size_t f_end = bounds[i + 1];
+      size_t s     = f_end;
+      size_t s_end = i + 1 < n_runs ? bounds[i + 2] : f_end;
+      size_t out   = f;
+
+      while (f < f_end || s < s_end) {
+        if (s == s_end ||
+            (f < f_end && sp_ts_index_member_cmp(&arr[s], &arr[f]) >= 0)) {
+          tmp[out++] = arr[f++];
+        } else {
+          tmp[out++] = arr[s++];
+        }
+      } //while
+      bounds[merged++] = bounds[i];
+    } //for
+    bounds[merged] = total;
+    n_runs         = merged;
+    sp_util_swap_voidp(&arr, &tmp);
+  } //while
+
+  free(self->members);
+  self->members   = arr;
+  self->n_members = total;
+  arr             = NULL;
+  res             = 0;
+
+  for (i = 0; i < self->length; ++i) {
+    free(self->files[i]->members);
+    self->files[i]->members   = NULL;
+    self->files[i]->n_members = 0;
+  } //for
+
+Lout:
+  free(arr);
+  free(tmp);
+  free(bounds);
+  return res;
+}
+
+int
+sp_ts_index_init(struct sp_ts_index *self)
+{
+  memset(self, 0, sizeof(*self));
+  return sp_ts_parsers_init(&self->parsers);
+}
+
+static void
+sp_ts_index_run_init(struct sp_ts_index_run *run,
+                     struct sp_ts_index *self,
+                     struct sp_ts_pool *pool,
+                     enum sp_ts_pool_prio prio,
+                     const struct sp_ts_limits *limits)
+{
+  memset(run, 0, sizeof(*run));
+  run->index  = self;
+  run->pool   = pool;
+  run->prio   = prio;
+  run->limits = limits;
+  pthread_mutex_init(&run->lock, NULL);
+  pthread_cond_init(&run->cond, NULL);
+}
+
+/* Wait for the submitted jobs, also those they submit, and merge */
+static int
+sp_ts_index_run_wait(struct sp_ts_index_run *run)
+{
+  pthread_mutex_lock(&run->lock);
+  while (run->pending > 0) {
+    pthread_cond_wait(&run->cond, &run->lock);
+  } //while
+  pthread_mutex_unlock(&run->lock);
+  pthread_cond_destroy(&run->cond);
+  pthread_mutex_destroy(&run->lock);
+  sp_ts_index_seen_free(&run->seen);
+
+  return sp_ts_index_merge(run->index);
+}
+
+int
+sp_ts_index_dir(struct sp_ts_index *self,
+                const char *dir,
+                struct sp_ts_pool *pool,
+                enum sp_ts_pool_prio prio,
+                const struct sp_ts_limits *limits)
+{
+  struct sp_ts_index_run run;
+  int res;
+
+  sp_ts_index_run_init(&run, self, pool, prio, limits);
+  res = sp_ts_index_walk(&run, dir);
+  if (sp_ts_index_run_wait(&run) != 0) {
+    res = -1;
+  }
+
+  return res;
+}
+
+int
+sp_ts_index_compdb(struct sp_ts_index *self,
+                   const struct sp_ts_compdb *compdb,
+                   struct sp_ts_pool *pool,
+                   enum sp_ts_pool_prio prio,
+                   const struct sp_ts_limits *limits)
+{
+  struct sp_ts_index_run run;
+  int res = 0;
+  size_t i;
+
+  sp_ts_index_run_init(&run, self, pool, prio, limits);
+  run.compdb = compdb;
+  for (i = 0; i < compdb->units.length; ++i) {
+    const struct sp_ts_compdb_unit *unit =
+      sp_util_sorted_set_at(&compdb->units, i);
+    char *path;
+    int claimed;
+
+    /* a unit #include:d by another is parsed once */
+    pthread_mutex_lock(&run.lock);
+    claimed = sp_ts_index_seen_add(&run.seen, unit->file);
+    pthread_mutex_unlock(&run.lock);
+    if (claimed == 1 && (path = strdup(unit->file))) {
+      sp_ts_index_submit(&run, path, unit);
+    } else if (claimed < 0) {
+      res = -1;
+    }
+  } //for
+  if (sp_ts_index_run_wait(&run) != 0) {
+    res = -1;
+  }
+
+  return res;
+}
+
+int
+sp_ts_index_free(struct sp_ts_index *self)
+{
+  size_t i;
+
+  for (i = 0; i < self->length; ++i) {
+    struct sp_ts_index_file *file = self->files[i];
+    if (file->decls) {
+      sp_ts_decls_free(file->decls);
+    }
+    free(file->members);
+    free(file->path);
+    free(file);
+  } //for
+  free(self->files);
+  free(self->members);
+  sp_ts_parsers_free(&self->parsers);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
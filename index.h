@@ -0,0 +1,86 @@
+#ifndef SP_TS_INDEX_H
+#define SP_TS_INDEX_H
+
+#include <stddef.h>
+
+#include "cache.h"
+#include "compdb.h"
+#include "pool.h"
+
+/* ======================================== */
+/* Declarations of every C/C++ file of a source tree, what `index <dir>`
+ * builds to measure how fast a whole project is parsed and extracted. It is
+ * a throughput benchmark: nothing looks types up in it, serve follows the
+ * includes of a file instead (types.h).
+ *
+ * Files are parsed and extracted as one pool job each, on a parser of the
+ * worker's own. A job only writes the summary of its file: the declarations
+ * and its members sorted by (scope, name, line). The sorted runs are merged
+ * once all jobs are done, so no lock is held while parsing, extracting or
+ * sorting. A short critical section of the run lock is taken per file, to
+ * append it to $files, to count it done and, following includes, to claim a
+ * header not seen before.
+ *
+ * An index can be added to by further sp_ts_index_dir()/compdb() calls, the
+ * members of the earlier ones are kept. A file indexed by two of them is
+ * there twice.
+ */
+struct sp_ts_index_file {
+  char *path;
+  enum sp_ts_parse_res parse;
+  /* NULL when it could not be read or parsed */
+  struct sp_ts_decls *decls;
+
+  /* sorted run of the file, merged into sp_ts_index.members */
+  struct sp_ts_index_member *members;
+  size_t n_members;
+};
+
+/* A field or enumerator of a named struct/union/class/enum */
+struct sp_ts_index_member {
+  const struct sp_ts_decl *decl;
+  const struct sp_ts_index_file *file;
+};
+
+struct sp_ts_index {
+  struct sp_ts_index_file **files;
+  size_t length;
+  size_t capacity;
+
+  /* by scope, name and line, then file order, `index` counts the types
+   * from it */
+  struct sp_ts_index_member *members;
+  size_t n_members;
+
+  struct sp_ts_parsers parsers;
+};
+
+int
+sp_ts_index_init(struct sp_ts_index *);
+
+/* Index the C/C++ files (is_c_file(), is_cpp_file()) under $dir on $pool and
+ * wait for it, so not to be called from one of its workers. Hidden entries
+ * and symlinks are skipped. A parse is bounded by $limits (may be NULL), a
+ * file that fails is kept with a NULL $decls. */
+int
+sp_ts_index_dir(struct sp_ts_index *,
+                const char *dir,
+                struct sp_ts_pool *pool,
+                enum sp_ts_pool_prio prio,
+                const struct sp_ts_limits *limits);
+
+/* Index the translation units of $compdb and, with the include paths of the
+ * unit, the headers they include. A header shared by any number of units is
+ * parsed once, with the paths of the first unit found to include it. Like
+ * sp_ts_index_dir() otherwise. */
+int
+sp_ts_index_compdb(struct sp_ts_index *,
+                   const struct sp_ts_compdb *compdb,
+                   struct sp_ts_pool *pool,
+                   enum sp_ts_pool_prio prio,
+                   const struct sp_ts_limits *limits);
+
+int
+sp_ts_index_free(struct sp_ts_index *);
+
+#endif
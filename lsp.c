@@ -0,0 +1,889 @@
+#define _GNU_SOURCE
+#include <tree_sitter/api.h>
+
+#include "shared.h"
+#include "struct.h"
+#include "lsp.h"
+#include "sp_util.h"
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <jansson.h>
+
+/* JSON-RPC/LSP error codes */
+#define SP_LSP_PARSE_ERROR -32700
+#define SP_LSP_INVALID_REQUEST -32600
+#define SP_LSP_METHOD_NOT_FOUND -32601
+#define SP_LSP_INVALID_PARAMS -32602
+#define SP_LSP_NOT_INITIALIZED -32002
+#define SP_LSP_CONTENT_MODIFIED -32801
+#define SP_LSP_REQUEST_FAILED -32803
+
+/* the largest document, with room for the JSON around and escaping in it */
+#define SP_LSP_MAX_MESSAGE ((uint64_t)SP_TS_MAX_INPUT + (64 << 20))
+
+/* a header line longer than this is not LSP */
+#define SP_LSP_MAX_HEADER 4096
+/* read() size */
+#define SP_LSP_READ (64 << 10)
+
+/* textDocumentSync kind */
+#define SP_LSP_SYNC_INCREMENTAL 2
+
+struct sp_lsp_doc {
+  char *uri;
+  /* file system path of $uri, for language and domain detection */
+  char *path;
+  const TSLanguage *lang;
+  /* NUL terminated */
+  char *text;
+  size_t length;
+  size_t capacity;
+  TSTree *tree;
+  /* $text changed since $tree was parsed, $tree has been edited to match */
+  bool dirty;
+};
+
+struct sp_lsp {
+  int in;
+  FILE *out;
+  /* read from $in and framed here rather than by stdio, so messages that
+   * have arrived are seen by sp_lsp_preempt() */
+  char *buf;
+  size_t buf_begin;
+  size_t buf_end;
+  size_t buf_capacity;
+  /* [$buf_begin, $buf_scanned) are whole messages which do not preempt the
+   * parse of $parsing */
+  size_t buf_scanned;
+  /* uri of the document being parsed, NULL otherwise */
+  const char *parsing;
+  TSParser *parser;
+  struct sp_ts_limits limits;
+  struct sp_lsp_doc *docs;
+  size_t n_docs;
+  /* negotiated positionEncoding, utf-16 (the LSP default) otherwise */
+  bool utf8;
+  bool initialized;
+  bool shutdown;
+};
+
+static const struct {
+  const char *title;
+  const char *in_type;
+} sp_lsp_actions[] = {
+  {"Generate sp_debug printer", "crunch"},
+  {"Insert locals trace", "locals"},
+  {"Instrument branches", "branches"},
+};
+
+/* ======================================== */
+/* The value of a Content-Length header, false when it is not a number or
+ * larger than any message we accept */
+static bool
+sp_lsp_content_length(const char *it, size_t *out)
+{
+  unsigned long long val;
+  char *end;
+
+  it += strspn(it, " \t");
+  if (*it < '0' || *it > '9') {
+    return false;
+  }
+  errno = 0;
+  val   = strtoull(it, &end, 10);
+  if (errno == ERANGE || val > SP_LSP_MAX_MESSAGE) {
+    return false;
+  }
+  if (end[strspn(end, " \t\r\n")] != '\0') {
+    return false;
+  }
+
+  *out = (size_t)val;
+  return true;
+}
+
+/* Room for $need unconsumed bytes in $self->buf, which are moved to its
+ * start */
+static int
+sp_lsp_reserve(struct sp_lsp *self, size_t need)
+{
+  if (self->buf_begin > 0) {
+    memmove(self->buf, self->buf + self->buf_begin,
+            self->buf_end - self->buf_begin);
+    self->buf_end -= self->buf_begin;
+    self->buf_scanned -= self->buf_begin;
+    self->buf_begin = 0;
+  }
+  if (need > self->buf_capacity) {
+    size_t capacity = sp_max(self->buf_capacity * 2, need);
+    char *tmp;
+    if (!(tmp = realloc(self->buf, capacity))) {
+      return -1;
+    }
+    self->buf          = tmp;
+    self->buf_capacity = capacity;
+  }
+
+  return 0;
+}
+
+/* One read() of $self->in, 0 on EOF */
+static ssize_t
+sp_lsp_fill(struct sp_lsp *self)
+{
+  ssize_t res;
+
+  if (self->buf_capacity - self->buf_end < SP_LSP_READ &&
+      sp_lsp_reserve(self, self->buf_end - self->buf_begin + SP_LSP_READ) !=
+        0) {
+    return -1;
+  }
+  do {
+    res = read(self->in, self->buf + self->buf_end,
+               self->buf_capacity - self->buf_end);
+  } while (res < 0 && errno == EINTR);
+  if (res > 0) {
+    self->buf_end += (size_t)res;
+  }
+
+  return res;
+}
+
+/* The header of the message at $self->buf + $at. 1 when it is complete, its
+ * body is at $*body and $*length bytes long (not necessarily read yet), 0
+ * when more has to be read and -1 when it is malformed. */
+static int
+sp_lsp_frame(const struct sp_lsp *self,
+             size_t at,
+             size_t *body,
+             size_t *length)
+{
+  bool have_length = false;
+
+  while (at < self->buf_end) {
+    const char *line = self->buf + at;
+    const char *nl   = memchr(line, '\n', self->buf_end - at);
+    size_t l_line;
+
+    if (!nl) {
+      return self->buf_end - at > SP_LSP_MAX_HEADER ? -1 : 0;
+    }
+    l_line = (size_t)(nl - line) + 1;
+    at += l_line;
+
+    if (l_line == 1 || (l_line == 2 && line[0] == '\r')) {
+      if (have_length) {
+        *body = at;
+        return 1;
+      }
+    } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      char value[64];
+
+      if (l_line - 15 >= sizeof(value)) {
+        return -1;
+      }
+      memcpy(value, line + 15, l_line - 15);
+      value[l_line - 15] = '\0';
+      if (!sp_lsp_content_length(value, length)) {
+        fprintf(stderr, "%s: bad Content-Length:%s", __func__, value);
+        return -1;
+      }
+      have_length = true;
+    }
+  } //while
+
+  return 0;
+}
+
+static int
+sp_lsp_read(struct sp_lsp *self, json_t **out)
+{
+  json_error_t error;
+  size_t body   = 0;
+  size_t length = 0;
+  int res;
+
+  *out = NULL;
+  while ((res = sp_lsp_frame(self, self->buf_begin, &body, &length)) == 0 ||
+         (res == 1 && self->buf_end - body < length)) {
+    if (res == 1 &&
+        sp_lsp_reserve(self, body - self->buf_begin + length) != 0) {
+      return -1;
+    }
+    if (sp_lsp_fill(self) <= 0) {
+      /* EOF */
+      return -1;
+    }
+  } //while
+  if (res < 0) {
+    /* the stream can not be framed any further */
+    return -1;
+  }
+
+  if (length > 0) {
+    /* NULL on malformed json, the caller answers with a ParseError */
+    *out = json_loadb(self->buf + body, length, 0, &error);
+  }
+  self->buf_begin   = body + length;
+  self->buf_scanned = sp_max(self->buf_scanned, self->buf_begin);
+
+  return 0;
+}
+
+static void
+sp_lsp_write(struct sp_lsp *self, json_t *msg)
+{
+  char *body;
+
+  json_object_set_new(msg, "jsonrpc", json_string("2.0"));
+  if ((body = json_dumps(msg, JSON_COMPACT))) {
+    fprintf(self->out, "Content-Length: %zu\r\n\r\n%s", strlen(body), body);
+    fflush(self->out);
+    free(body);
+  }
+  json_decref(msg);
+}
+
+static void
+sp_lsp_respond(struct sp_lsp *self, json_t *id, json_t *result)
+{
+  json_t *msg = json_object();
+  json_object_set(msg, "id", id ? id : json_null());
+  json_object_set_new(msg, "result", result ? result : json_null());
+  sp_lsp_write(self, msg);
+}
+
+static void
+sp_lsp_error(struct sp_lsp *self, json_t *id, int code, const char *message)
+{
+  json_t *msg = json_object();
+  json_object_set(msg, "id", id ? id : json_null());
+  json_object_set_new(msg, "error", json_pack("{s:i, s:s}", "code", code,
+                                              "message", message));
+  sp_lsp_write(self, msg);
+}
+
+/* ======================================== */
+static int
+sp_lsp_hex(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* file:///a%20b.c -> /a b.c, other schemes are kept as is */
+static char *
+sp_lsp_uri_to_path(const char *uri)
+{
+  const char *it = uri;
+  char *result;
+  char *out;
+
+  if (strncmp(uri, "file://", 7) == 0) {
+    it = uri + 7;
+  }
+  if (!(out = result = malloc(strlen(it) + 1))) {
+    return NULL;
+  }
+  for (; *it; ++it) {
+    if (it[0] == '%' && sp_lsp_hex(it[1]) >= 0 && sp_lsp_hex(it[2]) >= 0) {
+      *out++ = (char)((sp_lsp_hex(it[1]) << 4) | sp_lsp_hex(it[2]));
+      it += 2;
+    } else {
+      *out++ = *it;
+    }
+  } //for
+  *out = '\0';
+
+  return result;
+}
+
+static struct sp_lsp_doc *
+sp_lsp_doc_find(struct sp_lsp *self, const char *uri)
+{
+  size_t i;
+  if (uri) {
+    for (i = 0; i < self->n_docs; ++i) {
+      if (strcmp(self->docs[i].uri, uri) == 0) {
+        return &self->docs[i];
+      }
+    } //for
+  }
+  return NULL;
+}
+
+static void
+sp_lsp_doc_free(struct sp_lsp_doc *doc)
+{
+  if (doc->tree) {
+    ts_tree_delete(doc->tree);
+  }
+  free(doc->uri);
+  free(doc->path);
+  free(doc->text);
+  memset(doc, 0, sizeof(*doc));
+}
+
+static int
+sp_lsp_doc_reserve(struct sp_lsp_doc *doc, size_t length)
+{
+  if (length > SP_TS_MAX_INPUT) {
+    /* beyond what tree-sitter can address */
+    return -1;
+  }
+  if (length + 1 > doc->capacity) {
+    size_t capacity = sp_max(doc->capacity * 2, length + 1);
+    char *tmp;
+    if (!(tmp = realloc(doc->text, capacity))) {
+      return -1;
+    }
+    doc->text     = tmp;
+    doc->capacity = capacity;
+  }
+  return 0;
+}
+
+static enum sp_ts_parse_res
+sp_lsp_doc_parse(struct sp_lsp *self, struct sp_lsp_doc *doc)
+{
+  enum sp_ts_parse_res res;
+  TSTree *tree;
+
+  if (doc->tree && !doc->dirty) {
+    return SP_TS_PARSED;
+  }
+
+  ts_parser_set_language(self->parser, doc->lang);
+  /* what is queued was scanned against another document, if at all */
+  self->parsing     = doc->uri;
+  self->buf_scanned = self->buf_begin;
+  /* $doc->tree has been ts_tree_edit():ed to match $doc->text */
+  res = sp_ts_parse(self->parser, doc->tree, doc->text, doc->length,
+                    &self->limits, &tree);
+  self->parsing = NULL;
+  if (res != SP_TS_PARSED) {
+    /* keep the edited tree, further edits pile onto it and the next parse
+     * is still incremental */
+    doc->dirty = true;
+    return res;
+  }
+
+  if (doc->tree) {
+    ts_tree_delete(doc->tree);
+  }
+  doc->tree  = tree;
+  doc->dirty = false;
+
+  return res;
+}
+
+/* $msg makes the parse of $self->parsing moot: an edit or close of the same
+ * document or the end of the session. Not a request, it waits for this very
+ * tree; as each parse rescans what is queued, queued requests would otherwise
+ * cancel one another's parse until the last. */
+static bool
+sp_lsp_supersedes(const struct sp_lsp *self, json_t *msg)
+{
+  const char *method = json_string_value(json_object_get(msg, "method"));
+  const char *uri;
+
+  if (!method) {
+    return false;
+  }
+  if (strcmp(method, "exit") == 0 || strcmp(method, "shutdown") == 0) {
+    return true;
+  }
+  uri = json_string_value(json_object_get(
+    json_object_get(json_object_get(msg, "params"), "textDocument"), "uri"));
+  if (!uri || strcmp(uri, self->parsing) != 0) {
+    return false;
+  }
+  return strcmp(method, "textDocument/didChange") == 0 ||
+         strcmp(method, "textDocument/didClose") == 0;
+}
+
+static bool
+sp_lsp_preempt(void *closure)
+{
+  struct sp_lsp *self = closure;
+  size_t body;
+  size_t length;
+
+  if (!self->parsing) {
+    return false;
+  }
+  if (sp_ts_fd_pending(self->in) && sp_lsp_fill(self) < 0) {
+    return false;
+  }
+  /* each message that has arrived is looked at once per parse */
+  while (sp_lsp_frame(self, self->buf_scanned, &body, &length) == 1 &&
+         self->buf_end - body >= length) {
+    json_t *msg = json_loadb(self->buf + body, length, 0, NULL);
+    bool res    = msg && sp_lsp_supersedes(self, msg);
+
+    json_decref(msg);
+    self->buf_scanned = body + length;
+    if (res) {
+      return true;
+    }
+  } //while
+
+  return false;
+}
+
+/* ======================================== */
+/* Number of $self->utf8 position units in the $length bytes of $it */
+static uint32_t
+sp_lsp_units(const struct sp_lsp *self, const char *it, size_t length)
+{
+  uint32_t result = 0;
+  size_t i;
+
+  if (self->utf8) {
+    return (uint32_t)length;
+  }
+  for (i = 0; i < length; ++i) {
+    unsigned char c = (unsigned char)it[i];
+    if ((c & 0xc0) != 0x80) {
+      /* lead byte, 4 byte sequences are a surrogate pair in utf-16 */
+      result += c >= 0xf0 ? 2 : 1;
+    }
+  } //for
+
+  return result;
+}
+
+/* LSP Position -> byte offset, clamped to the line/document end */
+static size_t
+sp_lsp_offset(const struct sp_lsp *self,
+              const struct sp_lsp_doc *doc,
+              json_t *position)
+{
+  json_int_t line  = json_integer_value(json_object_get(position, "line"));
+  json_int_t chr   = json_integer_value(json_object_get(position, "character"));
+  const char *end  = doc->text + doc->length;
+  const char *it   = doc->text;
+  json_int_t units = 0;
+  const char *eol;
+
+  for (; line > 0; --line) {
+    const char *nl = memchr(it, '\n', (size_t)(end - it));
+    if (!nl) {
+      return doc->length;
+    }
+    it = nl + 1;
+  } //for
+
+  if (!(eol = memchr(it, '\n', (size_t)(end - it)))) {
+    eol = end;
+  }
+  if (self->utf8) {
+    return (size_t)(it - doc->text) +
+           (size_t)sp_max(0, sp_min(chr, (json_int_t)(eol - it)));
+  }
+  while (it < eol && units < chr) {
+    size_t l_seq = 1;
+    while (it + l_seq < eol && ((unsigned char)it[l_seq] & 0xc0) == 0x80) {
+      ++l_seq;
+    }
+    units += sp_lsp_units(self, it, l_seq);
+    it += l_seq;
+  } //while
+
+  return (size_t)(it - doc->text);
+}
+
+static TSPoint
+sp_lsp_point(const struct sp_lsp_doc *doc, size_t offset)
+{
+  return sp_ts_point_advance((TSPoint){0, 0}, doc->text, offset);
+}
+
+static json_t *
+sp_lsp_position(const struct sp_lsp *self,
+                const struct sp_lsp_doc *doc,
+                size_t offset)
+{
+  TSPoint point = sp_lsp_point(doc, offset);
+  size_t bol    = offset - point.column;
+  return json_pack("{s:I, s:I}", "line", (json_int_t)point.row, "character",
+                   (json_int_t)sp_lsp_units(self, doc->text + bol,
+                                            point.column));
+}
+
+/* ======================================== */
+static int
+sp_lsp_doc_change(struct sp_lsp *self, struct sp_lsp_doc *doc, json_t *change)
+{
+  json_t *range    = json_object_get(change, "range");
+  json_t *jtext    = json_object_get(change, "text");
+  const char *text = json_string_value(jtext);
+  size_t l_text    = json_string_length(jtext);
+  size_t start;
+  size_t end;
+  size_t length;
+  TSInputEdit edit;
+
+  if (!text) {
+    return -1;
+  }
+  doc->dirty = true;
+
+  if (!range) {
+    /* full content */
+    if (sp_lsp_doc_reserve(doc, l_text) != 0) {
+      return -1;
+    }
+    memcpy(doc->text, text, l_text);
+    doc->text[l_text] = '\0';
+    doc->length       = l_text;
+    if (doc->tree) {
+      ts_tree_delete(doc->tree);
+      doc->tree = NULL;
+    }
+    return 0;
+  }
+
+  start = sp_lsp_offset(self, doc, json_object_get(range, "start"));
+  end   = sp_lsp_offset(self, doc, json_object_get(range, "end"));
+  if (end < start) {
+    return -1;
+  }
+  length = doc->length - (end - start) + l_text;
+  if (sp_lsp_doc_reserve(doc, length) != 0) {
+    return -1;
+  }
+
+  edit.start_byte    = (uint32_t)start;
+  edit.old_end_byte  = (uint32_t)end;
+  edit.new_end_byte  = (uint32_t)(start + l_text);
+  edit.start_point   = sp_lsp_point(doc, start);
+  edit.old_end_point = sp_ts_point_advance(edit.start_point, doc->text + start,
+                                           end - start);
+  edit.new_end_point = sp_ts_point_advance(edit.start_point, text, l_text);
+
+  memmove(doc->text + start + l_text, doc->text + end, doc->length - end);
+  memcpy(doc->text + start, text, l_text);
+  doc->length            = length;
+  doc->text[doc->length] = '\0';
+
+  if (doc->tree) {
+    ts_tree_edit(doc->tree, &edit);
+  }
+
+  return 0;
+}
+
+static void
+sp_lsp_did_open(struct sp_lsp *self, json_t *params)
+{
+  json_t *item     = json_object_get(params, "textDocument");
+  const char *uri  = json_string_value(json_object_get(item, "uri"));
+  const char *lang = json_string_value(json_object_get(item, "languageId"));
+  json_t *text     = json_object_get(item, "text");
+  struct sp_lsp_doc *doc;
+
+  if (!uri || !json_is_string(text)) {
+    return;
+  }
+
+  if (!(doc = sp_lsp_doc_find(self, uri))) {
+    struct sp_lsp_doc *tmp;
+    if (!(tmp = realloc(self->docs, (self->n_docs + 1) * sizeof(*tmp)))) {
+      return;
+    }
+    self->docs = tmp;
+    doc        = &self->docs[self->n_docs++];
+    memset(doc, 0, sizeof(*doc));
+    doc->uri  = strdup(uri);
+    doc->path = sp_lsp_uri_to_path(uri);
+    if (!doc->uri || !doc->path) {
+      sp_lsp_doc_free(doc);
+      --self->n_docs;
+      return;
+    }
+  }
+
+  if (lang && strcmp(lang, "cpp") == 0) {
+    doc->lang = tree_sitter_cpp();
+  } else if (lang && strcmp(lang, "c") == 0) {
+    doc->lang = tree_sitter_c();
+  } else {
+    doc->lang = sp_ts_file_language(doc->path);
+  }
+
+  if (sp_lsp_doc_change(self, doc, item) == 0) {
+    sp_lsp_doc_parse(self, doc);
+  }
+}
+
+static void
+sp_lsp_did_change(struct sp_lsp *self, json_t *params)
+{
+  json_t *item    = json_object_get(params, "textDocument");
+  const char *uri = json_string_value(json_object_get(item, "uri"));
+  json_t *changes = json_object_get(params, "contentChanges");
+  struct sp_lsp_doc *doc;
+  size_t i;
+
+  if (!(doc = sp_lsp_doc_find(self, uri))) {
+    return;
+  }
+
+  for (i = 0; i < json_array_size(changes); ++i) {
+    json_t *change = json_array_get(changes, i);
+    if (sp_lsp_doc_change(self, doc, change) != 0) {
+      fprintf(stderr, "%s: failed to apply change to '%s'\n", __func__, uri);
+      /* out of sync, reparse whatever we have from scratch */
+      if (doc->tree) {
+        ts_tree_delete(doc->tree);
+        doc->tree = NULL;
+      }
+      break;
+    }
+  } //for
+
+  /* every change has been ts_tree_edit():ed, one incremental reparse */
+  sp_lsp_doc_parse(self, doc);
+}
+
+static void
+sp_lsp_did_close(struct sp_lsp *self, json_t *params)
+{
+  json_t *item    = json_object_get(params, "textDocument");
+  const char *uri = json_string_value(json_object_get(item, "uri"));
+  struct sp_lsp_doc *doc;
+
+  if ((doc = sp_lsp_doc_find(self, uri))) {
+    sp_lsp_doc_free(doc);
+    *doc = self->docs[--self->n_docs];
+  }
+}
+
+/* ======================================== */
+static json_t *
+sp_lsp_text_edit(struct sp_lsp *self,
+                 struct sp_lsp_doc *doc,
+                 const struct sp_ts_insert *insert)
+{
+  const char *end    = doc->text + doc->length;
+  bool newline       = false;
+  const char *suffix = "";
+  json_t *position;
+  json_t *text;
+  size_t l_data;
+
+  /* $insert->byte starts the line to insert before */
+  if (insert->byte >= doc->length) {
+    /* past the last line, append on a line of its own */
+    newline = doc->length > 0 && end[-1] != '\n';
+  }
+  position = sp_lsp_position(self, doc, sp_min(insert->byte, doc->length));
+
+  l_data = strlen(insert->data);
+  if (l_data == 0 || insert->data[l_data - 1] != '\n') {
+    suffix = "\n";
+  }
+  text = json_sprintf("%s%s%s", newline ? "\n" : "", insert->data, suffix);
+
+  return json_pack("{s:{s:O, s:o}, s:o}", "range", "start", position, "end",
+                   position, "newText", text);
+}
+
+static json_t *
+sp_lsp_code_action(struct sp_lsp *self,
+                   struct sp_lsp_doc *doc,
+                   size_t action,
+                   TSPoint pos)
+{
+  struct sp_ts_Context ctx = {0};
+  json_t *result           = NULL;
+  json_t *edits;
+  size_t i;
+
+  ctx.file.content = doc->text;
+  ctx.file.length  = doc->length;
+  ctx.file.fd      = -1;
+  ctx.tree         = doc->tree;
+  ctx.domain       = get_domain(doc->path);
+
+  sp_ts_request(&ctx, sp_lsp_actions[action].in_type, pos);
+  if (ctx.inserts.length == 0) {
+    goto Lout;
+  }
+  /* the TextEdits of a WorkspaceEdit all refer to the unmodified document */
+  sp_ts_inserts_sort(&ctx.inserts, doc->text, doc->length);
+
+  edits = json_array();
+  for (i = 0; i < ctx.inserts.length; ++i) {
+    json_array_append_new(edits,
+                          sp_lsp_text_edit(self, doc, &ctx.inserts.arr[i]));
+  } //for
+
+  result = json_pack("{s:s, s:s, s:{s:{s:o}}}", "title",
+                     sp_lsp_actions[action].title, "kind", "refactor",
+                     "edit", "changes", doc->uri, edits);
+Lout:
+  sp_ts_inserts_free(&ctx.inserts);
+  return result;
+}
+
+static void
+sp_lsp_code_actions(struct sp_lsp *self, json_t *id, json_t *params)
+{
+  json_t *item    = json_object_get(params, "textDocument");
+  const char *uri = json_string_value(json_object_get(item, "uri"));
+  json_t *start   = json_object_get(json_object_get(params, "range"), "start");
+  struct sp_lsp_doc *doc;
+  enum sp_ts_parse_res parse;
+  json_t *result;
+  TSPoint pos;
+  size_t offset;
+  size_t i;
+
+  if (!(doc = sp_lsp_doc_find(self, uri)) || !start) {
+    sp_lsp_error(self, id, SP_LSP_INVALID_PARAMS, "unknown document");
+    return;
+  }
+
+  /* a no-op unless a parse on change was cut short */
+  parse = sp_lsp_doc_parse(self, doc);
+  if (parse == SP_TS_PARSE_TIMEOUT) {
+    sp_lsp_error(self, id, SP_LSP_REQUEST_FAILED, "parse timeout");
+    return;
+  }
+  if (parse == SP_TS_PARSE_CANCELLED) {
+    /* newer messages, most likely edits, are waiting */
+    sp_lsp_error(self, id, SP_LSP_CONTENT_MODIFIED, "superseded");
+    return;
+  }
+
+  result = json_array();
+  if (parse == SP_TS_PARSED) {
+    offset = sp_lsp_offset(self, doc, start);
+    pos    = sp_lsp_point(doc, offset);
+    for (i = 0; i < sizeof(sp_lsp_actions) / sizeof(sp_lsp_actions[0]); ++i) {
+      json_t *action;
+      if ((action = sp_lsp_code_action(self, doc, i, pos))) {
+        json_array_append_new(result, action);
+      }
+    } //for
+  }
+
+  sp_lsp_respond(self, id, result);
+}
+
+static void
+sp_lsp_initialize(struct sp_lsp *self, json_t *id, json_t *params)
+{
+  json_t *encodings;
+  size_t i;
+
+  encodings = json_object_get(
+    json_object_get(json_object_get(params, "capabilities"), "general"),
+    "positionEncodings");
+  for (i = 0; i < json_array_size(encodings); ++i) {
+    const char *it = json_string_value(json_array_get(encodings, i));
+    if (it && strcmp(it, "utf-8") == 0) {
+      /* no utf-16 translation of columns */
+      self->utf8 = true;
+    }
+  } //for
+
+  self->initialized = true;
+  sp_lsp_respond(
+    self, id,
+    json_pack("{s:{s:s, s:{s:b, s:i}, s:b}, s:{s:s}}", "capabilities",
+              "positionEncoding", self->utf8 ? "utf-8" : "utf-16",
+              "textDocumentSync", "openClose", 1, "change",
+              SP_LSP_SYNC_INCREMENTAL, "codeActionProvider", 1, "serverInfo",
+              "name", "sp_struct_to_string"));
+}
+
+static void
+sp_lsp_dispatch(struct sp_lsp *self,
+                const char *method,
+                json_t *id,
+                json_t *params)
+{
+  if (strcmp(method, "initialize") == 0) {
+    sp_lsp_initialize(self, id, params);
+  } else if (!self->initialized) {
+    if (id) {
+      sp_lsp_error(self, id, SP_LSP_NOT_INITIALIZED, "not initialized");
+    }
+  } else if (self->shutdown) {
+    if (id) {
+      sp_lsp_error(self, id, SP_LSP_INVALID_REQUEST, "shutting down");
+    }
+  } else if (strcmp(method, "shutdown") == 0) {
+    self->shutdown = true;
+    sp_lsp_respond(self, id, NULL);
+  } else if (strcmp(method, "textDocument/didOpen") == 0) {
+    sp_lsp_did_open(self, params);
+  } else if (strcmp(method, "textDocument/didChange") == 0) {
+    sp_lsp_did_change(self, params);
+  } else if (strcmp(method, "textDocument/didClose") == 0) {
+    sp_lsp_did_close(self, params);
+  } else if (strcmp(method, "textDocument/codeAction") == 0) {
+    sp_lsp_code_actions(self, id, params);
+  } else if (id) {
+    sp_lsp_error(self, id, SP_LSP_METHOD_NOT_FOUND, method);
+  }
+  /* unknown notifications are ignored */
+}
+
+int
+sp_lsp_main(FILE *in, FILE *out, uint64_t timeout_us)
+{
+  struct sp_lsp self = {.in = fileno(in), .out = out};
+  json_t *msg;
+  size_t i;
+
+  if (!(self.parser = ts_parser_new())) {
+    return EXIT_FAILURE;
+  }
+  self.limits.timeout_us = timeout_us;
+  self.limits.preempt    = sp_lsp_preempt;
+  self.limits.closure    = &self;
+
+  while (sp_lsp_read(&self, &msg) == 0) {
+    const char *method;
+    if (!msg) {
+      sp_lsp_error(&self, NULL, SP_LSP_PARSE_ERROR, "parse error");
+      continue;
+    }
+
+    method = json_string_value(json_object_get(msg, "method"));
+    if (method && strcmp(method, "exit") == 0) {
+      json_decref(msg);
+      break;
+    }
+    /* without a method it is a response, we never send requests */
+    if (method) {
+      sp_lsp_dispatch(&self, method, json_object_get(msg, "id"),
+                      json_object_get(msg, "params"));
+    }
+    json_decref(msg);
+  } //while
+
+  for (i = 0; i < self.n_docs; ++i) {
+    sp_lsp_doc_free(&self.docs[i]);
+  }
+  free(self.docs);
+  free(self.buf);
+  ts_parser_delete(self.parser);
+
+  return self.shutdown ? EXIT_SUCCESS : EXIT_FAILURE;
+}
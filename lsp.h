@@ -0,0 +1,26 @@
+#ifndef SP_TS_LSP_H
+#define SP_TS_LSP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* ======================================== */
+/* Language Server Protocol front-end, `sp_struct_to_string lsp`.
+ *
+ * Documents are kept in sync with incremental didChange events which are
+ * mapped onto ts_tree_edit() so only the edited part is reparsed. The
+ * crunch/locals/branches requests are offered as code actions whose
+ * WorkspaceEdit carries the generated code.
+ *
+ * A parse gets $timeout_us (0 unbounded) and is abandoned as soon as an edit
+ * or close of the same document (or shutdown/exit) has arrived, typing never
+ * waits on a huge document.
+ *
+ * Serves JSON-RPC over $in/$out until `exit`, returns the process exit code.
+ * $in is read with read(2), nothing may have been read from it through
+ * stdio.
+ */
+int
+sp_lsp_main(FILE *in, FILE *out, uint64_t timeout_us);
+
+#endif
@@ -0,0 +1,322 @@
+#include "pool.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct sp_ts_pool_job {
+  sp_ts_pool_fn fn;
+  void *arg;
+  struct sp_ts_pool_job *next;
+};
+
+/* the worker the calling thread is, NULL outside of any pool */
+static __thread struct sp_ts_pool_worker *sp_ts_pool_current = NULL;
+
+static struct sp_ts_pool_job *
+sp_ts_pool_pop(struct sp_ts_pool_worker *worker, enum sp_ts_pool_prio prio)
+{
+  struct sp_ts_pool_job *result;
+
+  pthread_mutex_lock(&worker->lock);
+  if ((result = worker->head[prio])) {
+    if (!(worker->head[prio] = result->next)) {
+      worker->tail[prio] = NULL;
+    }
+  }
+  pthread_mutex_unlock(&worker->lock);
+
+  return result;
+}
+
+/* a background slot, false when all are in use */
+static bool
+sp_ts_pool_reserve(struct sp_ts_pool *self)
+{
+  size_t running = __atomic_load_n(&self->background, __ATOMIC_RELAXED);
+  do {
+    if (running >= self->background_max) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&self->background, &running,
+                                        running + 1, true, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED));
+  return true;
+}
+
+static bool
+sp_ts_pool_runnable(struct sp_ts_pool *self)
+{
+  return __atomic_load_n(&self->queued[SP_TS_POOL_INTERACTIVE],
+                         __ATOMIC_ACQUIRE) > 0 ||
+         (__atomic_load_n(&self->queued[SP_TS_POOL_BACKGROUND],
+                          __ATOMIC_ACQUIRE) > 0 &&
+          __atomic_load_n(&self->background, __ATOMIC_ACQUIRE) <
+            self->background_max);
+}
+
+static bool
+sp_ts_pool_empty(struct sp_ts_pool *self)
+{
+  size_t prio;
+  for (prio = 0; prio < SP_TS_POOL_PRIOS; ++prio) {
+    if (__atomic_load_n(&self->queued[prio], __ATOMIC_ACQUIRE) > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* The oldest job of the highest class, own queue first */
+static struct sp_ts_pool_job *
+sp_ts_pool_take(struct sp_ts_pool_worker *worker, enum sp_ts_pool_prio *prio)
+{
+  struct sp_ts_pool *self = worker->pool;
+  size_t p;
+  size_t i;
+
+  for (p = 0; p < SP_TS_POOL_PRIOS; ++p) {
+    if (__atomic_load_n(&self->queued[p], __ATOMIC_ACQUIRE) == 0) {
+      continue;
+    }
+    if (p == SP_TS_POOL_BACKGROUND && !sp_ts_pool_reserve(self)) {
+      break;
+    }
+    for (i = 0; i < self->n_workers; ++i) {
+      struct sp_ts_pool_worker *victim =
+        &self->workers[(worker->index + i) % self->n_workers];
+      struct sp_ts_pool_job *job;
+
+      if ((job = sp_ts_pool_pop(victim, (enum sp_ts_pool_prio)p))) {
+        __atomic_sub_fetch(&self->queued[p], 1, __ATOMIC_RELEASE);
+        *prio = (enum sp_ts_pool_prio)p;
+        return job;
+      }
+    } //for
+    if (p == SP_TS_POOL_BACKGROUND) {
+      /* raced with another worker for it */
+      __atomic_sub_fetch(&self->background, 1, __ATOMIC_RELEASE);
+    }
+  } //for
+
+  return NULL;
+}
+
+static void
+sp_ts_pool_wake(struct sp_ts_pool *self, bool all)
+{
+  pthread_mutex_lock(&self->lock);
+  if (all) {
+    pthread_cond_broadcast(&self->cond);
+  } else {
+    pthread_cond_signal(&self->cond);
+  }
+  pthread_mutex_unlock(&self->lock);
+}
+
+static void *
+sp_ts_pool_worker(void *closure)
+{
+  struct sp_ts_pool_worker *worker = closure;
+  struct sp_ts_pool *self          = worker->pool;
+
+  sp_ts_pool_current = worker;
+  for (;;) {
+    enum sp_ts_pool_prio prio;
+    struct sp_ts_pool_job *job;
+
+    if ((job = sp_ts_pool_take(worker, &prio))) {
+      job->fn(job->arg);
+      free(job);
+      if (prio == SP_TS_POOL_BACKGROUND) {
+        __atomic_sub_fetch(&self->background, 1, __ATOMIC_RELEASE);
+        /* one waiting on the background bound can go */
+        sp_ts_pool_wake(self, false);
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    while (!sp_ts_pool_runnable(self) &&
+           !(self->stop && sp_ts_pool_empty(self))) {
+      pthread_cond_wait(&self->cond, &self->lock);
+    } //while
+    if (self->stop && sp_ts_pool_empty(self)) {
+      /* stopped and drained */
+      pthread_mutex_unlock(&self->lock);
+      break;
+    }
+    pthread_mutex_unlock(&self->lock);
+  } //for
+  sp_ts_pool_current = NULL;
+
+  return NULL;
+}
+
+int
+sp_ts_pool_init(struct sp_ts_pool *self, size_t threads)
+{
+  size_t i;
+
+  memset(self, 0, sizeof(*self));
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_cond_init(&self->cond, NULL);
+
+  if (threads == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads     = online > 0 ? (size_t)online : 1;
+  }
+  /* one kept free for interactive jobs, unless there is only one */
+  self->background_max = threads > 1 ? threads - 1 : 1;
+
+  if (!(self->workers = calloc(threads, sizeof(*self->workers)))) {
+    goto Lerr;
+  }
+  for (i = 0; i < threads; ++i) {
+    self->workers[i].pool  = self;
+    self->workers[i].index = i;
+    pthread_mutex_init(&self->workers[i].lock, NULL);
+  } //for
+  for (; self->n_workers < threads; ++self->n_workers) {
+    struct sp_ts_pool_worker *worker = &self->workers[self->n_workers];
+    if (pthread_create(&worker->thread, NULL, sp_ts_pool_worker, worker) !=
+        0) {
+      fprintf(stderr, "%s: pthread_create failed\n", __func__);
+      goto Lerr;
+    }
+  } //for
+
+  return 0;
+Lerr:
+  sp_ts_pool_free(self);
+  return -1;
+}
+
+int
+sp_ts_pool_submit(struct sp_ts_pool *self,
+                  enum sp_ts_pool_prio prio,
+                  sp_ts_pool_fn fn,
+                  void *arg)
+{
+  struct sp_ts_pool_worker *worker = sp_ts_pool_current;
+  struct sp_ts_pool_job *job;
+
+  if (!(job = calloc(1, sizeof(*job)))) {
+    return -1;
+  }
+  job->fn  = fn;
+  job->arg = arg;
+
+  if (!worker || worker->pool != self) {
+    size_t next = __atomic_fetch_add(&self->next, 1, __ATOMIC_RELAXED);
+    worker      = &self->workers[next % self->n_workers];
+  }
+
+  pthread_mutex_lock(&worker->lock);
+  if (worker->tail[prio]) {
+    worker->tail[prio]->next = job;
+  } else {
+    worker->head[prio] = job;
+  }
+  worker->tail[prio] = job;
+  pthread_mutex_unlock(&worker->lock);
+
+  __atomic_add_fetch(&self->queued[prio], 1, __ATOMIC_RELEASE);
+  sp_ts_pool_wake(self, false);
+
+  return 0;
+}
+
+int
+sp_ts_pool_free(struct sp_ts_pool *self)
+{
+  size_t i;
+
+  pthread_mutex_lock(&self->lock);
+  self->stop = true;
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->lock);
+
+  for (i = 0; i < self->n_workers; ++i) {
+    pthread_join(self->workers[i].thread, NULL);
+  }
+  for (i = 0; i < self->n_workers; ++i) {
+    pthread_mutex_destroy(&self->workers[i].lock);
+  }
+  free(self->workers);
+  pthread_cond_destroy(&self->cond);
+  pthread_mutex_destroy(&self->lock);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
+
+int
+sp_ts_parsers_init(struct sp_ts_parsers *self)
+{
+  memset(self, 0, sizeof(*self));
+  pthread_mutex_init(&self->lock, NULL);
+  return 0;
+}
+
+TSParser *
+sp_ts_parsers_take(struct sp_ts_parsers *self, const TSLanguage *lang)
+{
+  TSParser *result = NULL;
+  size_t i;
+
+  pthread_mutex_lock(&self->lock);
+  for (i = 0; i < self->length; ++i) {
+    if (ts_parser_language(self->idle[i]) == lang) {
+      result        = self->idle[i];
+      self->idle[i] = self->idle[--self->length];
+      break;
+    }
+  } //for
+  pthread_mutex_unlock(&self->lock);
+
+  if (!result && (result = ts_parser_new())) {
+    if (!ts_parser_set_language(result, lang)) {
+      ts_parser_delete(result);
+      result = NULL;
+    }
+  }
+
+  return result;
+}
+
+void
+sp_ts_parsers_give(struct sp_ts_parsers *self, TSParser *parser)
+{
+  pthread_mutex_lock(&self->lock);
+  if (self->length == self->capacity) {
+    size_t capacity = self->capacity ? self->capacity * 2 : 8;
+    TSParser **tmp;
+
+    if (!(tmp = realloc(self->idle, capacity * sizeof(*tmp)))) {
+      pthread_mutex_unlock(&self->lock);
+      ts_parser_delete(parser);
+      return;
+    }
+    self->idle     = tmp;
+    self->capacity = capacity;
+  }
+  self->idle[self->length++] = parser;
+  pthread_mutex_unlock(&self->lock);
+}
+
+int
+sp_ts_parsers_free(struct sp_ts_parsers *self)
+{
+  size_t i;
+
+  for (i = 0; i < self->length; ++i) {
+    ts_parser_delete(self->idle[i]);
+  }
+  free(self->idle);
+  pthread_mutex_destroy(&self->lock);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
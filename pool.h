@@ -0,0 +1,105 @@
+#ifndef SP_TS_POOL_H
+#define SP_TS_POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <tree_sitter/api.h>
+
+/* ======================================== */
+/* Fixed set of worker threads running submitted jobs, for CPU bound work
+ * (parsing, generating, indexing) off an event loop.
+ *
+ * Every worker has a queue per priority class. A job submitted from a worker
+ * goes to its own queue, otherwise the queues are taken round robin. A worker
+ * runs the oldest job of the highest class with anything queued, from its
+ * own queue first and else stolen from another worker's.
+ *
+ * Jobs are not interrupted. An interactive job waits at most for the running
+ * jobs to finish, so background work is submitted in small units (one file),
+ * and it never occupies all workers: one is kept for interactive jobs. The
+ * exception is a pool of one worker, which runs both classes, serve mode
+ * therefore starts at least two.
+ */
+enum sp_ts_pool_prio {
+  SP_TS_POOL_INTERACTIVE = 0,
+  SP_TS_POOL_BACKGROUND,
+  SP_TS_POOL_PRIOS,
+};
+
+typedef void (*sp_ts_pool_fn)(void *arg);
+
+struct sp_ts_pool_job;
+struct sp_ts_pool;
+
+struct sp_ts_pool_worker {
+  struct sp_ts_pool *pool;
+  pthread_t thread;
+  size_t index;
+
+  /* FIFO per priority class */
+  pthread_mutex_t lock;
+  struct sp_ts_pool_job *head[SP_TS_POOL_PRIOS];
+  struct sp_ts_pool_job *tail[SP_TS_POOL_PRIOS];
+};
+
+struct sp_ts_pool {
+  struct sp_ts_pool_worker *workers;
+  size_t n_workers;
+  /* round robin target of submits from outside the pool */
+  size_t next;
+
+  /* queued jobs per class, updated atomically */
+  size_t queued[SP_TS_POOL_PRIOS];
+  /* running background jobs and the bound on them */
+  size_t background;
+  size_t background_max;
+
+  /* idle workers sleep on $cond */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool stop;
+};
+
+/* $threads 0 is one per online cpu */
+int
+sp_ts_pool_init(struct sp_ts_pool *, size_t threads);
+
+int
+sp_ts_pool_submit(struct sp_ts_pool *,
+                  enum sp_ts_pool_prio prio,
+                  sp_ts_pool_fn fn,
+                  void *arg);
+
+/* Runs what is already queued, then joins the workers */
+int
+sp_ts_pool_free(struct sp_ts_pool *);
+
+/* ======================================== */
+/* A TSParser must not be used by two threads at once. Parsers are taken for
+ * the duration of one parse and handed back, so there are at most as many
+ * per language as there have been concurrent parses, one per worker.
+ */
+struct sp_ts_parsers {
+  pthread_mutex_t lock;
+  /* idle parsers, each with its language set */
+  TSParser **idle;
+  size_t length;
+  size_t capacity;
+};
+
+int
+sp_ts_parsers_init(struct sp_ts_parsers *);
+
+/* An idle parser for $lang or a new one, NULL if out of memory */
+TSParser *
+sp_ts_parsers_take(struct sp_ts_parsers *, const TSLanguage *lang);
+
+void
+sp_ts_parsers_give(struct sp_ts_parsers *, TSParser *);
+
+int
+sp_ts_parsers_free(struct sp_ts_parsers *);
+
+#endif
@@ -0,0 +1,1288 @@
+#define _GNU_SOURCE
+#include <tree_sitter/api.h>
+
+#include "shared.h"
+#include "struct.h"
+#include "cache.h"
+#include "compdb.h"
+#include "types.h"
+#include "pool.h"
+#include "watch.h"
+#include "server.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <jansson.h>
+
+/* longest request line, a connection sending more is dropped */
+#define SP_SERVER_LINE_MAX (64 * 1024)
+/* a connection is not read from while this much output is unsent */
+#define SP_SERVER_WBUF_MAX (1024 * 1024)
+#define SP_SERVER_EVENTS 64
+
+struct sp_server;
+struct sp_server_conn;
+
+struct sp_server_job {
+  struct sp_server_conn *conn;
+  /* the "@<tag>" of the request, NULL if untagged */
+  char *tag;
+  char *line;
+  /* "<kind> <file>" of a generating request, a newer request of the
+   * connection with the same key supersedes this one. NULL otherwise. */
+  char *key;
+  /* set once superseded, read by the worker and the parse */
+  size_t cancel;
+  /* set by the worker once it runs, after the identity of the file of $key
+   * it is about to read: $ino 0 when it could not stat it */
+  size_t started;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  struct sp_ts_limits limits;
+  json_t *response;
+  struct sp_server_job *next;
+  /* $conn->keyed */
+  struct sp_server_job *sibling;
+};
+
+/* open/prefetch of $path */
+struct sp_server_warm {
+  struct sp_server *server;
+  char *path;
+  /* also warm the files $path includes */
+  bool includes;
+  /* of $path, NULL when it is not in the compdb */
+  const struct sp_ts_compdb_unit *unit;
+};
+
+struct sp_server_conn {
+  struct sp_server *server;
+  int in_fd;
+  int out_fd;
+  /* a socket client, stdin/stdout otherwise */
+  bool socket;
+  /* $in_fd is watched by epoll, not possible for a regular file */
+  bool polled;
+  /* registered epoll events, 0 when not registered */
+  uint32_t events;
+
+  char *rbuf;
+  size_t l_rbuf;
+  size_t c_rbuf;
+  /* [o_wbuf, l_wbuf) is not yet written */
+  char *wbuf;
+  size_t o_wbuf;
+  size_t l_wbuf;
+  size_t c_wbuf;
+
+  /* untagged requests run one at a time, the rest wait in [head, tail] */
+  bool busy;
+  struct sp_server_job *head;
+  struct sp_server_job *tail;
+  /* queued or running jobs with a key, false when every request is to be
+   * answered in full (a batch of requests read from a file) */
+  bool coalesce;
+  struct sp_server_job *keyed;
+  /* jobs handed to the pool and not yet completed */
+  size_t inflight;
+
+  /* nothing more is read */
+  bool eof;
+  /* writing failed, output is discarded */
+  bool dead;
+
+  struct sp_server_conn *prev;
+  struct sp_server_conn *next;
+};
+
+struct sp_server {
+  const struct sp_server_options *options;
+  int epoll_fd;
+  int listen_fd;
+  /* eventfd, signaled by workers when a job completes */
+  int done_fd;
+  int signal_fd;
+  /* unlinked on shutdown, set once bound */
+  const char *socket_path;
+  struct sp_server_conn *conns;
+  /* requests run interactive, prefetching in the background */
+  struct sp_ts_pool pool;
+  /* set on shutdown, cancels background parses */
+  size_t halt;
+
+  /* shared by the workers */
+  struct sp_ts_cache cache;
+  /* directories of cached files, NULL without inotify */
+  struct sp_ts_watch *files;
+  struct sp_ts_watch files_storage;
+  /* entries dropped because their file changed */
+  uint64_t invalidated;
+  /* read only once loaded, empty without a compile_commands.json */
+  struct sp_ts_compdb compdb;
+  /* typedefs and enums of the headers files include */
+  struct sp_ts_types types;
+
+  /* completed jobs, most recent first */
+  pthread_mutex_t done_lock;
+  struct sp_server_job *done;
+  /* requests answered cancelled because a newer one replaced them */
+  uint64_t superseded;
+
+  bool stop;
+};
+
+static json_t *
+sp_server_error(const char *message)
+{
+  return json_pack("{s:s}", "error", message);
+}
+
+/* split off the next ' ' separated token of $it */
+static char *
+sp_server_token(char **it)
+{
+  char *result = *it;
+  char *end;
+
+  if (!result || *result == '\0') {
+    return NULL;
+  }
+  if ((end = strchr(result, ' '))) {
+    *end = '\0';
+    *it  = end + 1;
+  } else {
+    *it = NULL;
+  }
+
+  return result;
+}
+
+/* resident set size of the process, 0 if unknown */
+static size_t
+sp_server_rss(void)
+{
+  unsigned long size     = 0;
+  unsigned long resident = 0;
+  FILE *f;
+
+  if (!(f = fopen("/proc/self/statm", "r"))) {
+    return 0;
+  }
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(f);
+
+  return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static json_t *
+sp_server_stats(struct sp_server *self)
+{
+  struct sp_ts_cache_stats stats;
+
+  sp_ts_cache_stats(&self->cache, &stats);
+  return json_pack(
+    "{s:{s:I, s:I, s:I, s:I, s:I, s:I, s:I}, s:I, s:I}", "cache", "entries",
+    (json_int_t)stats.entries, "bytes", (json_int_t)stats.bytes, "budget",
+    (json_int_t)stats.budget, "hits", (json_int_t)stats.hits, "misses",
+    (json_int_t)stats.misses, "evictions", (json_int_t)stats.evictions,
+    "invalidated",
+    (json_int_t)__atomic_load_n(&self->invalidated, __ATOMIC_RELAXED),
+    "superseded",
+    (json_int_t)__atomic_load_n(&self->superseded, __ATOMIC_RELAXED), "rss",
+    (json_int_t)sp_server_rss());
+}
+
+static void
+sp_server_prefetch(struct sp_server *self, const char *path, bool includes);
+
+/* sp_ts_cache_get() of a file that is then watched for changes */
+static struct sp_ts_cache_entry *
+sp_server_get(struct sp_server *self,
+              const char *path,
+              const struct sp_ts_limits *limits,
+              enum sp_ts_parse_res *parse,
+              TSTree **tree)
+{
+  struct sp_ts_cache_entry *result;
+
+  result = sp_ts_cache_get(&self->cache, path, limits, parse, tree);
+  if (result && self->files) {
+    sp_ts_watch_file(self->files, result->path);
+  }
+  return result;
+}
+
+/* sp_ts_types_watch_cb, headers followed for types are parsed into the cache
+ * without sp_server_get() */
+static void
+sp_server_types_watch(void *closure, const char *path)
+{
+  struct sp_server *self = closure;
+  if (self->files) {
+    sp_ts_watch_file(self->files, path);
+  }
+}
+
+/* sp_ts_watch_cb, forget a changed file and parse it again in the
+ * background so the next request on it finds it hot */
+static void
+sp_server_changed(void *closure, const char *path, bool removed)
+{
+  struct sp_server *self = closure;
+
+  if (!path) {
+    /* anything may have changed, not only what the next requests validate */
+    fprintf(stderr, "%s: inotify events lost\n", __func__);
+    __atomic_add_fetch(&self->invalidated, sp_ts_cache_clear(&self->cache),
+                       __ATOMIC_RELAXED);
+    sp_ts_types_invalidate(&self->types, NULL);
+    return;
+  }
+  /* also when no longer cached, the headers of a file are remembered longer
+   * than the headers themselves */
+  sp_ts_types_invalidate(&self->types, path);
+  if (sp_ts_cache_drop(&self->cache, path)) {
+    __atomic_add_fetch(&self->invalidated, 1, __ATOMIC_RELAXED);
+    if (!removed) {
+      sp_server_prefetch(self, path, false);
+    }
+  }
+}
+
+/* sp_ts_include_cb, looked up next to the includer and in the include
+ * paths of the compdb */
+static int
+sp_server_warm_include(void *closure, const char *path, bool system)
+{
+  struct sp_server_warm *self = closure;
+  char *header;
+
+  if ((header = sp_ts_compdb_resolve(&self->server->compdb, self->unit,
+                                     self->path, path, system))) {
+    sp_server_prefetch(self->server, header, false);
+    free(header);
+  }
+
+  return 0;
+}
+
+/* sp_ts_pool_fn, parse $path and extract its declarations so they are hot
+ * for the first request */
+static void
+sp_server_warm(void *arg)
+{
+  struct sp_server_warm *warm = arg;
+  struct sp_server *self      = warm->server;
+  struct sp_ts_limits limits  = {.cancel = &self->halt};
+  struct sp_ts_cache_entry *entry;
+  TSTree *tree;
+
+  if (__atomic_load_n(&self->halt, __ATOMIC_RELAXED)) {
+    goto Lout;
+  }
+  entry = sp_server_get(self, warm->path, &limits, NULL, &tree);
+  if (!entry) {
+    goto Lout;
+  }
+  sp_ts_cache_decls(&self->cache, entry, tree);
+  if (warm->includes) {
+    struct sp_ts_Context ctx = {0};
+    ctx.file                 = entry->file;
+    ctx.tree                 = tree;
+    warm->unit               = sp_ts_compdb_unit(&self->compdb, warm->path);
+    sp_ts_includes(&ctx, sp_server_warm_include, warm);
+  }
+  ts_tree_delete(tree);
+  sp_ts_cache_release(&self->cache, entry);
+
+Lout:
+  free(warm->path);
+  free(warm);
+}
+
+/* Queue a warm up of $path as background work, thread safe */
+static void
+sp_server_prefetch(struct sp_server *self, const char *path, bool includes)
+{
+  struct sp_server_warm *warm;
+
+  if (!(warm = calloc(1, sizeof(*warm)))) {
+    return;
+  }
+  warm->server   = self;
+  warm->includes = includes;
+  if (!(warm->path = strdup(path)) ||
+      sp_ts_pool_submit(&self->pool, SP_TS_POOL_BACKGROUND, sp_server_warm,
+                        warm) != 0) {
+    free(warm->path);
+    free(warm);
+  }
+}
+
+static const char *const sp_server_decl_kinds[] = {
+  [SP_TS_FIELD]   = "field",
+  [SP_TS_ENUM]    = "enum",
+  [SP_TS_LOCAL]   = "local",
+  [SP_TS_GLOBAL]  = "global",
+  [SP_TS_TYPEDEF] = "typedef",
+};
+
+static json_t *
+sp_server_decls(struct sp_server *self,
+                const char *file,
+                const struct sp_ts_limits *limits)
+{
+  const struct sp_ts_decls *decls;
+  struct sp_ts_cache_entry *entry;
+  enum sp_ts_parse_res parse;
+  json_t *result = NULL;
+  json_t *arr;
+  TSTree *tree;
+  size_t i;
+
+  if (!(entry = sp_server_get(self, file, limits, &parse, &tree))) {
+    if (parse == SP_TS_PARSE_TIMEOUT || parse == SP_TS_PARSE_CANCELLED) {
+      return json_pack("{s:[], s:b}", "decls",
+                       parse == SP_TS_PARSE_TIMEOUT ? "timeout" : "cancelled",
+                       1);
+    }
+    return sp_server_error("failed to read file");
+  }
+
+  if (!(decls = sp_ts_cache_decls(&self->cache, entry, tree)) ||
+      !(arr = json_array())) {
+    goto Lout;
+  }
+  for (i = 0; i < decls->length; ++i) {
+    const struct sp_ts_decl *it = &decls->arr[i];
+    json_array_append_new(
+      arr, json_pack("{s:s, s:s?, s:s?, s:s?, s:i, s:i}", "kind",
+                     sp_server_decl_kinds[it->kind], "scope", it->scope,
+                     "name", it->name, "type", it->type, "pointer",
+                     (int)it->pointer, "line", (int)it->line));
+  } //for
+  result = json_pack("{s:o}", "decls", arr);
+
+Lout:
+  ts_tree_delete(tree);
+  sp_ts_cache_release(&self->cache, entry);
+  return result;
+}
+
+/* Runs on a worker */
+static json_t *
+sp_server_request(struct sp_server *self,
+                  char *line,
+                  const struct sp_ts_limits *limits)
+{
+  struct sp_ts_Context ctx = {0};
+  struct sp_ts_types_request types;
+  struct sp_ts_cache_entry *entry;
+  enum sp_ts_parse_res parse;
+  const char *in_type;
+  const char *in_line;
+  const char *in_column;
+  const char *file;
+  json_t *result;
+  TSPoint pos;
+
+  if (!(in_type = sp_server_token(&line))) {
+    return sp_server_error("empty request");
+  }
+
+  if (strcmp(in_type, "stats") == 0) {
+    return sp_server_stats(self);
+  }
+
+  if (strcmp(in_type, "open") == 0 || strcmp(in_type, "prefetch") == 0) {
+    /* answered only when tagged, see sp_server_dispatch() */
+    if (!line || *line == '\0') {
+      return sp_server_error("open <file>");
+    }
+    sp_server_prefetch(self, line, true);
+    return json_object();
+  }
+
+  if (strcmp(in_type, "decls") == 0) {
+    if (!line || *line == '\0') {
+      return sp_server_error("decls <file>");
+    }
+    return sp_server_decls(self, line, limits);
+  }
+
+  if (strcmp(in_type, "drop") == 0) {
+    if (!line || *line == '\0') {
+      return sp_server_error("drop <file>");
+    }
+    sp_ts_cache_drop(&self->cache, line);
+    sp_ts_types_invalidate(&self->types, line);
+    return json_object();
+  }
+
+  if (strcmp(in_type, "crunch") != 0 && strcmp(in_type, "locals") != 0 &&
+      strcmp(in_type, "branches") != 0) {
+    return sp_server_error("unknown request");
+  }
+
+  in_line   = sp_server_token(&line);
+  in_column = sp_server_token(&line);
+  /* the rest, paths may contain spaces */
+  file = line;
+  if (!in_line || !in_column || !file || *file == '\0') {
+    return sp_server_error("<type> <line> <column> <file>");
+  }
+  if (!sp_parse_uint32_t(in_line, &pos.row) ||
+      !sp_parse_uint32_t(in_column, &pos.column)) {
+    return sp_server_error("malformed position");
+  }
+
+  entry = sp_server_get(self, file, limits, &parse, &ctx.tree);
+  if (!entry) {
+    if (parse == SP_TS_PARSE_TIMEOUT || parse == SP_TS_PARSE_CANCELLED) {
+      ctx.inserts.parse = parse;
+      return sp_ts_inserts_to_json(&ctx.inserts);
+    }
+    return sp_server_error("failed to read file");
+  }
+
+  /* borrowed from the cache, not closed here. $ctx.tree is our own copy */
+  ctx.file   = entry->file;
+  ctx.domain = get_domain(file);
+  /* field types declared in the headers it includes */
+  sp_ts_types_begin(&self->types, &types, file, limits);
+  ctx.type_cb      = sp_ts_types_lookup;
+  ctx.type_closure = &types;
+
+  sp_ts_request(&ctx, in_type, pos);
+  sp_ts_inserts_finish(&ctx.inserts, ctx.file.content, ctx.file.length);
+  result = sp_ts_inserts_to_json(&ctx.inserts);
+  sp_ts_inserts_free(&ctx.inserts);
+  sp_ts_types_end(&types);
+  ts_tree_delete(ctx.tree);
+  sp_ts_cache_release(&self->cache, entry);
+
+  return result;
+}
+
+static void
+sp_server_job_free(struct sp_server_job *job)
+{
+  if (job->response) {
+    json_decref(job->response);
+  }
+  free(job->tag);
+  free(job->line);
+  free(job->key);
+  free(job);
+}
+
+/* sp_ts_pool_fn */
+static void
+sp_server_work(void *arg)
+{
+  struct sp_server_job *job = arg;
+  struct sp_server *self    = job->conn->server;
+  uint64_t one              = 1;
+
+  if (job->key) {
+    struct stat st;
+    /* before the parse opens it, at worst we think it read an older file */
+    if (stat(strchr(job->key, ' ') + 1, &st) == 0) {
+      job->dev   = st.st_dev;
+      job->ino   = st.st_ino;
+      job->size  = st.st_size;
+      job->mtime = st.st_mtim;
+    }
+    __atomic_store_n(&job->started, 1, __ATOMIC_RELEASE);
+  }
+
+  if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+    /* superseded before it started */
+    struct sp_ts_inserts none = {.parse = SP_TS_PARSE_CANCELLED};
+    job->response             = sp_ts_inserts_to_json(&none);
+  } else {
+    job->response = sp_server_request(self, job->line, &job->limits);
+  }
+
+  if (!job->response) {
+    job->response = sp_server_error("out of memory");
+  }
+  if (job->response && job->tag) {
+    json_object_set_new(job->response, "id", json_string(job->tag));
+  }
+
+  pthread_mutex_lock(&self->done_lock);
+  job->next  = self->done;
+  self->done = job;
+  pthread_mutex_unlock(&self->done_lock);
+
+  if (write(self->done_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    fprintf(stderr, "%s: eventfd: %m\n", __func__);
+  }
+}
+
+static void
+sp_server_submit(struct sp_server *self, struct sp_server_job *job)
+{
+  ++job->conn->inflight;
+  if (sp_ts_pool_submit(&self->pool, SP_TS_POOL_INTERACTIVE, sp_server_work,
+                        job) != 0) {
+    /* no memory to queue it, answer it here instead */
+    sp_server_work(job);
+  }
+}
+
+/* "<kind> <file>" of a crunch|locals|branches request, NULL otherwise */
+static char *
+sp_server_key(const char *line)
+{
+  const char *kind_end;
+  const char *it;
+  char *result;
+
+  if (strncmp(line, "crunch ", 7) != 0 && strncmp(line, "locals ", 7) != 0 &&
+      strncmp(line, "branches ", 9) != 0) {
+    return NULL;
+  }
+  kind_end = strchr(line, ' ');
+  /* past <line> and <column> */
+  if (!(it = strchr(kind_end + 1, ' ')) || !(it = strchr(it + 1, ' '))) {
+    return NULL;
+  }
+  if (asprintf(&result, "%.*s %s", (int)(kind_end - line), line, it + 1) < 0) {
+    return NULL;
+  }
+
+  return result;
+}
+
+/* $job, running, reads the file $st describes */
+static bool
+sp_server_job_read(const struct sp_server_job *job, const struct stat *st)
+{
+  return job->ino != 0 && job->dev == st->st_dev && job->ino == st->st_ino &&
+         job->size == st->st_size &&
+         job->mtime.tv_sec == st->st_mtim.tv_sec &&
+         job->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Cancel the jobs of $conn $job replaces. A queued one is dropped. A running
+ * one only when the file changed since it read it, its parse is abandoned
+ * through the tree-sitter cancellation flag; otherwise its answer is as
+ * current as the one of $job and it is left to complete. */
+static void
+sp_server_supersede(struct sp_server_conn *conn, struct sp_server_job *job)
+{
+  struct sp_server_job *it;
+  bool stated = false;
+  struct stat st;
+
+  for (it = conn->keyed; it; it = it->sibling) {
+    if (strcmp(it->key, job->key) != 0) {
+      continue;
+    }
+    if (__atomic_load_n(&it->started, __ATOMIC_ACQUIRE)) {
+      if (!stated) {
+        /* $key is "<kind> <file>" */
+        if (stat(strchr(job->key, ' ') + 1, &st) != 0) {
+          memset(&st, 0, sizeof(st));
+        }
+        stated = true;
+      }
+      if (sp_server_job_read(it, &st)) {
+        continue;
+      }
+    }
+    if (!__atomic_exchange_n(&it->cancel, 1, __ATOMIC_RELAXED)) {
+      __atomic_add_fetch(&conn->server->superseded, 1, __ATOMIC_RELAXED);
+    }
+  } //for
+  job->sibling = conn->keyed;
+  conn->keyed  = job;
+}
+
+/* $line is NUL terminated and without its newline */
+static void
+sp_server_dispatch(struct sp_server_conn *conn, const char *line)
+{
+  struct sp_server *self = conn->server;
+  struct sp_server_job *job;
+
+  /* notifications, not answered */
+  if (strncmp(line, "open ", 5) == 0) {
+    sp_server_prefetch(self, line + 5, true);
+    return;
+  }
+  if (strncmp(line, "prefetch ", 9) == 0) {
+    sp_server_prefetch(self, line + 9, true);
+    return;
+  }
+
+  if (!(job = calloc(1, sizeof(*job)))) {
+    return;
+  }
+  job->conn = conn;
+
+  if (line[0] == '@') {
+    const char *end = strchr(line, ' ');
+    size_t l_tag    = end ? (size_t)(end - line) - 1 : strlen(line) - 1;
+
+    if (!(job->tag = strndup(line + 1, l_tag))) {
+      goto Lerr;
+    }
+    line += 1 + l_tag;
+    while (*line == ' ') {
+      ++line;
+    }
+  }
+  if (!(job->line = strdup(line))) {
+    goto Lerr;
+  }
+
+  job->limits.timeout_us = self->options->timeout_us;
+  job->limits.cancel     = &job->cancel;
+  if (conn->coalesce && (job->key = sp_server_key(job->line))) {
+    sp_server_supersede(conn, job);
+  }
+
+  if (job->tag) {
+    sp_server_submit(self, job);
+  } else if (!conn->busy) {
+    conn->busy = true;
+    sp_server_submit(self, job);
+  } else {
+    if (conn->tail) {
+      conn->tail->next = job;
+    } else {
+      conn->head = job;
+    }
+    conn->tail = job;
+  }
+  return;
+
+Lerr:
+  sp_server_job_free(job);
+}
+
+static void
+sp_server_send(struct sp_server_conn *conn, json_t *root)
+{
+  size_t length;
+  char *r;
+
+  if (conn->dead) {
+    return;
+  }
+  if (!(r = json_dumps(root, JSON_PRESERVE_ORDER | JSON_COMPACT))) {
+    return;
+  }
+  length = strlen(r);
+
+  if (conn->o_wbuf > 0) {
+    memmove(conn->wbuf, conn->wbuf + conn->o_wbuf,
+            conn->l_wbuf - conn->o_wbuf);
+    conn->l_wbuf -= conn->o_wbuf;
+    conn->o_wbuf = 0;
+  }
+  if (conn->c_wbuf - conn->l_wbuf < length + 1) {
+    size_t capacity = conn->c_wbuf ? conn->c_wbuf : 4096;
+    char *tmp;
+
+    while (capacity - conn->l_wbuf < length + 1) {
+      capacity *= 2;
+    } //while
+    if (!(tmp = realloc(conn->wbuf, capacity))) {
+      goto Lout;
+    }
+    conn->wbuf   = tmp;
+    conn->c_wbuf = capacity;
+  }
+  memcpy(conn->wbuf + conn->l_wbuf, r, length);
+  conn->wbuf[conn->l_wbuf + length] = '\n';
+  conn->l_wbuf += length + 1;
+
+Lout:
+  free(r);
+}
+
+/* Sockets are written as far as they accept, stdout (owned by whoever
+ * started us) is written in full. */
+static void
+sp_server_flush(struct sp_server_conn *conn)
+{
+  while (!conn->dead && conn->o_wbuf < conn->l_wbuf) {
+    const char *it = conn->wbuf + conn->o_wbuf;
+    size_t length  = conn->l_wbuf - conn->o_wbuf;
+    ssize_t written;
+
+    if (conn->socket) {
+      written = send(conn->out_fd, it, length, MSG_NOSIGNAL);
+    } else {
+      written = write(conn->out_fd, it, length);
+    }
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd pfd = {.fd = conn->out_fd, .events = POLLOUT};
+        if (conn->socket) {
+          /* resumed on EPOLLOUT */
+          return;
+        }
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      if (errno != EPIPE && errno != ECONNRESET) {
+        fprintf(stderr, "%s: write: %m\n", __func__);
+      }
+      conn->dead = true;
+      break;
+    }
+    conn->o_wbuf += (size_t)written;
+  } //while
+
+  if (conn->o_wbuf == conn->l_wbuf || conn->dead) {
+    conn->o_wbuf = conn->l_wbuf = 0;
+  }
+}
+
+static void
+sp_server_read(struct sp_server_conn *conn)
+{
+  ssize_t bytes;
+  char *it;
+  char *nl;
+
+  /* room for one line too long and its NUL at most */
+  if (conn->c_rbuf - conn->l_rbuf < 4096 &&
+      conn->c_rbuf < SP_SERVER_LINE_MAX + 2) {
+    size_t capacity = conn->c_rbuf ? conn->c_rbuf * 2 : 8192;
+    char *tmp;
+
+    if (capacity > SP_SERVER_LINE_MAX + 2) {
+      capacity = SP_SERVER_LINE_MAX + 2;
+    }
+
+    if (!(tmp = realloc(conn->rbuf, capacity))) {
+      conn->eof = true;
+      return;
+    }
+    conn->rbuf   = tmp;
+    conn->c_rbuf = capacity;
+  }
+
+  /* the byte after what is read is kept for the NUL of an unterminated
+   * last line */
+  bytes = read(conn->in_fd, conn->rbuf + conn->l_rbuf,
+               conn->c_rbuf - conn->l_rbuf - 1);
+  if (bytes < 0) {
+    if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+      return;
+    }
+    if (errno != ECONNRESET) {
+      fprintf(stderr, "%s: read: %m\n", __func__);
+    }
+    conn->eof = true;
+  } else if (bytes == 0) {
+    conn->eof = true;
+  }
+  if (bytes > 0) {
+    conn->l_rbuf += (size_t)bytes;
+  }
+
+  it = conn->rbuf;
+  while ((nl = memchr(it, '\n', conn->l_rbuf - (size_t)(it - conn->rbuf)))) {
+    char *end = nl;
+    while (end > it && end[-1] == '\r') {
+      --end;
+    }
+    *end = '\0';
+    sp_server_dispatch(conn, it);
+    it = nl + 1;
+  } //while
+  conn->l_rbuf -= (size_t)(it - conn->rbuf);
+  memmove(conn->rbuf, it, conn->l_rbuf);
+
+  if (conn->l_rbuf > SP_SERVER_LINE_MAX) {
+    json_t *error = sp_server_error("request too long");
+    sp_server_send(conn, error);
+    json_decref(error);
+    conn->l_rbuf = 0;
+    conn->eof    = true;
+  } else if (conn->eof && conn->l_rbuf > 0) {
+    while (conn->l_rbuf > 0 && conn->rbuf[conn->l_rbuf - 1] == '\r') {
+      --conn->l_rbuf;
+    }
+    conn->rbuf[conn->l_rbuf] = '\0';
+    if (conn->l_rbuf > 0) {
+      sp_server_dispatch(conn, conn->rbuf);
+    }
+    conn->l_rbuf = 0;
+  }
+}
+
+static void
+sp_server_conn_free(struct sp_server_conn *conn)
+{
+  while (conn->head) {
+    struct sp_server_job *job = conn->head;
+    conn->head                = job->next;
+    sp_server_job_free(job);
+  } //while
+  if (conn->socket) {
+    close(conn->in_fd);
+  }
+  free(conn->rbuf);
+  free(conn->wbuf);
+  free(conn);
+}
+
+static void
+sp_server_unkey(struct sp_server_conn *conn, struct sp_server_job *job)
+{
+  struct sp_server_job **it;
+
+  for (it = &conn->keyed; *it; it = &(*it)->sibling) {
+    if (*it == job) {
+      *it = job->sibling;
+      break;
+    }
+  } //for
+}
+
+/* Flush, re-arm epoll for what $conn is waiting on, and free it once it has
+ * nothing left to do. */
+static void
+sp_server_update(struct sp_server *self, struct sp_server_conn *conn)
+{
+  uint32_t events = 0;
+  size_t pending;
+
+  sp_server_flush(conn);
+  pending = conn->l_wbuf - conn->o_wbuf;
+
+  if (conn->dead) {
+    struct sp_server_job *it;
+
+    /* nobody to answer, what runs is cancelled and completes on its own */
+    for (it = conn->keyed; it; it = it->sibling) {
+      __atomic_store_n(&it->cancel, 1, __ATOMIC_RELAXED);
+    }
+    while (conn->head) {
+      struct sp_server_job *job = conn->head;
+      if (!(conn->head = job->next)) {
+        conn->tail = NULL;
+      }
+      sp_server_unkey(conn, job);
+      sp_server_job_free(job);
+    } //while
+  }
+
+  if (!conn->eof && !conn->dead && pending < SP_SERVER_WBUF_MAX) {
+    events |= EPOLLIN;
+  }
+  if (conn->socket && !conn->dead && pending > 0) {
+    events |= EPOLLOUT;
+  }
+
+  if (conn->polled && events != conn->events) {
+    struct epoll_event ev = {.events = events, .data.ptr = conn};
+    int op;
+
+    /* unregistered rather than 0 events, a hangup is reported regardless */
+    if (events == 0) {
+      op = EPOLL_CTL_DEL;
+    } else {
+      op = conn->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    }
+    if (epoll_ctl(self->epoll_fd, op, conn->in_fd, &ev) != 0) {
+      fprintf(stderr, "%s: epoll_ctl: %m\n", __func__);
+      conn->eof  = true;
+      conn->dead = true;
+    } else {
+      conn->events = events;
+    }
+  }
+
+  if ((conn->eof || conn->dead) && conn->inflight == 0 && !conn->head &&
+      conn->l_wbuf == 0) {
+    if (conn->polled && conn->events) {
+      epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, conn->in_fd, NULL);
+    }
+    if (conn->prev) {
+      conn->prev->next = conn->next;
+    } else {
+      self->conns = conn->next;
+    }
+    if (conn->next) {
+      conn->next->prev = conn->prev;
+    }
+    if (!conn->socket) {
+      /* stdin/stdout is the only client */
+      self->stop = true;
+    }
+    sp_server_conn_free(conn);
+  }
+}
+
+static struct sp_server_conn *
+sp_server_conn_new(struct sp_server *self,
+                   int in_fd,
+                   int out_fd,
+                   bool is_socket)
+{
+  struct sp_server_conn *conn;
+
+  if (!(conn = calloc(1, sizeof(*conn)))) {
+    return NULL;
+  }
+  conn->server  = self;
+  conn->in_fd   = in_fd;
+  conn->out_fd  = out_fd;
+  conn->socket  = is_socket;
+  conn->polled   = true;
+  conn->coalesce = true;
+
+  conn->next = self->conns;
+  if (self->conns) {
+    self->conns->prev = conn;
+  }
+  self->conns = conn;
+
+  return conn;
+}
+
+static void
+sp_server_accept(struct sp_server *self)
+{
+  int fd;
+
+  while ((fd = accept4(self->listen_fd, NULL, NULL,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    struct sp_server_conn *conn;
+    if (!(conn = sp_server_conn_new(self, fd, fd, true))) {
+      close(fd);
+      continue;
+    }
+    sp_server_update(self, conn);
+  } //while
+
+  if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    fprintf(stderr, "%s: accept: %m\n", __func__);
+  }
+}
+
+/* Hand the completed jobs to their connections */
+static void
+sp_server_complete(struct sp_server *self)
+{
+  struct sp_server_job *done = NULL;
+  struct sp_server_job *job;
+  uint64_t count;
+
+  if (read(self->done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    fprintf(stderr, "%s: eventfd: %m\n", __func__);
+  }
+
+  pthread_mutex_lock(&self->done_lock);
+  job        = self->done;
+  self->done = NULL;
+  pthread_mutex_unlock(&self->done_lock);
+
+  /* back into completion order */
+  while (job) {
+    struct sp_server_job *next = job->next;
+    job->next                  = done;
+    done                       = job;
+    job                        = next;
+  } //while
+
+  while ((job = done)) {
+    struct sp_server_conn *conn = job->conn;
+    done                        = job->next;
+
+    --conn->inflight;
+    sp_server_unkey(conn, job);
+    if (job->response) {
+      sp_server_send(conn, job->response);
+    }
+    if (!job->tag) {
+      struct sp_server_job *next;
+      if ((next = conn->head)) {
+        if (!(conn->head = next->next)) {
+          conn->tail = NULL;
+        }
+        next->next = NULL;
+        sp_server_submit(self, next);
+      } else {
+        conn->busy = false;
+      }
+    }
+    sp_server_job_free(job);
+    sp_server_update(self, conn);
+  } //while
+}
+
+static int
+sp_server_listen(struct sp_server *self, const char *path)
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  struct stat st;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path '%s' is too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  /* left behind by a server that did not shut down, unless it still
+   * accepts */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 &&
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 &&
+        errno == ECONNREFUSED) {
+      unlink(path);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  self->listen_fd =
+    socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (self->listen_fd < 0) {
+    fprintf(stderr, "%s: socket: %m\n", __func__);
+    return -1;
+  }
+  if (bind(self->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(self->listen_fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Unable to listen on '%s': %m\n", path);
+    return -1;
+  }
+  self->socket_path = path;
+
+  return 0;
+}
+
+static int
+sp_server_watch(struct sp_server *self, int fd, int *tag)
+{
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = tag};
+  return epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* stdin/stdout as the one client */
+static int
+sp_server_stdio(struct sp_server *self)
+{
+  struct epoll_event ev = {.events = EPOLLIN};
+  struct sp_server_conn *conn;
+
+  if (!(conn = sp_server_conn_new(self, STDIN_FILENO, STDOUT_FILENO, false))) {
+    return -1;
+  }
+
+  ev.data.ptr = conn;
+  if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, conn->in_fd, &ev) == 0) {
+    conn->events = ev.events;
+  } else if (errno == EPERM) {
+    /* A regular file can not be polled, it is always readable. It is a
+     * batch where every request wants its answer. */
+    conn->polled   = false;
+    conn->coalesce = false;
+    while (!conn->eof) {
+      sp_server_read(conn);
+    } //while
+  } else {
+    fprintf(stderr, "%s: epoll_ctl: %m\n", __func__);
+    return -1;
+  }
+  sp_server_update(self, conn);
+
+  return 0;
+}
+
+int
+sp_server_main(const struct sp_server_options *options)
+{
+  struct sp_server self = {
+    .options   = options,
+    .epoll_fd  = -1,
+    .listen_fd = -1,
+    .done_fd   = -1,
+    .signal_fd = -1,
+  };
+  struct epoll_event events[SP_SERVER_EVENTS];
+  int res      = EXIT_FAILURE;
+  bool pool    = false;
+  char *compdb = NULL;
+  size_t workers;
+  sigset_t mask;
+
+  pthread_mutex_init(&self.done_lock, NULL);
+  sp_ts_compdb_init(&self.compdb);
+  sp_ts_types_init(&self.types, &self.cache, &self.compdb,
+                   sp_server_types_watch, &self);
+  if (sp_ts_cache_init(&self.cache, options->cache_budget) != 0) {
+    goto Lout;
+  }
+  if (options->compdb) {
+    if (sp_ts_compdb_load(&self.compdb, options->compdb) != 0) {
+      goto Lout;
+    }
+  } else if ((compdb = sp_ts_compdb_locate("."))) {
+    /* best effort, includes are then only looked up next to the includer */
+    sp_ts_compdb_load(&self.compdb, compdb);
+    free(compdb);
+  }
+
+  /* delivered through $signal_fd, blocked before the workers inherit the
+   * mask */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+  /* a client that went away is seen as EPIPE */
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((self.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      (self.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+      (self.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+    fprintf(stderr, "%s: %m\n", __func__);
+    goto Lout;
+  }
+  if (sp_server_watch(&self, self.done_fd, &self.done_fd) != 0 ||
+      sp_server_watch(&self, self.signal_fd, &self.signal_fd) != 0) {
+    fprintf(stderr, "%s: epoll_ctl: %m\n", __func__);
+    goto Lout;
+  }
+  /* without inotify cached entries are still validated on use */
+  if (sp_ts_watch_init(&self.files_storage) == 0 &&
+      sp_server_watch(&self, self.files_storage.fd, &self.files_storage.fd) ==
+        0) {
+    self.files = &self.files_storage;
+  } else {
+    sp_ts_watch_free(&self.files_storage);
+  }
+
+  workers = options->workers;
+  if (workers == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    workers     = online > 0 ? (size_t)online : 1;
+  }
+  /* background work never takes the last worker, so it needs a second one
+   * to run on */
+  if (sp_ts_pool_init(&self.pool, workers > 2 ? workers : 2) != 0) {
+    goto Lout;
+  }
+  pool = true;
+
+  if (options->socket) {
+    if (sp_server_listen(&self, options->socket) != 0 ||
+        sp_server_watch(&self, self.listen_fd, &self.listen_fd) != 0) {
+      goto Lout;
+    }
+  } else if (sp_server_stdio(&self) != 0) {
+    goto Lout;
+  }
+
+  while (!self.stop) {
+    bool completed = false;
+    int n;
+    int i;
+
+    if ((n = epoll_wait(self.epoll_fd, events, SP_SERVER_EVENTS, -1)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "%s: epoll_wait: %m\n", __func__);
+      goto Lout;
+    }
+
+    for (i = 0; i < n; ++i) {
+      void *tag = events[i].data.ptr;
+
+      if (tag == &self.listen_fd) {
+        sp_server_accept(&self);
+      } else if (tag == &self.done_fd) {
+        /* after the batch, it can free connections the batch refers to */
+        completed = true;
+      } else if (tag == &self.signal_fd) {
+        self.stop = true;
+      } else if (tag == &self.files_storage.fd) {
+        sp_ts_watch_read(self.files, sp_server_changed, &self);
+      } else {
+        struct sp_server_conn *conn = tag;
+        if (!conn->eof &&
+            (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+          sp_server_read(conn);
+        }
+        sp_server_update(&self, conn);
+      }
+    } //for
+
+    if (completed) {
+      sp_server_complete(&self);
+    }
+  } //while
+
+  res = EXIT_SUCCESS;
+Lout:
+  __atomic_store_n(&self.halt, 1, __ATOMIC_RELAXED);
+  if (pool) {
+    /* runs what is queued, the answers are dropped */
+    sp_ts_pool_free(&self.pool);
+  }
+  while (self.done) {
+    struct sp_server_job *job = self.done;
+    self.done                 = job->next;
+    sp_server_job_free(job);
+  } //while
+  while (self.conns) {
+    struct sp_server_conn *conn = self.conns;
+    self.conns                  = conn->next;
+    sp_server_conn_free(conn);
+  } //while
+  if (self.listen_fd >= 0) {
+    close(self.listen_fd);
+  }
+  if (self.socket_path) {
+    unlink(self.socket_path);
+  }
+  if (self.signal_fd >= 0) {
+    close(self.signal_fd);
+  }
+  if (self.done_fd >= 0) {
+    close(self.done_fd);
+  }
+  if (self.epoll_fd >= 0) {
+    close(self.epoll_fd);
+  }
+  if (self.files) {
+    sp_ts_watch_free(self.files);
+  }
+  sp_ts_types_free(&self.types);
+  sp_ts_cache_free(&self.cache);
+  sp_ts_compdb_free(&self.compdb);
+  pthread_mutex_destroy(&self.done_lock);
+
+  return res;
+}
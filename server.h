@@ -0,0 +1,69 @@
+#ifndef SP_TS_SERVER_H
+#define SP_TS_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ======================================== */
+/* Long running request loop, `sp_struct_to_string serve`. One request per
+ * line:
+ *   [@<tag>] crunch|locals|branches <line> <column> <file>
+ *   [@<tag>] decls <file>
+ *   [@<tag>] drop <file>
+ *   [@<tag>] stats
+ * answered by one json line, {"inserts": [...]}, {"decls": [...]} or
+ * {"error": "..."}.
+ *
+ *   open|prefetch <file>
+ * is a notification, answered ({}) only when tagged. $file and the headers
+ * it includes are parsed and their declarations extracted as background
+ * work, so the first request on them does not wait for it. Headers are
+ * looked up like the compiler does, with the include paths $compdb has for
+ * $file (those of every unit when it has none for it).
+ *
+ * Clients are stdin/stdout, or with $socket any number of connections to a
+ * unix socket at that path. Connections are served from one epoll loop and
+ * the requests themselves run on $workers threads, a client that is slow to
+ * send or to read its answers only holds up itself. Requests take precedence
+ * over queued background work, which never occupies every worker.
+ *
+ * Untagged requests of a connection are answered in order. Tagged requests
+ * are pipelined: they run concurrently and are answered as they complete,
+ * with the tag echoed as "id".
+ *
+ * Files and trees are cached between requests, least recently used entries
+ * are evicted once their approximate footprint exceeds $cache_budget bytes
+ * (0 unbounded). The directories of cached files are watched (inotify): a
+ * file written, replaced or removed is dropped from the cache and, unless
+ * removed, parsed again as background work.
+ *
+ * Field types a file does not declare itself are looked up in the headers it
+ * includes, followed when first needed and parsed into the same cache: a
+ * typedef is printed as what it names, an enum by its enumerators and a C
+ * struct member by member. What a file's headers declare is remembered until
+ * one of them changes.
+ *
+ * A parse gets $timeout_us (0 unbounded). A generating request is superseded
+ * by a newer one of the same connection, kind and file: it is dropped if not
+ * yet started, and its parse is cancelled if running on a file that has
+ * changed since. The answer is then {"inserts": [], "timeout": true} or
+ * {"inserts": [], "cancelled": true}.
+ * Requests read from a regular file are never superseded.
+ */
+struct sp_server_options {
+  /* unix socket to listen on, NULL to serve stdin/stdout */
+  const char *socket;
+  /* compile_commands.json, NULL for the closest one from the working
+   * directory up, if any */
+  const char *compdb;
+  size_t cache_budget;
+  uint64_t timeout_us;
+  /* 0 is one per online cpu, at least 2 are started so background work
+   * always leaves one for requests */
+  size_t workers;
+};
+
+int
+sp_server_main(const struct sp_server_options *);
+
+#endif
@@ -2,12 +2,15 @@
 
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 
 typedef struct {
   int dummy;
@@ -80,6 +83,13 @@ mmap_file(const char *file, struct sp_ts_file *result)
     goto Lerr;
   }
 
+  if ((uint64_t)st.st_size > SP_TS_MAX_INPUT) {
+    fprintf(stderr, "File: '%s' is larger than the 4GiB tree-sitter can "
+                    "address\n",
+            file);
+    goto Lerr;
+  }
+
   result->length  = (size_t)st.st_size;
   result->content = mmap(NULL, result->length, PROT_READ,
                          MAP_PRIVATE | MAP_FILE, result->fd, 0);
@@ -87,6 +97,7 @@ mmap_file(const char *file, struct sp_ts_file *result)
     fprintf(stderr, "mmap failed on '%s': %m\n", file);
     goto Lerr;
   }
+  result->mapped = true;
 
   return 0;
 Lerr:
@@ -97,6 +108,663 @@ Lerr:
   return -1;
 }
 
+int
+fd_file(int fd, struct sp_ts_file *result)
+{
+  struct stat st  = {0};
+  size_t capacity = 0;
+  char *tmp;
+
+  memset(result, 0, sizeof(*result));
+  result->fd = -1;
+
+  if (fstat(fd, &st) < 0) {
+    fprintf(stderr, "fstat failed on fd %d: %m\n", fd);
+    return -1;
+  }
+
+  if (S_ISREG(st.st_mode) && (uint64_t)st.st_size > SP_TS_MAX_INPUT) {
+    fprintf(stderr, "fd %d is larger than the 4GiB tree-sitter can address\n",
+            fd);
+    return -1;
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    /* a file or memfd, map it so the bytes are never copied */
+    result->length  = (size_t)st.st_size;
+    result->content = mmap(NULL, result->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (result->content == MAP_FAILED) {
+      fprintf(stderr, "mmap failed on fd %d: %m\n", fd);
+      memset(result, 0, sizeof(*result));
+      result->fd = -1;
+      return -1;
+    }
+    result->mapped = true;
+    return 0;
+  }
+
+  /* a pipe or tty */
+  for (;;) {
+    ssize_t n;
+    if (result->length == capacity) {
+      capacity = capacity ? capacity * 2 : 64 * 1024;
+      if (!(tmp = realloc(result->content, capacity))) {
+        goto Lerr;
+      }
+      result->content = tmp;
+    }
+    n = read(fd, result->content + result->length, capacity - result->length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "read failed on fd %d: %m\n", fd);
+      goto Lerr;
+    }
+    if (n == 0) {
+      break;
+    }
+    result->length += (size_t)n;
+    if (result->length > SP_TS_MAX_INPUT) {
+      /* rather than buffering all of it */
+      fprintf(stderr, "fd %d is larger than the 4GiB tree-sitter can "
+                      "address\n",
+              fd);
+      goto Lerr;
+    }
+  } //for
+
+  return 0;
+Lerr:
+  free(result->content);
+  memset(result, 0, sizeof(*result));
+  result->fd = -1;
+  return -1;
+}
+
+int
+sp_ts_file_close(struct sp_ts_file *self)
+{
+  if (self->mapped) {
+    munmap(self->content, self->length);
+  } else {
+    free(self->content);
+  }
+  if (self->fd >= 0) {
+    close(self->fd);
+  }
+  memset(self, 0, sizeof(*self));
+  self->fd = -1;
+
+  return 0;
+}
+
+char *
+sp_ts_path_canonical(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  const char *name  = slash ? slash + 1 : path;
+  char *result;
+  char *dir;
+  size_t length;
+
+  if ((result = realpath(path, NULL))) {
+    return result;
+  }
+
+  /* removed, renamed away or not yet there */
+  if (!slash) {
+    dir = strdup(".");
+  } else if (slash == path) {
+    dir = strdup("/");
+  } else {
+    dir = strndup(path, (size_t)(slash - path));
+  }
+  if (!dir || !(result = realpath(dir, NULL))) {
+    free(dir);
+    return strdup(path);
+  }
+  free(dir);
+
+  if (strcmp(result, "/") == 0) {
+    result[0] = '\0';
+  }
+  length = strlen(result) + 1 + strlen(name) + 1;
+  if ((dir = malloc(length))) {
+    snprintf(dir, length, "%s/%s", result, name);
+  }
+  free(result);
+
+  return dir;
+}
+
+/* granularity at which $preempt is polled */
+#define SP_TS_PARSE_SLICE_US 10000
+
+static uint64_t
+sp_ts_now_us(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+static enum sp_ts_parse_res
+sp_ts_parse_slices(TSParser *parser,
+                   const TSTree *old,
+                   TSInput input,
+                   const struct sp_ts_limits *limits,
+                   TSTree **out)
+{
+  enum sp_ts_parse_res res = SP_TS_PARSE_FAILED;
+  uint64_t deadline        = 0;
+
+  *out = NULL;
+  if (!ts_parser_language(parser)) {
+    return SP_TS_PARSE_FAILED;
+  }
+  if (!limits) {
+    *out = ts_parser_parse(parser, old, input);
+    return *out ? SP_TS_PARSED : SP_TS_PARSE_FAILED;
+  }
+
+  if (limits->timeout_us > 0) {
+    deadline = sp_ts_now_us() + limits->timeout_us;
+  }
+  ts_parser_set_cancellation_flag(parser, limits->cancel);
+
+  /* A halted parse resumes where it stopped when called again with the same
+   * arguments, so the budget is spent in slices with $preempt polled in
+   * between. */
+  for (;;) {
+    uint64_t slice = limits->preempt ? SP_TS_PARSE_SLICE_US : 0;
+
+    if (deadline) {
+      uint64_t now = sp_ts_now_us();
+      if (now >= deadline) {
+        res = SP_TS_PARSE_TIMEOUT;
+        break;
+      }
+      if (!slice || deadline - now < slice) {
+        slice = deadline - now;
+      }
+    }
+    ts_parser_set_timeout_micros(parser, slice);
+
+    if ((*out = ts_parser_parse(parser, old, input))) {
+      res = SP_TS_PARSED;
+      break;
+    }
+    if (limits->cancel && __atomic_load_n(limits->cancel, __ATOMIC_RELAXED)) {
+      res = SP_TS_PARSE_CANCELLED;
+      break;
+    }
+    if (!slice) {
+      break;
+    }
+    if (limits->preempt && limits->preempt(limits->closure)) {
+      res = SP_TS_PARSE_CANCELLED;
+      break;
+    }
+  } //for
+
+  if (res != SP_TS_PARSED) {
+    ts_parser_reset(parser);
+  }
+  ts_parser_set_timeout_micros(parser, 0);
+  ts_parser_set_cancellation_flag(parser, NULL);
+
+  return res;
+}
+
+struct sp_ts_string {
+  const char *content;
+  uint32_t length;
+};
+
+static const char *
+sp_ts_string_read(void *payload,
+                  uint32_t byte,
+                  TSPoint position,
+                  uint32_t *bytes_read)
+{
+  const struct sp_ts_string *self = payload;
+  (void)position;
+
+  if (byte >= self->length) {
+    *bytes_read = 0;
+    return "";
+  }
+  *bytes_read = self->length - byte;
+  return self->content + byte;
+}
+
+enum sp_ts_parse_res
+sp_ts_parse(TSParser *parser,
+            const TSTree *old,
+            const char *content,
+            size_t length,
+            const struct sp_ts_limits *limits,
+            TSTree **out)
+{
+  struct sp_ts_string string = {.content = content};
+  TSInput input = {.payload  = &string,
+                   .read     = sp_ts_string_read,
+                   .encoding = TSInputEncodingUTF8};
+
+  *out = NULL;
+  if (length > SP_TS_MAX_INPUT) {
+    return SP_TS_PARSE_FAILED;
+  }
+  string.length = (uint32_t)length;
+
+  return sp_ts_parse_slices(parser, old, input, limits, out);
+}
+
+/* ======================================== */
+int
+sp_ts_input_open(struct sp_ts_input *self, int fd, bool owned)
+{
+  struct stat st;
+
+  memset(self, 0, sizeof(*self));
+  self->fd = -1;
+
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    return 1;
+  }
+  if ((uint64_t)st.st_size > SP_TS_MAX_INPUT) {
+    fprintf(stderr, "fd %d: %jd bytes, larger than the 4GiB tree-sitter can "
+                    "address\n",
+            fd, (intmax_t)st.st_size);
+    return -1;
+  }
+  if (!(self->chunk = malloc(SP_TS_INPUT_CHUNK))) {
+    return -1;
+  }
+  self->fd     = fd;
+  self->owned  = owned;
+  self->length = (uint32_t)st.st_size;
+
+  return 0;
+}
+
+static const char *
+sp_ts_input_read(void *payload,
+                 uint32_t byte,
+                 TSPoint position,
+                 uint32_t *bytes_read)
+{
+  struct sp_ts_input *self = payload;
+  uint32_t offset;
+  ssize_t n;
+  (void)position;
+
+  *bytes_read = 0;
+  if (byte >= self->length) {
+    return "";
+  }
+
+  if (byte < self->offset || byte >= self->offset + self->l_chunk) {
+    /* the parser only holds on to the latest chunk, the buffer is reused */
+    offset = byte - byte % SP_TS_INPUT_CHUNK;
+    do {
+      n = pread(self->fd, self->chunk, SP_TS_INPUT_CHUNK, (off_t)offset);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+      /* the parse ends here, its result is discarded */
+      self->failed  = true;
+      self->l_chunk = 0;
+      return "";
+    }
+    self->offset  = offset;
+    self->l_chunk = (uint32_t)n;
+    if (byte >= self->offset + self->l_chunk) {
+      /* truncated under us */
+      self->failed = true;
+      return "";
+    }
+  }
+
+  *bytes_read = self->offset + self->l_chunk - byte;
+  return self->chunk + (byte - self->offset);
+}
+
+enum sp_ts_parse_res
+sp_ts_parse_input(TSParser *parser,
+                  const TSTree *old,
+                  struct sp_ts_input *self,
+                  const struct sp_ts_limits *limits,
+                  TSTree **out)
+{
+  TSInput input = {.payload  = self,
+                   .read     = sp_ts_input_read,
+                   .encoding = TSInputEncodingUTF8};
+  enum sp_ts_parse_res res;
+
+  self->failed  = false;
+  self->l_chunk = 0;
+  res           = sp_ts_parse_slices(parser, old, input, limits, out);
+  if (res == SP_TS_PARSED && self->failed) {
+    fprintf(stderr, "read failed on fd %d\n", self->fd);
+    ts_tree_delete(*out);
+    *out = NULL;
+    res  = SP_TS_PARSE_FAILED;
+  }
+
+  return res;
+}
+
+int
+sp_ts_input_close(struct sp_ts_input *self)
+{
+  if (self->owned && self->fd >= 0) {
+    close(self->fd);
+  }
+  free(self->chunk);
+  memset(self, 0, sizeof(*self));
+  self->fd = -1;
+
+  return 0;
+}
+
+const char *
+sp_ts_parse_res_str(enum sp_ts_parse_res res)
+{
+  if (res == SP_TS_PARSED) {
+    return "parsed";
+  } else if (res == SP_TS_PARSE_TIMEOUT) {
+    return "timeout";
+  } else if (res == SP_TS_PARSE_CANCELLED) {
+    return "cancelled";
+  }
+  return "failed to parse";
+}
+
+/* $i past the end of the comment/literal/directive starting at $i, $length
+ * when it does not end */
+static size_t
+sp_ts_skip_comment(const char *content, size_t length, size_t i)
+{
+  for (i += 2; i + 1 < length; ++i) {
+    if (content[i] == '*' && content[i + 1] == '/') {
+      return i + 2;
+    }
+  } //for
+  return length;
+}
+
+static size_t
+sp_ts_skip_line(const char *content, size_t length, size_t i)
+{
+  for (; i < length && content[i] != '\n'; ++i) {
+    if (content[i] == '\\' && i + 1 < length) {
+      /* continuation */
+      ++i;
+    }
+  } //for
+  return i;
+}
+
+/* a literal spanning lines (C++ raw string, broken code) is $length */
+static size_t
+sp_ts_skip_literal(const char *content, size_t length, size_t i)
+{
+  char quote = content[i];
+  for (++i; i < length && content[i] != '\n'; ++i) {
+    if (content[i] == '\\') {
+      ++i;
+    } else if (content[i] == quote) {
+      return i + 1;
+    }
+  } //for
+  return length;
+}
+
+static bool
+sp_ts_is_conditional(const char *it, const char *end)
+{
+  static const char *const directives[] = {"if", "elif", "else", "endif"};
+  size_t i;
+
+  /* past '#' */
+  ++it;
+  while (it < end && (*it == ' ' || *it == '\t')) {
+    ++it;
+  }
+  for (i = 0; i < sizeof(directives) / sizeof(directives[0]); ++i) {
+    size_t l = strlen(directives[i]);
+    /* "if" covers ifdef/ifndef */
+    if ((size_t)(end - it) >= l && memcmp(it, directives[i], l) == 0) {
+      return true;
+    }
+  } //for
+  return false;
+}
+
+bool
+sp_ts_decl_range(const char *content,
+                 size_t length,
+                 TSPoint pos,
+                 TSRange *out)
+{
+  size_t line  = 0;
+  size_t start = 0;
+  size_t depth = 0;
+  bool blank   = true;
+  uint32_t row;
+  size_t i;
+
+  for (row = 0; row < pos.row; ++row) {
+    const char *nl = memchr(content + line, '\n', length - line);
+    if (!nl) {
+      return false;
+    }
+    line = (size_t)(nl - content) + 1;
+  } //for
+
+  /* back to the line after the closest column zero '}' above the cursor */
+  for (i = line; i > 0;) {
+    size_t prev = i - 1;
+    while (prev > 0 && content[prev - 1] != '\n') {
+      --prev;
+    }
+    if (content[prev] == '}') {
+      start = i;
+      break;
+    }
+    i = prev;
+    --row;
+  } //for
+
+  for (i = start; i < length; ++i) {
+    char c = content[i];
+
+    if (c == '\n') {
+      blank = true;
+      continue;
+    }
+    if (c == ' ' || c == '\t' || c == '\r') {
+      continue;
+    }
+    if (c == '/' && i + 1 < length && content[i + 1] == '*') {
+      i = sp_ts_skip_comment(content, length, i) - 1;
+      continue;
+    }
+    if (c == '/' && i + 1 < length && content[i + 1] == '/') {
+      i = sp_ts_skip_line(content, length, i) - 1;
+      continue;
+    }
+    if (c == '#' && blank) {
+      size_t eol = sp_ts_skip_line(content, length, i);
+      if (sp_ts_is_conditional(content + i, content + eol)) {
+        /* braces may be unbalanced per branch */
+        return false;
+      }
+      i = eol - 1;
+      continue;
+    }
+    if (c == '"' || c == '\'') {
+      if ((i = sp_ts_skip_literal(content, length, i)) == length) {
+        return false;
+      }
+      --i;
+      blank = false;
+      continue;
+    }
+
+    if (c == '{') {
+      ++depth;
+    } else if (c == '}') {
+      bool column_zero = i == 0 || content[i - 1] == '\n';
+      if (depth == 0) {
+        return false;
+      }
+      --depth;
+      if (column_zero) {
+        if (depth != 0) {
+          /* a nested scope (namespace, extern "C") closed in column zero */
+          return false;
+        }
+        if (i >= line) {
+          const char *nl = memchr(content + i, '\n', length - i);
+          size_t end     = nl ? (size_t)(nl - content) + 1 : length;
+          if (start == 0 && end == length) {
+            return false;
+          }
+          out->start_byte  = (uint32_t)start;
+          out->end_byte    = (uint32_t)end;
+          out->start_point = (TSPoint){row, 0};
+          out->end_point   = sp_ts_point_advance(out->start_point,
+                                                 content + start, end - start);
+          return true;
+        }
+      }
+    }
+    blank = false;
+  } //for
+
+  /* no '}' in column zero after the cursor */
+  return false;
+}
+
+static int
+sp_ts_range_cmp(const void *f, const void *s)
+{
+  const TSRange *first  = f;
+  const TSRange *second = s;
+  if (first->start_byte != second->start_byte) {
+    return first->start_byte < second->start_byte ? -1 : 1;
+  }
+  return 0;
+}
+
+enum sp_ts_parse_res
+sp_ts_parse_at(TSParser *parser,
+               const char *content,
+               size_t length,
+               const TSPoint *pos,
+               size_t n_pos,
+               const struct sp_ts_limits *limits,
+               TSTree **out)
+{
+  enum sp_ts_parse_res res;
+  TSRange *ranges = NULL;
+  uint32_t n_ranges;
+  size_t i;
+
+  if (length > SP_TS_MAX_INPUT || n_pos == 0 || n_pos > UINT32_MAX) {
+    goto Lfull;
+  }
+  if (!(ranges = calloc(n_pos, sizeof(*ranges)))) {
+    goto Lfull;
+  }
+  for (i = 0; i < n_pos; ++i) {
+    if (!sp_ts_decl_range(content, length, pos[i], &ranges[i])) {
+      goto Lfull;
+    }
+  } //for
+
+  /* ascending and disjoint, positions in the same declaration share one */
+  qsort(ranges, n_pos, sizeof(*ranges), sp_ts_range_cmp);
+  for (i = 1, n_ranges = 1; i < n_pos; ++i) {
+    TSRange *last = &ranges[n_ranges - 1];
+    if (ranges[i].start_byte < last->end_byte) {
+      if (ranges[i].end_byte > last->end_byte) {
+        last->end_byte  = ranges[i].end_byte;
+        last->end_point = ranges[i].end_point;
+      }
+    } else {
+      ranges[n_ranges++] = ranges[i];
+    }
+  } //for
+
+  if (!ts_parser_set_included_ranges(parser, ranges, n_ranges)) {
+    goto Lfull;
+  }
+  free(ranges);
+  res = sp_ts_parse(parser, NULL, content, length, limits, out);
+  ts_parser_set_included_ranges(parser, NULL, 0);
+
+  if (res == SP_TS_PARSED && ts_node_has_error(ts_tree_root_node(*out))) {
+    /* not self contained declarations after all */
+    ts_tree_delete(*out);
+    *out = NULL;
+    res  = sp_ts_parse(parser, NULL, content, length, limits, out);
+  }
+
+  return res;
+Lfull:
+  free(ranges);
+  return sp_ts_parse(parser, NULL, content, length, limits, out);
+}
+
+bool
+sp_ts_fd_pending(int fd)
+{
+  struct stat st;
+  int pending = 0;
+
+  if (fstat(fd, &st) != 0 || S_ISREG(st.st_mode)) {
+    return false;
+  }
+  return ioctl(fd, FIONREAD, &pending) == 0 && pending > 0;
+}
+
+TSPoint
+sp_ts_point_advance(TSPoint point, const char *it, size_t length)
+{
+  const char *end = it + length;
+  const char *nl;
+  while ((nl = memchr(it, '\n', (size_t)(end - it)))) {
+    point.row++;
+    point.column = 0;
+    it           = nl + 1;
+  }
+  point.column += (uint32_t)(end - it);
+  return point;
+}
+
+void
+arg_list_free(struct arg_list *it)
+{
+  while (it) {
+    struct arg_list *next = it->next;
+    /* a dead entry has had its $rec spliced into the $next chain */
+    if (it->rec && !it->dead) {
+      arg_list_free(it->rec);
+    }
+    free(it->format_alloc);
+    free(it->complex_raw);
+    free(it->macro_type);
+    free(it->type);
+    free(it->variable);
+    free(it->variable_array_length);
+    free(it);
+    it = next;
+  } //while
+}
+
 bool
 sp_parse_uint32_t(const char *in, uint32_t *out)
 {
@@ -124,3 +792,151 @@ sp_parse_uint32_t(const char *in, uint32_t *out)
 
   return true;
 }
+
+int
+sp_ts_inserts_add(struct sp_ts_inserts *self, uint32_t line, const char *data)
+{
+  if (self->length == self->capacity) {
+    size_t capacity = self->capacity ? self->capacity * 2 : 4;
+    struct sp_ts_insert *tmp;
+    if (!(tmp = realloc(self->arr, capacity * sizeof(*tmp)))) {
+      return -1;
+    }
+    self->arr      = tmp;
+    self->capacity = capacity;
+  }
+
+  if (!(self->arr[self->length].data = strdup(data))) {
+    return -1;
+  }
+  self->arr[self->length].line = line;
+  ++self->length;
+  self->responded = true;
+
+  return 0;
+}
+
+int
+sp_ts_inserts_merge(struct sp_ts_inserts *self, struct sp_ts_inserts *other)
+{
+  size_t i;
+
+  self->responded |= other->responded;
+  if (other->parse != SP_TS_PARSED) {
+    self->parse = other->parse;
+  }
+  for (i = 0; i < other->length; ++i) {
+    if (sp_ts_inserts_add(self, other->arr[i].line, other->arr[i].data) != 0) {
+      return -1;
+    }
+  } //for
+
+  return 0;
+}
+
+/* lines $data takes up once inserted, a missing final newline is implied */
+static uint32_t
+sp_ts_insert_lines(const char *data, size_t *bytes)
+{
+  uint32_t lines = 0;
+  size_t length  = strlen(data);
+  const char *it;
+
+  for (it = data; (it = strchr(it, '\n')); ++it) {
+    ++lines;
+  }
+  *bytes = length;
+  if (length == 0 || data[length - 1] != '\n') {
+    ++lines;
+    ++*bytes;
+  }
+
+  return lines;
+}
+
+int
+sp_ts_inserts_sort(struct sp_ts_inserts *self,
+                   const char *content,
+                   size_t length)
+{
+  size_t line_start = 0;
+  uint32_t row      = 0;
+  size_t n          = 0;
+  size_t i;
+
+  /* stable, generators mostly emit in order already */
+  for (i = 1; i < self->length; ++i) {
+    struct sp_ts_insert it = self->arr[i];
+    size_t j               = i;
+    while (j > 0 && self->arr[j - 1].line > it.line) {
+      self->arr[j] = self->arr[j - 1];
+      --j;
+    }
+    self->arr[j] = it;
+  } //for
+
+  for (i = 0; i < self->length; ++i) {
+    struct sp_ts_insert *it = &self->arr[i];
+
+    if (n > 0 && self->arr[n - 1].line == it->line &&
+        strcmp(self->arr[n - 1].data, it->data) == 0) {
+      /* the same code requested from two positions */
+      free(it->data);
+      continue;
+    }
+
+    /* one pass over $content for all of them */
+    while (row < it->line && line_start < length) {
+      const char *nl = memchr(content + line_start, '\n', length - line_start);
+      line_start     = nl ? (size_t)(nl - content) + 1 : length;
+      ++row;
+    } //while
+    if (row < it->line) {
+      /* past the end, appended */
+      it->line = row;
+    }
+    it->byte       = (uint32_t)line_start;
+    self->arr[n++] = *it;
+  } //for
+  self->length = n;
+
+  return 0;
+}
+
+int
+sp_ts_inserts_finish(struct sp_ts_inserts *self,
+                     const char *content,
+                     size_t length)
+{
+  uint32_t lines = 0;
+  size_t bytes   = 0;
+  size_t i;
+
+  if (sp_ts_inserts_sort(self, content, length) != 0) {
+    return -1;
+  }
+  for (i = 0; i < self->length; ++i) {
+    struct sp_ts_insert *it = &self->arr[i];
+    size_t l_data;
+
+    it->line += lines;
+    it->byte += (uint32_t)bytes;
+    lines += sp_ts_insert_lines(it->data, &l_data);
+    bytes += l_data;
+  } //for
+
+  return 0;
+}
+
+int
+sp_ts_inserts_free(struct sp_ts_inserts *self)
+{
+  size_t i;
+  for (i = 0; i < self->length; ++i) {
+    free(self->arr[i].data);
+  }
+  free(self->arr);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
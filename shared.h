@@ -4,14 +4,62 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <tree_sitter/api.h>
 
+/* tree-sitter byte offsets are 32 bit */
+#define SP_TS_MAX_INPUT UINT32_MAX
+
 /* ======================================== */
 struct sp_ts_file {
   char *content;
   size_t length;
+  /* owned by us, -1 otherwise */
   int fd;
+  /* $content is mmap():ed, malloc():ed otherwise */
+  bool mapped;
+};
+
+/* ======================================== */
+enum sp_ts_parse_res {
+  SP_TS_PARSED = 0,
+  /* $timeout_us ran out */
+  SP_TS_PARSE_TIMEOUT,
+  /* abandoned for a newer request */
+  SP_TS_PARSE_CANCELLED,
+  SP_TS_PARSE_FAILED,
+};
+
+struct sp_ts_limits {
+  /* latency budget of a parse in microseconds, 0 is unbounded */
+  uint64_t timeout_us;
+  /* set non-zero by another thread to abandon the parse, may be NULL */
+  const size_t *cancel;
+  /* polled between slices of the parse, true abandons it (there is a newer
+   * request waiting), may be NULL */
+  bool (*preempt)(void *closure);
+  void *closure;
+};
+
+/* ======================================== */
+/* A regular file or memfd pulled by the parser on demand through a TSInput
+ * read callback, SP_TS_INPUT_CHUNK bytes at a time, instead of being mapped
+ * or read whole. For when only the tree is wanted, not the content.
+ */
+#define SP_TS_INPUT_CHUNK (64 * 1024)
+
+struct sp_ts_input {
+  int fd;
+  /* $fd is closed by sp_ts_input_close() */
+  bool owned;
+  uint32_t length;
+  /* the last read, $l_chunk bytes at $offset */
+  char *chunk;
+  uint32_t offset;
+  uint32_t l_chunk;
+  /* a read failed or came up short during the parse */
+  bool failed;
 };
 
 /* ======================================== */
@@ -24,13 +72,78 @@ enum sp_ts_SourceDomain {
   AX_ERROR_DOMAIN,
 };
 
+struct sp_ts_insert {
+  /* 0-based line of the content to insert $data before */
+  uint32_t line;
+  /* byte offset of $line, filled in by sp_ts_inserts_sort() */
+  uint32_t byte;
+  char *data;
+};
+
+struct sp_ts_inserts {
+  struct sp_ts_insert *arr;
+  size_t length;
+  size_t capacity;
+  /* a response, possibly without inserts, has been produced */
+  bool responded;
+  /* SP_TS_PARSE_TIMEOUT/CANCELLED: there was no tree to produce inserts
+   * from, reported as such in the response */
+  enum sp_ts_parse_res parse;
+};
+
+/* A member of a struct/union/class, see struct sp_ts_entry */
+struct sp_ts_type_field {
+  const char *name;
+  const char *type;
+  uint32_t pointer;
+  const char *array_length;
+  bool function_pointer;
+};
+
+/* What a type name declared outside of what __format() knows stands for,
+ * the strings are owned by the resolver */
+struct sp_ts_type {
+  /* typedef $type $name;, NULL when $name is not a typedef. A struct, union
+   * or enum $type without its keyword */
+  const char *type;
+  uint32_t pointer;
+  /* NULL terminated when $name is an enum */
+  const char *const *enumerators;
+  /* the members when $name is a struct/union/class */
+  const struct sp_ts_type_field *fields;
+  size_t n_fields;
+};
+
+/* false when $name is not declared anywhere the resolver looks */
+typedef bool (*sp_ts_type_cb)(void *closure,
+                              const char *name,
+                              struct sp_ts_type *out);
+
 struct sp_ts_Context {
   struct sp_ts_file file;
   TSTree *tree;
   enum sp_ts_SourceDomain domain;
   uint32_t output_line;
+  struct sp_ts_inserts inserts;
+  /* types of other files (headers), may be NULL */
+  sp_ts_type_cb type_cb;
+  void *type_closure;
+  /* typedefs followed by __format() so far */
+  uint32_t type_depth;
+  /* trace the generators on stderr, see sp_ts_debug() */
+  bool debug;
 };
 
+/* Diagnostics of a request, the syntax trees looked at and the fields given
+ * up on. Off unless $ctx->debug: the core also runs inside nvim, the python
+ * module and the servers, whose stderr is not a terminal. */
+#define sp_ts_debug(ctx, ...)                                                  \
+  do {                                                                         \
+    if ((ctx)->debug) {                                                        \
+      fprintf(stderr, __VA_ARGS__);                                            \
+    }                                                                          \
+  } while (0)
+
 typedef enum {
   AS_PACKAGE_PROTECTED,
   AS_PUBLIC,
@@ -41,6 +154,8 @@ typedef enum {
 struct arg_list;
 struct arg_list {
   char *format;
+  /* backing storage of $format when it is not a string literal */
+  char *format_alloc;
   char *variable;
   bool complete;
   char *complex_raw;
@@ -49,6 +164,8 @@ struct arg_list {
   /* type var; */
   char *type;
   bool complex_printf;
+  /* $complex_raw is a sp_hexdump() call */
+  bool hexdump;
   uint32_t pointer;
 
   bool function_pointer;
@@ -59,6 +176,8 @@ struct arg_list {
   char *variable_array_length;
 
   struct arg_list *rec;
+  /* a member of a struct resolved by __format(), nested this deep */
+  uint32_t nested;
 
   struct arg_list *next;
 };
@@ -67,10 +186,121 @@ struct arg_list {
 int
 mmap_file(const char *file, struct sp_ts_file *result);
 
+/* Content of an already open $fd (stdin, a pipe or a memfd). Regular files
+ * and memfds are mapped directly, anything else is read until EOF. $fd is
+ * not owned by $result. */
+int
+fd_file(int fd, struct sp_ts_file *result);
+
+int
+sp_ts_file_close(struct sp_ts_file *);
+
+/* The one spelling of $path that caches and watches key on: absolute and
+ * without symlinks, or the canonical directory of a file that is gone. As
+ * given when not even the directory exists. The result is to be freed. */
+char *
+sp_ts_path_canonical(const char *path);
+
+/* ======================================== */
+/* ts_parser_parse_string() bounded by $limits, NULL is unbounded. Unless
+ * SP_TS_PARSED is returned $out is NULL and $parser has been reset so the
+ * next parse, of any document, starts from scratch. */
+enum sp_ts_parse_res
+sp_ts_parse(TSParser *,
+            const TSTree *old,
+            const char *content,
+            size_t length,
+            const struct sp_ts_limits *limits,
+            TSTree **out);
+
+const char *
+sp_ts_parse_res_str(enum sp_ts_parse_res);
+
+/* 0 on success, 1 when $fd is not a regular file (read it whole with
+ * fd_file()) and -1 on error, inputs larger than SP_TS_MAX_INPUT included */
+int
+sp_ts_input_open(struct sp_ts_input *, int fd, bool owned);
+
+/* sp_ts_parse() of what is read from $input */
+enum sp_ts_parse_res
+sp_ts_parse_input(TSParser *,
+                  const TSTree *old,
+                  struct sp_ts_input *input,
+                  const struct sp_ts_limits *limits,
+                  TSTree **out);
+
+int
+sp_ts_input_close(struct sp_ts_input *);
+
+/* Bounds of the top-level declaration around $pos by a lexical scan for
+ * braces in column zero, comments and literals skipped. False when they are
+ * ambiguous (preprocessor conditionals, unbalanced braces, no closing brace
+ * after $pos, ...) or cover the whole of $content. */
+bool
+sp_ts_decl_range(const char *content,
+                 size_t length,
+                 TSPoint pos,
+                 TSRange *out);
+
+/* sp_ts_parse() of only the sp_ts_decl_range():s around the $n_pos $pos, the
+ * resulting tree has the positions of the whole $content. Falls back to
+ * parsing all of $content when a range is ambiguous or they do not parse
+ * cleanly. */
+enum sp_ts_parse_res
+sp_ts_parse_at(TSParser *,
+               const char *content,
+               size_t length,
+               const TSPoint *pos,
+               size_t n_pos,
+               const struct sp_ts_limits *limits,
+               TSTree **out);
+
+/* Unread input is waiting on the pipe/socket/tty $fd, the next request of an
+ * interactive client. End of file and regular files (a batch of requests)
+ * do not count. */
+bool
+sp_ts_fd_pending(int fd);
+
+/* ======================================== */
+/* $point moved past the $length bytes of $it, column in bytes */
+TSPoint
+sp_ts_point_advance(TSPoint point, const char *it, size_t length);
+
+/* ======================================== */
+void
+arg_list_free(struct arg_list *);
+
 /* ======================================== */
 bool
 sp_parse_uint32_t(const char *in, uint32_t *out);
 
+/* ======================================== */
+/* An edit batch: generators add inserts at lines of the content as parsed,
+ * in any order, the batch is put in order once complete. */
+int
+sp_ts_inserts_add(struct sp_ts_inserts *, uint32_t line, const char *data);
+
+/* Add the inserts of $other, a request on the same content, to $self */
+int
+sp_ts_inserts_merge(struct sp_ts_inserts *self, struct sp_ts_inserts *other);
+
+/* Order by line (stable), drop duplicates and fill in the byte offsets. The
+ * coordinates still refer to the unmodified $content, what an LSP
+ * WorkspaceEdit wants. */
+int
+sp_ts_inserts_sort(struct sp_ts_inserts *, const char *content, size_t length);
+
+/* sp_ts_inserts_sort() then shift the line and byte of each insert by what
+ * the ones before it add, so the batch applies top to bottom in one pass.
+ * A missing final newline of an insert counts as added. */
+int
+sp_ts_inserts_finish(struct sp_ts_inserts *,
+                     const char *content,
+                     size_t length);
+
+int
+sp_ts_inserts_free(struct sp_ts_inserts *);
+
 /* ======================================== */
 
 #endif
@@ -0,0 +1,470 @@
+#define _GNU_SOURCE
+#include <tree_sitter/api.h>
+
+#include "shared.h"
+#include "struct.h"
+#include "lsp.h"
+#include "server.h"
+#include "index.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+struct sp_ts_cli {
+  /* --lang=c|cpp, detected from $name otherwise */
+  const TSLanguage *lang;
+  /* --name=path, used for language/domain detection when the source is
+   * stdin or a fd */
+  const char *name;
+  /* --cache-mb=N, serve mode */
+  size_t cache_budget;
+  /* --socket=path, serve mode listens there instead of on stdin */
+  const char *socket;
+  /* --compdb=path to a compile_commands.json, serve and index */
+  const char *compdb;
+  /* --workers=N, serve and index, 0 is one per cpu */
+  uint32_t workers;
+  /* --timeout-ms=N, latency budget of a parse, 0 is unbounded */
+  uint32_t timeout_ms;
+  /* --debug, trace a one-shot request on stderr */
+  bool debug;
+};
+
+/* $in_file: "-" for stdin or "fd:N" for an inherited fd/memfd, -1 for a path
+ * and -2 when malformed */
+static int
+cli_fd(const char *in_file)
+{
+  uint32_t fd;
+
+  if (strcmp(in_file, "-") == 0) {
+    return STDIN_FILENO;
+  }
+  if (strncmp(in_file, "fd:", 3) != 0) {
+    return -1;
+  }
+  if (!sp_parse_uint32_t(in_file + 3, &fd) || fd > INT_MAX) {
+    fprintf(stderr, "failed to parse fd '%s'\n", in_file);
+    return -2;
+  }
+
+  return (int)fd;
+}
+
+static void
+cli_detect(struct sp_ts_cli *cli)
+{
+  if (!cli->name) {
+    cli->name = "";
+  }
+  if (!cli->lang) {
+    cli->lang = sp_ts_file_language(cli->name);
+  }
+}
+
+/* $in_file: a path, "-" for stdin or "fd:N" for an inherited fd/memfd */
+static int
+cli_open(struct sp_ts_cli *cli, const char *in_file, struct sp_ts_file *file)
+{
+  int fd = cli_fd(in_file);
+  int res;
+
+  if (fd == -2) {
+    return -1;
+  }
+  if (fd >= 0) {
+    res = fd_file(fd, file);
+  } else {
+    res = mmap_file(in_file, file);
+    if (!cli->name) {
+      cli->name = in_file;
+    }
+  }
+  cli_detect(cli);
+
+  return res;
+}
+
+/* $in_file as a sp_ts_input when it is a regular file, 1 when it has to be
+ * read whole by cli_open() */
+static int
+cli_open_input(struct sp_ts_cli *cli,
+               const char *in_file,
+               struct sp_ts_input *input)
+{
+  int fd     = cli_fd(in_file);
+  bool owned = false;
+  int res;
+
+  if (fd == -2) {
+    return -1;
+  }
+  if (fd == -1) {
+    if ((fd = open(in_file, O_RDONLY | O_CLOEXEC)) < 0) {
+      /* reported by cli_open() */
+      return 1;
+    }
+    owned = true;
+  }
+  if ((res = sp_ts_input_open(input, fd, owned)) != 0) {
+    if (owned) {
+      close(fd);
+    }
+    return res;
+  }
+  if (owned && !cli->name) {
+    cli->name = in_file;
+  }
+  cli_detect(cli);
+
+  return 0;
+}
+
+static int
+main_print(struct sp_ts_cli *cli, const char *in_file, int kind)
+{
+  int res                    = EXIT_FAILURE;
+  struct sp_ts_Context ctx   = {0};
+  struct sp_ts_limits limits = {0};
+  struct sp_ts_input input   = {.fd = -1};
+  bool streamed              = false;
+  enum sp_ts_parse_res parse;
+  TSParser *parser;
+
+  ctx.file.fd = -1;
+  /* the s-expression needs no content, a regular file is pulled into the
+   * parser chunk by chunk instead */
+  if (kind == 0) {
+    int r;
+    if ((r = cli_open_input(cli, in_file, &input)) < 0) {
+      return EXIT_FAILURE;
+    }
+    streamed = r == 0;
+  }
+  if (!streamed && cli_open(cli, in_file, &ctx.file) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  parser = ts_parser_new();
+  if (cli->lang == tree_sitter_cpp()) {
+    fprintf(stderr, "cpp\n");
+  } else if (is_c_file(cli->name)) {
+    fprintf(stderr, "c\n");
+  } else {
+    fprintf(stderr, "unknown (c)\n");
+  }
+  ts_parser_set_language(parser, cli->lang);
+
+  limits.timeout_us = (uint64_t)cli->timeout_ms * 1000u;
+  if (streamed) {
+    parse = sp_ts_parse_input(parser, NULL, &input, &limits, &ctx.tree);
+  } else {
+    parse = sp_ts_parse(parser, NULL, ctx.file.content, ctx.file.length,
+                        &limits, &ctx.tree);
+  }
+  if (parse != SP_TS_PARSED) {
+    fprintf(stderr, "%s\n", sp_ts_parse_res_str(parse));
+    goto Lerr;
+  }
+
+  res = sp_ts_print(&ctx, kind);
+  ts_tree_delete(ctx.tree);
+Lerr:
+  ts_parser_delete(parser);
+  sp_ts_input_close(&input);
+  sp_ts_file_close(&ctx.file);
+  return res;
+}
+
+/* Index the units of $cli->compdb or $dir/compile_commands.json and their
+ * headers, without one every C/C++ file under $dir. Reports the
+ * throughput. */
+static int
+main_index(struct sp_ts_cli *cli, const char *dir)
+{
+  int res                    = EXIT_FAILURE;
+  struct sp_ts_limits limits = {0};
+  char *compdb_path          = NULL;
+  struct sp_ts_compdb compdb;
+  struct sp_ts_index index;
+  struct sp_ts_pool pool;
+  struct timespec start;
+  struct timespec end;
+  size_t failed  = 0;
+  size_t n_decls = 0;
+  size_t types   = 0;
+  double seconds;
+  json_t *root;
+  char *r;
+  size_t i;
+
+  sp_ts_compdb_init(&compdb);
+  if (cli->compdb) {
+    compdb_path = strdup(cli->compdb);
+  } else if (asprintf(&compdb_path, "%s/compile_commands.json", dir) >= 0 &&
+             access(compdb_path, R_OK) != 0) {
+    free(compdb_path);
+    compdb_path = NULL;
+  }
+  if (compdb_path && sp_ts_compdb_load(&compdb, compdb_path) != 0) {
+    sp_ts_compdb_free(&compdb);
+    free(compdb_path);
+    return EXIT_FAILURE;
+  }
+  if (sp_ts_pool_init(&pool, cli->workers) != 0) {
+    free(compdb_path);
+    sp_ts_compdb_free(&compdb);
+    return EXIT_FAILURE;
+  }
+  sp_ts_index_init(&index);
+
+  limits.timeout_us = (uint64_t)cli->timeout_ms * 1000u;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  /* nothing interactive to keep a worker free for */
+  if (compdb_path) {
+    if (sp_ts_index_compdb(&index, &compdb, &pool, SP_TS_POOL_INTERACTIVE,
+                           &limits) != 0) {
+      goto Lerr;
+    }
+  } else if (sp_ts_index_dir(&index, dir, &pool, SP_TS_POOL_INTERACTIVE,
+                             &limits) != 0) {
+    goto Lerr;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  seconds = (double)(end.tv_sec - start.tv_sec) +
+            (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+  for (i = 0; i < index.length; ++i) {
+    if (index.files[i]->decls) {
+      n_decls += index.files[i]->decls->length;
+    } else {
+      ++failed;
+    }
+  } //for
+  for (i = 0; i < index.n_members; ++i) {
+    if (i == 0 || strcmp(index.members[i - 1].decl->scope,
+                         index.members[i].decl->scope) != 0) {
+      ++types;
+    }
+  } //for
+
+  root = json_pack("{s:I, s:I, s:I, s:I, s:I, s:I, s:f, s:f}", "units",
+                   (json_int_t)compdb.units.length, "files",
+                   (json_int_t)index.length, "failed", (json_int_t)failed,
+                   "decls", (json_int_t)n_decls, "types", (json_int_t)types,
+                   "workers", (json_int_t)pool.n_workers, "seconds", seconds,
+                   "files_per_s",
+                   seconds > 0 ? (double)index.length / seconds : 0.0);
+  if (root && (r = json_dumps(root, JSON_PRESERVE_ORDER))) {
+    fprintf(stdout, "%s\n", r);
+    free(r);
+    res = EXIT_SUCCESS;
+  }
+  json_decref(root);
+
+Lerr:
+  sp_ts_pool_free(&pool);
+  sp_ts_index_free(&index);
+  sp_ts_compdb_free(&compdb);
+  free(compdb_path);
+  return res;
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "%s [--lang=c|cpp] [--name=path] [--timeout-ms=N] [--debug] "
+          "crunch|locals|branches file line column "
+          "[crunch|locals|branches line column]...\n",
+          prog);
+  fprintf(stderr,
+          "%s [--lang=c|cpp] [--name=path] [--timeout-ms=N] "
+          "print|print2 file\n",
+          prog);
+  fprintf(stderr, "%s [--timeout-ms=N] lsp\n", prog);
+  fprintf(stderr,
+          "%s [--cache-mb=N] [--timeout-ms=N] [--socket=path] [--workers=N] "
+          "[--compdb=path] serve\n",
+          prog);
+  fprintf(stderr,
+          "%s [--timeout-ms=N] [--workers=N] [--compdb=path] index dir\n",
+          prog);
+  fprintf(stderr, "  --compdb: compile_commands.json, dir/ or the closest "
+                  "one from . up by default\n");
+  fprintf(stderr, "  file: a path, - for stdin or fd:N for an open fd/memfd\n");
+  fprintf(stderr, "  --timeout-ms: parse budget, 0 is unbounded (2000)\n");
+  fprintf(stderr, "  --workers: threads, one per cpu by default, serve runs "
+                  "at least 2\n");
+}
+
+int
+main(int argc, const char *argv[])
+{
+  int res                    = EXIT_FAILURE;
+  struct sp_ts_Context ctx   = {0};
+  struct sp_ts_cli cli       = {.cache_budget = 256u << 20, .timeout_ms = 2000};
+  struct sp_ts_limits limits = {0};
+  struct sp_ts_inserts all   = {0};
+  const char *prog           = argv[0];
+  const char *in_file        = NULL;
+  const char **in_types      = NULL;
+  TSPoint *pos               = NULL;
+  TSParser *parser           = NULL;
+  size_t n_pos;
+  size_t i;
+  enum sp_ts_parse_res parse;
+
+  for (--argc, ++argv; argc > 0 && strncmp(argv[0], "--", 2) == 0;
+       --argc, ++argv) {
+    if (strcmp(argv[0], "--lang=c") == 0) {
+      cli.lang = tree_sitter_c();
+    } else if (strcmp(argv[0], "--lang=cpp") == 0) {
+      cli.lang = tree_sitter_cpp();
+    } else if (strcmp(argv[0], "--debug") == 0) {
+      cli.debug = true;
+    } else if (strncmp(argv[0], "--name=", 7) == 0) {
+      cli.name = argv[0] + 7;
+    } else if (strncmp(argv[0], "--cache-mb=", 11) == 0) {
+      uint32_t mb;
+      if (!sp_parse_uint32_t(argv[0] + 11, &mb)) {
+        usage(prog);
+        return EXIT_FAILURE;
+      }
+      cli.cache_budget = (size_t)mb << 20;
+    } else if (strncmp(argv[0], "--socket=", 9) == 0) {
+      cli.socket = argv[0] + 9;
+    } else if (strncmp(argv[0], "--compdb=", 9) == 0) {
+      cli.compdb = argv[0] + 9;
+    } else if (strncmp(argv[0], "--workers=", 10) == 0) {
+      if (!sp_parse_uint32_t(argv[0] + 10, &cli.workers)) {
+        usage(prog);
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(argv[0], "--timeout-ms=", 13) == 0) {
+      if (!sp_parse_uint32_t(argv[0] + 13, &cli.timeout_ms)) {
+        usage(prog);
+        return EXIT_FAILURE;
+      }
+    } else {
+      usage(prog);
+      return EXIT_FAILURE;
+    }
+  } //for
+
+  if (argc < 4 || (argc - 4) % 3 != 0) {
+    if (argc > 0) {
+      const char *in_type = argv[0];
+      if (argc == 2 && strcmp(in_type, "print") == 0) {
+        in_file = argv[1];
+        return main_print(&cli, in_file, 0);
+      } else if (argc == 2 && strcmp(in_type, "print2") == 0) {
+        in_file = argv[1];
+        return main_print(&cli, in_file, 1);
+      } else if (argc == 2 && strcmp(in_type, "index") == 0) {
+        return main_index(&cli, argv[1]);
+      } else if (argc == 1 && strcmp(in_type, "lsp") == 0) {
+        return sp_lsp_main(stdin, stdout, (uint64_t)cli.timeout_ms * 1000u);
+      } else if (argc == 1 && strcmp(in_type, "serve") == 0) {
+        struct sp_server_options options = {
+          .socket       = cli.socket,
+          .compdb       = cli.compdb,
+          .cache_budget = cli.cache_budget,
+          .timeout_us   = (uint64_t)cli.timeout_ms * 1000u,
+          .workers      = cli.workers,
+        };
+        return sp_server_main(&options);
+      }
+    }
+    usage(prog);
+    return EXIT_FAILURE;
+  }
+
+  /* type file line column, then any number of further type line column */
+  ctx.file.fd = -1;
+  in_file     = argv[1];
+  n_pos       = 1 + (size_t)(argc - 4) / 3;
+  in_types    = calloc(n_pos, sizeof(*in_types));
+  pos         = calloc(n_pos, sizeof(*pos));
+  if (!in_types || !pos) {
+    goto Lerr;
+  }
+  for (i = 0; i < n_pos; ++i) {
+    /* the first has the file between its type and line */
+    size_t at             = i == 0 ? 1 : 4 + (i - 1) * 3;
+    const char *in_line   = argv[at + 1];
+    const char *in_column = argv[at + 2];
+
+    in_types[i] = i == 0 ? argv[0] : argv[at];
+    if (!sp_parse_uint32_t(in_line, &pos[i].row)) {
+      fprintf(stderr, "failed to parse line '%s'\n", in_line);
+      goto Lerr;
+    }
+    if (!sp_parse_uint32_t(in_column, &pos[i].column)) {
+      fprintf(stderr, "failed to parse column '%s'\n", in_column);
+      goto Lerr;
+    }
+  } //for
+
+  if (cli_open(&cli, in_file, &ctx.file) != 0) {
+    goto Lerr;
+  }
+  parser = ts_parser_new();
+  ts_parser_set_language(parser, cli.lang);
+  ctx.domain = get_domain(cli.name);
+  ctx.debug  = cli.debug;
+
+  limits.timeout_us = (uint64_t)cli.timeout_ms * 1000u;
+  /* a one-shot request only looks at the declarations around $pos */
+  parse = sp_ts_parse_at(parser, ctx.file.content, ctx.file.length, pos,
+                         n_pos, &limits, &ctx.tree);
+  if (parse == SP_TS_PARSE_TIMEOUT) {
+    /* an explicit answer rather than none, the editor must not wait on a
+     * huge or pathological file */
+    fprintf(stderr, "parse exceeded %ums\n", cli.timeout_ms);
+    all.parse     = parse;
+    all.responded = true;
+    sp_ts_print_json_response(stdout, &all);
+    goto Lerr;
+  }
+  if (parse != SP_TS_PARSED) {
+    fprintf(stderr, "failed to parse\n");
+    goto Lerr;
+  }
+
+  /* one tree, file and domain for all of them, one response */
+  res = EXIT_SUCCESS;
+  for (i = 0; i < n_pos; ++i) {
+    if (sp_ts_request(&ctx, in_types[i], pos[i]) != EXIT_SUCCESS) {
+      res = EXIT_FAILURE;
+    }
+    if (sp_ts_inserts_merge(&all, &ctx.inserts) != 0) {
+      res = EXIT_FAILURE;
+    }
+    sp_ts_inserts_free(&ctx.inserts);
+  } //for
+  sp_ts_inserts_finish(&all, ctx.file.content, ctx.file.length);
+  sp_ts_print_json_response(stdout, &all);
+  ts_tree_delete(ctx.tree);
+
+Lerr:
+  if (parser) {
+    ts_parser_delete(parser);
+  }
+  sp_ts_inserts_free(&all);
+  sp_ts_file_close(&ctx.file);
+  free(in_types);
+  free(pos);
+
+  return res;
+}
+
+// Example:
+// ./sp_struct_to_string crunch ./test7.c 2 0
+// ./sp_struct_to_string --lang=c --name=test7.c crunch - 2 0 < ./test7.c
+// ./sp_struct_to_string locals ./test7.c 10 2 locals 30 2 crunch 2 0
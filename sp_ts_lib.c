@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#include <tree_sitter/api.h>
+
+#include "shared.h"
+#include "struct.h"
+#include "sp_ts_lib.h"
+#include "sp_util.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* number of files whose tree is kept alive between calls */
+#define SP_TS_LIB_TREES 16
+
+struct sp_ts_lib_tree {
+  char *file;
+  /* private NUL terminated copy of what $tree was parsed from */
+  char *content;
+  size_t length;
+  TSTree *tree;
+  /* $content changed since $tree was parsed, $tree has been edited to
+   * match */
+  bool dirty;
+  uint64_t used;
+};
+
+struct sp_ts_lib {
+  TSParser *c_parser;
+  TSParser *cpp_parser;
+  struct sp_ts_lib_tree trees[SP_TS_LIB_TREES];
+  uint64_t tick;
+  struct sp_ts_limits limits;
+  /* set by sp_ts_lib_cancel(), possibly from another thread */
+  size_t cancel;
+};
+
+struct sp_ts_lib *
+sp_ts_lib_new(void)
+{
+  struct sp_ts_lib *self;
+
+  if (!(self = calloc(1, sizeof(*self)))) {
+    return NULL;
+  }
+
+  if (!(self->c_parser = ts_parser_new())) {
+    goto Lerr;
+  }
+  ts_parser_set_language(self->c_parser, tree_sitter_c());
+
+  if (!(self->cpp_parser = ts_parser_new())) {
+    goto Lerr;
+  }
+  ts_parser_set_language(self->cpp_parser, tree_sitter_cpp());
+  self->limits.cancel = &self->cancel;
+
+  return self;
+Lerr:
+  sp_ts_lib_free(self);
+  return NULL;
+}
+
+static void
+sp_ts_lib_tree_clear(struct sp_ts_lib_tree *it)
+{
+  if (it->tree) {
+    ts_tree_delete(it->tree);
+  }
+  free(it->file);
+  free(it->content);
+  memset(it, 0, sizeof(*it));
+}
+
+void
+sp_ts_lib_free(struct sp_ts_lib *self)
+{
+  if (self) {
+    sp_ts_lib_forget(self, NULL);
+    if (self->c_parser) {
+      ts_parser_delete(self->c_parser);
+    }
+    if (self->cpp_parser) {
+      ts_parser_delete(self->cpp_parser);
+    }
+    free(self);
+  }
+}
+
+void
+sp_ts_lib_forget(struct sp_ts_lib *self, const char *file)
+{
+  size_t i;
+  for (i = 0; i < SP_TS_LIB_TREES; ++i) {
+    struct sp_ts_lib_tree *it = &self->trees[i];
+    if (it->file && (!file || strcmp(it->file, file) == 0)) {
+      sp_ts_lib_tree_clear(it);
+    }
+  } //for
+}
+
+void
+sp_ts_lib_set_timeout(struct sp_ts_lib *self, uint64_t micros)
+{
+  self->limits.timeout_us = micros;
+}
+
+void
+sp_ts_lib_cancel(struct sp_ts_lib *self)
+{
+  __atomic_store_n(&self->cancel, 1, __ATOMIC_RELAXED);
+}
+
+static struct sp_ts_lib_tree *
+sp_ts_lib_slot(struct sp_ts_lib *self, const char *file)
+{
+  struct sp_ts_lib_tree *victim = &self->trees[0];
+  size_t i;
+
+  for (i = 0; i < SP_TS_LIB_TREES; ++i) {
+    struct sp_ts_lib_tree *it = &self->trees[i];
+    if (it->file && strcmp(it->file, file) == 0) {
+      return it;
+    }
+    if (!victim->file) {
+      continue;
+    }
+    if (!it->file || it->used < victim->used) {
+      victim = it;
+    }
+  } //for
+
+  sp_ts_lib_tree_clear(victim);
+  if (!(victim->file = strdup(file))) {
+    return NULL;
+  }
+
+  return victim;
+}
+
+/* Describe the difference between the cached and the new content as a single
+ * edit, the common prefix and suffix are what the caller left untouched. */
+static void
+sp_ts_lib_edit(struct sp_ts_lib_tree *it, const char *content, size_t length)
+{
+  size_t min    = sp_min(it->length, length);
+  size_t prefix = 0;
+  size_t suffix = 0;
+  TSInputEdit edit;
+
+  while (prefix < min && it->content[prefix] == content[prefix]) {
+    ++prefix;
+  }
+  while (suffix < min - prefix &&
+         it->content[it->length - suffix - 1] == content[length - suffix - 1]) {
+    ++suffix;
+  }
+
+  edit.start_byte    = (uint32_t)prefix;
+  edit.old_end_byte  = (uint32_t)(it->length - suffix);
+  edit.new_end_byte  = (uint32_t)(length - suffix);
+  edit.start_point   = sp_ts_point_advance((TSPoint){0, 0}, content, prefix);
+  edit.old_end_point = sp_ts_point_advance(
+    edit.start_point, it->content + prefix, edit.old_end_byte - prefix);
+  edit.new_end_point = sp_ts_point_advance(edit.start_point, content + prefix,
+                                           edit.new_end_byte - prefix);
+  ts_tree_edit(it->tree, &edit);
+}
+
+static int
+sp_ts_lib_parse(struct sp_ts_lib *self,
+                const char *file,
+                const char *buf,
+                size_t length,
+                struct sp_ts_lib_tree **out)
+{
+  struct sp_ts_lib_tree *it;
+  enum sp_ts_parse_res res;
+  TSParser *parser;
+  TSTree *tree;
+  char *content;
+
+  *out = NULL;
+  if (length > SP_TS_MAX_INPUT) {
+    return SP_TS_LIB_ERROR;
+  }
+  file   = file ? file : "";
+  buf    = buf ? buf : "";
+  parser = is_cpp_file(file) ? self->cpp_parser : self->c_parser;
+
+  if (!(it = sp_ts_lib_slot(self, file))) {
+    return SP_TS_LIB_ERROR;
+  }
+  it->used = ++self->tick;
+
+  if (it->content && it->length == length &&
+      memcmp(it->content, buf, length) == 0) {
+    if (it->tree && !it->dirty) {
+      *out = it;
+      return SP_TS_LIB_OK;
+    }
+    /* an earlier parse of the same content was cut short */
+    content = NULL;
+  } else {
+    if (!(content = malloc(length + 1))) {
+      return SP_TS_LIB_ERROR;
+    }
+    memcpy(content, buf, length);
+    content[length] = '\0';
+
+    if (it->tree) {
+      sp_ts_lib_edit(it, content, length);
+    }
+    /* $it->tree now describes $content, whether or not the parse completes */
+    free(it->content);
+    it->content = content;
+    it->length  = length;
+    it->dirty   = true;
+  }
+
+  __atomic_store_n(&self->cancel, 0, __ATOMIC_RELAXED);
+  res = sp_ts_parse(parser, it->tree, it->content, it->length, &self->limits,
+                    &tree);
+  if (res == SP_TS_PARSE_TIMEOUT) {
+    return SP_TS_LIB_TIMEOUT;
+  } else if (res == SP_TS_PARSE_CANCELLED) {
+    return SP_TS_LIB_CANCELLED;
+  } else if (res != SP_TS_PARSED) {
+    sp_ts_lib_tree_clear(it);
+    return SP_TS_LIB_ERROR;
+  }
+
+  if (it->tree) {
+    ts_tree_delete(it->tree);
+  }
+  it->tree  = tree;
+  it->dirty = false;
+  *out      = it;
+
+  return SP_TS_LIB_OK;
+}
+
+static int
+sp_ts_lib_request(struct sp_ts_lib *self,
+                  const char *in_type,
+                  const char *file,
+                  const char *buf,
+                  size_t length,
+                  uint32_t line,
+                  uint32_t column,
+                  struct sp_ts_lib_result *out)
+{
+  struct sp_ts_Context ctx = {0};
+  struct sp_ts_lib_tree *it;
+  TSPoint pos = {.row = line, .column = column};
+  int res;
+  size_t i;
+
+  memset(out, 0, sizeof(*out));
+  if ((res = sp_ts_lib_parse(self, file, buf, length, &it)) != SP_TS_LIB_OK) {
+    return res;
+  }
+
+  ctx.file.content = it->content;
+  ctx.file.length  = it->length;
+  ctx.file.fd      = -1;
+  ctx.tree         = it->tree;
+  ctx.domain       = get_domain(it->file);
+
+  res = sp_ts_request(&ctx, in_type, pos) == EXIT_SUCCESS ? SP_TS_LIB_OK
+                                                          : SP_TS_LIB_ERROR;
+  sp_ts_inserts_finish(&ctx.inserts, ctx.file.content, ctx.file.length);
+
+  if (ctx.inserts.length > 0) {
+    if (!(out->arr = calloc(ctx.inserts.length, sizeof(*out->arr)))) {
+      res = SP_TS_LIB_ERROR;
+      goto Lout;
+    }
+    for (i = 0; i < ctx.inserts.length; ++i) {
+      /* ownership of $data moves to the caller */
+      out->arr[i].line        = ctx.inserts.arr[i].line;
+      out->arr[i].byte        = ctx.inserts.arr[i].byte;
+      out->arr[i].data        = ctx.inserts.arr[i].data;
+      ctx.inserts.arr[i].data = NULL;
+    } //for
+    out->length = ctx.inserts.length;
+  }
+
+Lout:
+  sp_ts_inserts_free(&ctx.inserts);
+  return res;
+}
+
+int
+sp_ts_lib_crunch(struct sp_ts_lib *self,
+                 const char *file,
+                 const char *buf,
+                 size_t length,
+                 uint32_t line,
+                 uint32_t column,
+                 struct sp_ts_lib_result *out)
+{
+  return sp_ts_lib_request(self, "crunch", file, buf, length, line, column,
+                           out);
+}
+
+int
+sp_ts_lib_locals(struct sp_ts_lib *self,
+                 const char *file,
+                 const char *buf,
+                 size_t length,
+                 uint32_t line,
+                 uint32_t column,
+                 struct sp_ts_lib_result *out)
+{
+  return sp_ts_lib_request(self, "locals", file, buf, length, line, column,
+                           out);
+}
+
+int
+sp_ts_lib_branches(struct sp_ts_lib *self,
+                   const char *file,
+                   const char *buf,
+                   size_t length,
+                   uint32_t line,
+                   uint32_t column,
+                   struct sp_ts_lib_result *out)
+{
+  return sp_ts_lib_request(self, "branches", file, buf, length, line, column,
+                           out);
+}
+
+int
+sp_ts_lib_print(struct sp_ts_lib *self,
+                const char *file,
+                const char *buf,
+                size_t length,
+                char **out)
+{
+  struct sp_ts_lib_tree *it;
+  TSNode root;
+  int res;
+
+  *out = NULL;
+  if ((res = sp_ts_lib_parse(self, file, buf, length, &it)) != SP_TS_LIB_OK) {
+    return res;
+  }
+
+  root = ts_tree_root_node(it->tree);
+  if (ts_node_is_null(root)) {
+    return SP_TS_LIB_ERROR;
+  }
+  *out = ts_node_string(root);
+
+  return *out ? SP_TS_LIB_OK : SP_TS_LIB_ERROR;
+}
+
+void
+sp_ts_lib_result_free(struct sp_ts_lib_result *self)
+{
+  size_t i;
+  if (self) {
+    for (i = 0; i < self->length; ++i) {
+      free(self->arr[i].data);
+    }
+    free(self->arr);
+    memset(self, 0, sizeof(*self));
+  }
+}
+
+void
+sp_ts_lib_string_free(char *str)
+{
+  free(str);
+}
@@ -0,0 +1,119 @@
+#ifndef SP_TS_LIB_H
+#define SP_TS_LIB_H
+
+/* In-process API of libsp_ts.so, the same requests as the
+ * sp_struct_to_string cli without fork/exec, pipes and json.
+ *
+ * The declarations are kept free of macros and non-standard types so the
+ * header (minus the include guard and #includes) can be pasted verbatim into
+ * LuaJIT's ffi.cdef().
+ *
+ * A handle caches one parser per language and the latest tree per file name,
+ * a request with an edited buffer reparses incrementally against the cached
+ * tree. A handle must not be used concurrently from multiple threads, except
+ * for sp_ts_lib_cancel().
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* ======================================== */
+struct sp_ts_lib;
+
+/* In the order to apply, the coordinates of each account for the inserts
+ * before it. */
+struct sp_ts_lib_insert {
+  /* 0-based line to insert $data before, same as the cli "line" */
+  uint32_t line;
+  /* byte offset of $line */
+  uint32_t byte;
+  char *data;
+};
+
+struct sp_ts_lib_result {
+  struct sp_ts_lib_insert *arr;
+  size_t length;
+};
+
+/* return value of the requests */
+enum sp_ts_lib_status {
+  SP_TS_LIB_ERROR     = -1,
+  SP_TS_LIB_OK        = 0,
+  /* the parse ran past the timeout, nothing was produced */
+  SP_TS_LIB_TIMEOUT   = 1,
+  /* sp_ts_lib_cancel() was called during the request */
+  SP_TS_LIB_CANCELLED = 2,
+};
+
+/* ======================================== */
+struct sp_ts_lib *
+sp_ts_lib_new(void);
+
+void
+sp_ts_lib_free(struct sp_ts_lib *);
+
+/* drop the cached tree of $file, NULL drops all */
+void
+sp_ts_lib_forget(struct sp_ts_lib *, const char *file);
+
+/* latency budget of a parse in microseconds, 0 (the default) is unbounded */
+void
+sp_ts_lib_set_timeout(struct sp_ts_lib *, uint64_t micros);
+
+/* Abandon the parse in flight, may be called from another thread when a
+ * newer request supersedes it. The next request on the same file still
+ * reparses incrementally. */
+void
+sp_ts_lib_cancel(struct sp_ts_lib *);
+
+/* ======================================== */
+/* $file: name used for language detection and as tree cache key
+ * $buf,$length: current content of $file, need not be NUL terminated
+ * $line,$column: 0-based cursor position
+ * $out: filled with inserts owned by the caller, release with
+ *       sp_ts_lib_result_free()
+ *
+ * Returns an enum sp_ts_lib_status, SP_TS_LIB_OK on success.
+ */
+int
+sp_ts_lib_crunch(struct sp_ts_lib *,
+                 const char *file,
+                 const char *buf,
+                 size_t length,
+                 uint32_t line,
+                 uint32_t column,
+                 struct sp_ts_lib_result *out);
+
+int
+sp_ts_lib_locals(struct sp_ts_lib *,
+                 const char *file,
+                 const char *buf,
+                 size_t length,
+                 uint32_t line,
+                 uint32_t column,
+                 struct sp_ts_lib_result *out);
+
+int
+sp_ts_lib_branches(struct sp_ts_lib *,
+                   const char *file,
+                   const char *buf,
+                   size_t length,
+                   uint32_t line,
+                   uint32_t column,
+                   struct sp_ts_lib_result *out);
+
+/* s-expression of the whole tree, release with sp_ts_lib_string_free() */
+int
+sp_ts_lib_print(struct sp_ts_lib *,
+                const char *file,
+                const char *buf,
+                size_t length,
+                char **out);
+
+/* ======================================== */
+void
+sp_ts_lib_result_free(struct sp_ts_lib_result *);
+
+void
+sp_ts_lib_string_free(char *);
+
+#endif
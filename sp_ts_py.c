@@ -0,0 +1,227 @@
+/* CPython extension exposing the struct.c extraction in bulk:
+ *
+ *   import sp_ts
+ *   res = sp_ts.extract(source, "file.c")   # bytes-like, name picks c/c++
+ *   res = sp_ts.extract_file("file.c")
+ *   res["fields"|"enums"|"locals"|"globals"] ->
+ *     [(scope, name, type, pointer, line), ...]
+ *
+ * scope is the struct/enum/function name (None when anonymous or global),
+ * type is None for enumerators and line is 0-based.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <tree_sitter/api.h>
+
+#include "shared.h"
+#include "struct.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+static const char *const sp_ts_py_keys[] = {
+  [SP_TS_FIELD]  = "fields",
+  [SP_TS_ENUM]   = "enums",
+  [SP_TS_LOCAL]  = "locals",
+  [SP_TS_GLOBAL] = "globals",
+};
+
+struct sp_ts_py {
+  PyObject *lists[sizeof(sp_ts_py_keys) / sizeof(sp_ts_py_keys[0])];
+};
+
+static PyObject *
+sp_ts_py_str(const char *str)
+{
+  if (!str) {
+    Py_RETURN_NONE;
+  }
+  return PyUnicode_DecodeUTF8(str, (Py_ssize_t)strlen(str), "replace");
+}
+
+static int
+sp_ts_py_entry(void *closure, const struct sp_ts_entry *entry)
+{
+  struct sp_ts_py *self = closure;
+  PyObject *tuple;
+  int res;
+
+  tuple = Py_BuildValue("(NNNII)", sp_ts_py_str(entry->scope),
+                        sp_ts_py_str(entry->name), sp_ts_py_str(entry->type),
+                        entry->pointer, entry->line);
+  if (!tuple) {
+    return -1;
+  }
+  res = PyList_Append(self->lists[entry->kind], tuple);
+  Py_DECREF(tuple);
+
+  return res;
+}
+
+static PyObject *
+sp_ts_py_run(const char *file,
+             char *content,
+             size_t length,
+             unsigned int timeout_ms)
+{
+  struct sp_ts_Context ctx   = {0};
+  struct sp_ts_py self       = {0};
+  struct sp_ts_limits limits = {0};
+  PyObject *result           = NULL;
+  enum sp_ts_parse_res parse;
+  TSParser *parser;
+  size_t i;
+
+  if (length > SP_TS_MAX_INPUT) {
+    PyErr_SetString(PyExc_ValueError, "source larger than 4GiB");
+    return NULL;
+  }
+
+  if (!(parser = ts_parser_new())) {
+    return PyErr_NoMemory();
+  }
+  ts_parser_set_language(parser, sp_ts_file_language(file));
+
+  ctx.file.content = content;
+  ctx.file.length  = length;
+  ctx.file.fd      = -1;
+  ctx.domain       = get_domain(file);
+
+  limits.timeout_us = (uint64_t)timeout_ms * 1000u;
+  Py_BEGIN_ALLOW_THREADS
+  parse = sp_ts_parse(parser, NULL, content, length, &limits, &ctx.tree);
+  Py_END_ALLOW_THREADS
+  if (parse == SP_TS_PARSE_TIMEOUT) {
+    PyErr_Format(PyExc_TimeoutError, "parse exceeded %ums", timeout_ms);
+    goto Lout;
+  }
+  if (parse != SP_TS_PARSED) {
+    PyErr_SetString(PyExc_RuntimeError, "failed to parse");
+    goto Lout;
+  }
+
+  if (!(result = PyDict_New())) {
+    goto Lout;
+  }
+  for (i = 0; i < sizeof(self.lists) / sizeof(self.lists[0]); ++i) {
+    if (!(self.lists[i] = PyList_New(0))) {
+      goto Lerr;
+    }
+    if (PyDict_SetItemString(result, sp_ts_py_keys[i], self.lists[i]) != 0) {
+      goto Lerr;
+    }
+  } //for
+
+  if (sp_ts_extract(&ctx, sp_ts_py_entry, &self) != 0) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_RuntimeError, "failed to extract");
+    }
+    goto Lerr;
+  }
+
+Lout:
+  for (i = 0; i < sizeof(self.lists) / sizeof(self.lists[0]); ++i) {
+    Py_XDECREF(self.lists[i]);
+  }
+  if (ctx.tree) {
+    ts_tree_delete(ctx.tree);
+  }
+  ts_parser_delete(parser);
+  return result;
+Lerr:
+  Py_CLEAR(result);
+  goto Lout;
+}
+
+static PyObject *
+sp_ts_py_extract(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+  static char *kwlist[]   = {"source", "file", "timeout_ms", NULL};
+  const char *file        = "";
+  unsigned int timeout_ms = 0;
+  PyObject *result;
+  Py_buffer source;
+  char *content;
+
+  (void)module;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|sI", kwlist, &source,
+                                   &file, &timeout_ms)) {
+    return NULL;
+  }
+
+  /* the extraction code expects a NUL terminated copy */
+  if (!(content = malloc((size_t)source.len + 1))) {
+    PyBuffer_Release(&source);
+    return PyErr_NoMemory();
+  }
+  memcpy(content, source.buf, (size_t)source.len);
+  content[source.len] = '\0';
+
+  result = sp_ts_py_run(file, content, (size_t)source.len, timeout_ms);
+
+  free(content);
+  PyBuffer_Release(&source);
+  return result;
+}
+
+static PyObject *
+sp_ts_py_extract_file(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+  static char *kwlist[]   = {"path", "timeout_ms", NULL};
+  struct sp_ts_file file  = {0};
+  unsigned int timeout_ms = 0;
+  const char *path;
+  PyObject *result;
+  int res;
+
+  (void)module;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|I", kwlist, &path,
+                                   &timeout_ms)) {
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  res = mmap_file(path, &file);
+  Py_END_ALLOW_THREADS
+  if (res != 0) {
+    return PyErr_Format(PyExc_OSError, "failed to map '%s'", path);
+  }
+
+  result = sp_ts_py_run(path, file.content, file.length, timeout_ms);
+
+  sp_ts_file_close(&file);
+  return result;
+}
+
+static PyMethodDef sp_ts_py_methods[] = {
+  {"extract", (PyCFunction)(void (*)(void))sp_ts_py_extract,
+   METH_VARARGS | METH_KEYWORDS,
+   "extract(source, file='', timeout_ms=0)\n--\n\n"
+   "Fields, enums, locals and globals of source as lists of\n"
+   "(scope, name, type, pointer, line) tuples keyed by kind.\n"
+   "Raises TimeoutError when parsing takes longer than timeout_ms\n"
+   "(0 is unbounded)."},
+  {"extract_file", (PyCFunction)(void (*)(void))sp_ts_py_extract_file,
+   METH_VARARGS | METH_KEYWORDS,
+   "extract_file(path, timeout_ms=0)\n--\n\n"
+   "Same as extract() for the content of path."},
+  {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef sp_ts_py_module = {
+  PyModuleDef_HEAD_INIT,
+  .m_name    = "sp_ts",
+  .m_doc     = "tree-sitter based C/C++ extraction",
+  .m_size    = -1,
+  .m_methods = sp_ts_py_methods,
+};
+
+PyMODINIT_FUNC
+PyInit_sp_ts(void);
+
+PyMODINIT_FUNC
+PyInit_sp_ts(void)
+{
+  return PyModule_Create(&sp_ts_py_module);
+}
@@ -2,12 +2,17 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <ctype.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define SP_UTIL_X86 1
+#include <immintrin.h>
+#endif
+
 /* #include <execinfo.h> // backtrace */
 
 //==============================
@@ -31,6 +36,292 @@ sp_util_to_hex(const char *ctx, const uint8_t *raw, size_t len)
   printf("\n");
 }
 
+//==============================
+/* Byte at a time reference implementations, also used for the tail that
+ * does not fill a vector and to pinpoint where a vector block failed. */
+static void
+hex_encode_scalar(const uint8_t *it, size_t len, char *out)
+{
+  const uint8_t *const end = it + len;
+  while (it != end) {
+    *out++ = hex_encode_lookup[(*it >> 4) & 0xf];
+    *out++ = hex_encode_lookup[*it & 0xf];
+    ++it;
+  }
+}
+
+static int
+hex_decode_nibble(char c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return (c - 'A') + 0xA;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return (c - 'a') + 0xa;
+  }
+  return -1;
+}
+
+/* Decode $len bytes, returns the number of bytes decoded before the first
+ * invalid hex digit. */
+static size_t
+hex_decode_scalar(const char *hex, size_t len, uint8_t *out)
+{
+  size_t i;
+  for (i = 0; i < len; ++i) {
+    int f = hex_decode_nibble(hex[(i * 2)]);
+    int s = hex_decode_nibble(hex[(i * 2) + 1]);
+    if (f < 0 || s < 0) {
+      break;
+    }
+    out[i] = (uint8_t)((f << 4) | s);
+  }
+  return i;
+}
+
+/* Returns the length of the printable prefix, same as isprint() in the
+ * "C" locale. */
+static size_t
+printable_scalar(const uint8_t *b, size_t len)
+{
+  size_t i;
+  for (i = 0; i < len; ++i) {
+    if (b[i] < 0x20 || b[i] > 0x7e) {
+      break;
+    }
+  }
+  return i;
+}
+
+#ifdef SP_UTIL_X86
+static inline __m128i
+hex_nibble_to_ascii_sse2(__m128i n)
+{
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)),
+                                _mm_set1_epi8('A' - '0' - 0xA));
+  return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), alpha);
+}
+
+static void
+hex_encode_sse2(const uint8_t *it, size_t len, char *out)
+{
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  size_t i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    __m128i v  = _mm_loadu_si128((const __m128i *)(it + i));
+    __m128i hi = hex_nibble_to_ascii_sse2(
+      _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    __m128i lo = hex_nibble_to_ascii_sse2(_mm_and_si128(v, mask));
+    _mm_storeu_si128((__m128i *)(out + (i * 2)), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(out + (i * 2) + 16),
+                     _mm_unpackhi_epi8(hi, lo));
+  }
+  hex_encode_scalar(it + i, len - i, out + (i * 2));
+}
+
+static inline __m128i
+hex_ascii_to_nibble_sse2(__m128i c, __m128i *valid)
+{
+  __m128i lower    = _mm_or_si128(c, _mm_set1_epi8(0x20));
+  __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                   _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+  __m128i is_alpha =
+    _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                  _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+  __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  __m128i alpha = _mm_sub_epi8(lower, _mm_set1_epi8('a' - 0xa));
+
+  *valid = _mm_or_si128(is_digit, is_alpha);
+  return _mm_or_si128(_mm_and_si128(is_digit, digit),
+                      _mm_and_si128(is_alpha, alpha));
+}
+
+/* 16bit lane [lo byte: high nibble, hi byte: low nibble] -> byte */
+static inline __m128i
+hex_nibble_pair_sse2(__m128i n)
+{
+  return _mm_or_si128(
+    _mm_and_si128(_mm_slli_epi16(n, 4), _mm_set1_epi16(0xf0)),
+    _mm_srli_epi16(n, 8));
+}
+
+static size_t
+hex_decode_sse2(const char *hex, size_t len, uint8_t *out)
+{
+  size_t i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    __m128i valid0;
+    __m128i valid1;
+    __m128i n0 = hex_ascii_to_nibble_sse2(
+      _mm_loadu_si128((const __m128i *)(hex + (i * 2))), &valid0);
+    __m128i n1 = hex_ascii_to_nibble_sse2(
+      _mm_loadu_si128((const __m128i *)(hex + (i * 2) + 16)), &valid1);
+    if (_mm_movemask_epi8(_mm_and_si128(valid0, valid1)) != 0xffff) {
+      break;
+    }
+    _mm_storeu_si128((__m128i *)(out + i),
+                     _mm_packus_epi16(hex_nibble_pair_sse2(n0),
+                                      hex_nibble_pair_sse2(n1)));
+  }
+  return i + hex_decode_scalar(hex + (i * 2), len - i, out + i);
+}
+
+static size_t
+printable_sse2(const uint8_t *b, size_t len)
+{
+  const __m128i low  = _mm_set1_epi8(0x20 - 1);
+  const __m128i high = _mm_set1_epi8(0x7e + 1);
+  size_t i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    /* signed compare, >= 0x80 is negative and fails the low bound */
+    __m128i v  = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, high));
+    if (_mm_movemask_epi8(ok) != 0xffff) {
+      break;
+    }
+  }
+  return i + printable_scalar(b + i, len - i);
+}
+
+#define SP_AVX2 __attribute__((target("avx2")))
+
+static inline SP_AVX2 __m256i
+hex_nibble_to_ascii_avx2(__m256i n)
+{
+  __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)),
+                                   _mm256_set1_epi8('A' - '0' - 0xA));
+  return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), alpha);
+}
+
+static SP_AVX2 void
+hex_encode_avx2(const uint8_t *it, size_t len, char *out)
+{
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  size_t i;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    __m256i v  = _mm256_loadu_si256((const __m256i *)(it + i));
+    __m256i hi = hex_nibble_to_ascii_avx2(
+      _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+    __m256i lo = hex_nibble_to_ascii_avx2(_mm256_and_si256(v, mask));
+    /* unpack works per 128bit lane: [0-7,16-23] and [8-15,24-31] */
+    __m256i f = _mm256_unpacklo_epi8(hi, lo);
+    __m256i s = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i *)(out + (i * 2)),
+                        _mm256_permute2x128_si256(f, s, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + (i * 2) + 32),
+                        _mm256_permute2x128_si256(f, s, 0x31));
+  }
+  hex_encode_sse2(it + i, len - i, out + (i * 2));
+}
+
+static inline SP_AVX2 __m256i
+hex_ascii_to_nibble_avx2(__m256i c, __m256i *valid)
+{
+  __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+  __m256i is_digit =
+    _mm256_andnot_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('9')),
+                        _mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)));
+  __m256i is_alpha =
+    _mm256_andnot_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('f')),
+                        _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)));
+  __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+  __m256i alpha = _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 0xa));
+
+  *valid = _mm256_or_si256(is_digit, is_alpha);
+  return _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                         _mm256_and_si256(is_alpha, alpha));
+}
+
+static inline SP_AVX2 __m256i
+hex_nibble_pair_avx2(__m256i n)
+{
+  return _mm256_or_si256(
+    _mm256_and_si256(_mm256_slli_epi16(n, 4), _mm256_set1_epi16(0xf0)),
+    _mm256_srli_epi16(n, 8));
+}
+
+static SP_AVX2 size_t
+hex_decode_avx2(const char *hex, size_t len, uint8_t *out)
+{
+  size_t i;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    __m256i valid0;
+    __m256i valid1;
+    __m256i packed;
+    __m256i n0 = hex_ascii_to_nibble_avx2(
+      _mm256_loadu_si256((const __m256i *)(hex + (i * 2))), &valid0);
+    __m256i n1 = hex_ascii_to_nibble_avx2(
+      _mm256_loadu_si256((const __m256i *)(hex + (i * 2) + 32)), &valid1);
+    if (_mm256_movemask_epi8(_mm256_and_si256(valid0, valid1)) != -1) {
+      break;
+    }
+    /* pack works per 128bit lane: [0-7,16-23,8-15,24-31] */
+    packed = _mm256_packus_epi16(hex_nibble_pair_avx2(n0),
+                                 hex_nibble_pair_avx2(n1));
+    _mm256_storeu_si256((__m256i *)(out + i),
+                        _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  return i + hex_decode_sse2(hex + (i * 2), len - i, out + i);
+}
+
+static SP_AVX2 size_t
+printable_avx2(const uint8_t *b, size_t len)
+{
+  const __m256i low  = _mm256_set1_epi8(0x20 - 1);
+  const __m256i high = _mm256_set1_epi8(0x7e);
+  size_t i;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    __m256i v  = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i ok = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, high),
+                                     _mm256_cmpgt_epi8(v, low));
+    if (_mm256_movemask_epi8(ok) != -1) {
+      break;
+    }
+  }
+  return i + printable_sse2(b + i, len - i);
+}
+#endif
+
+static struct {
+  void (*hex_encode)(const uint8_t *, size_t, char *);
+  size_t (*hex_decode)(const char *, size_t, uint8_t *);
+  size_t (*printable)(const uint8_t *, size_t);
+} sp_util_simd = {
+#ifdef SP_UTIL_X86
+  /* SSE2 is part of the x86_64 baseline */
+  .hex_encode = hex_encode_sse2,
+  .hex_decode = hex_decode_sse2,
+  .printable  = printable_sse2,
+#else
+  .hex_encode = hex_encode_scalar,
+  .hex_decode = hex_decode_scalar,
+  .printable  = printable_scalar,
+#endif
+};
+
+/* Resolved once at load so the hot paths are a plain indirect call */
+__attribute__((constructor)) static void
+sp_util_simd_init(void)
+{
+#ifdef SP_UTIL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    sp_util_simd.hex_encode = hex_encode_avx2;
+    sp_util_simd.hex_decode = hex_decode_avx2;
+    sp_util_simd.printable  = printable_avx2;
+  }
+#endif
+}
+
 //==============================
 const uint8_t *
 sp_util_hex_encode(const uint8_t *it,
@@ -38,64 +329,92 @@ sp_util_hex_encode(const uint8_t *it,
                    char *out,
                    size_t l_out)
 {
+  size_t len;
+
   assert(l_out > 0);
-  --l_out;
-  if (l_out) {
-    const char *const eout = out + l_out - (l_out % 2);
-
-    while (it != end && out != eout) {
-      *out++ = hex_encode_lookup[(*it >> 4) & 0xf];
-      *out++ = hex_encode_lookup[*it & 0xf];
-      ++it;
-    }
-  }
+  len = sp_min((size_t)(end - it), (l_out - 1) / 2);
 
-  *out = '\0';
-  return it;
+  sp_util_simd.hex_encode(it, len, out);
+  out[len * 2] = '\0';
+
+  return it + len;
 }
 
 const char *
 sp_util_hex_decode(const char *it, size_t lhex, uint8_t *out, size_t lout)
 {
-  const char *const end = it + lhex;
-  //TODO add indicate out length
-  // TODO lowercase parse
-
-  uint8_t lookup[('F' - '0') + 1];
-  lookup['0' - '0'] = 0x0;
-  lookup['1' - '0'] = 0x1;
-  lookup['2' - '0'] = 0x2;
-  lookup['3' - '0'] = 0x3;
-  lookup['4' - '0'] = 0x4;
-  lookup['5' - '0'] = 0x5;
-  lookup['6' - '0'] = 0x6;
-  lookup['7' - '0'] = 0x7;
-  lookup['8' - '0'] = 0x8;
-  lookup['9' - '0'] = 0x9;
-  lookup['A' - '0'] = 0xA;
-  lookup['B' - '0'] = 0xB;
-  lookup['C' - '0'] = 0xC;
-  lookup['D' - '0'] = 0xD;
-  lookup['E' - '0'] = 0xE;
-  lookup['F' - '0'] = 0xF;
+  size_t len;
 
   assert(lhex % 2 == 0);
+  len = sp_min(lhex / 2, lout);
 
-  while (it != end) {
-    int idxf = (int)(*it++ - '0');
-    int idxs = (int)(*it++ - '0');
-    assert(idxf < sizeof(lookup));
-    assert(idxf >= 0);
+  return it + (sp_util_simd.hex_decode(it, len, out) * 2);
+}
+
+/* Per thread, freed with it */
+struct sp_hexdump_ring {
+  char *bufs[SP_HEXDUMP_RING];
+  size_t capacity[SP_HEXDUMP_RING];
+  unsigned int next;
+};
 
-    assert(idxs < sizeof(lookup));
-    assert(idxs >= 0);
+static pthread_key_t sp_hexdump_key;
+static pthread_once_t sp_hexdump_once = PTHREAD_ONCE_INIT;
 
-    uint8_t f = lookup[idxf];
-    uint8_t s = lookup[idxs];
-    *out++    = (f << 4) | s;
+static void
+sp_hexdump_ring_free(void *arg)
+{
+  struct sp_hexdump_ring *ring = arg;
+  size_t i;
+
+  for (i = 0; i < SP_HEXDUMP_RING; ++i) {
+    free(ring->bufs[i]);
+  }
+  free(ring);
+}
+
+static void
+sp_hexdump_key_create(void)
+{
+  pthread_key_create(&sp_hexdump_key, sp_hexdump_ring_free);
+}
+
+const char *
+sp_hexdump(const void *raw, size_t len)
+{
+  /* Ring of buffers so a generated printer can call this for several fields
+   * in the same printf() argument list. */
+  struct sp_hexdump_ring *ring;
+  const size_t needed = (len * 2) + 1;
+  unsigned int idx;
+
+  if (!raw) {
+    return "(NULL)";
+  }
+
+  pthread_once(&sp_hexdump_once, sp_hexdump_key_create);
+  if (!(ring = pthread_getspecific(sp_hexdump_key))) {
+    if (!(ring = calloc(1, sizeof(*ring)))) {
+      return "(ENOMEM)";
+    }
+    if (pthread_setspecific(sp_hexdump_key, ring) != 0) {
+      free(ring);
+      return "(ENOMEM)";
+    }
   }
+  idx = ring->next++ % SP_HEXDUMP_RING;
 
-  return it;
+  if (needed > ring->capacity[idx]) {
+    char *tmp;
+    if (!(tmp = realloc(ring->bufs[idx], needed))) {
+      return "(ENOMEM)";
+    }
+    ring->bufs[idx]     = tmp;
+    ring->capacity[idx] = needed;
+  }
+
+  sp_util_hex_encode(raw, (const uint8_t *)raw + len, ring->bufs[idx], needed);
+  return ring->bufs[idx];
 }
 
 //==============================
@@ -511,13 +830,7 @@ sp_util_sort_ptr_arr(void **arr, size_t arr_len, sp_util_sort_cmp_cb cmp)
 bool
 sp_util_is_printable(const uint8_t *b, size_t len)
 {
-  size_t i;
-  for (i = 0; i < len; ++i) {
-    if (!(isprint(b[i]))) {
-      return false;
-    }
-  }
-  return true;
+  return sp_util_simd.printable(b, len) == len;
 }
 
 //==============================
@@ -537,27 +850,126 @@ sp_util_bin_search(void *arr,
                    size_t needle_sz,
                    sp_util_sort_cmp_cb cmp)
 {
+  uint8_t *it = arr;
+
   while (arr_len > 0) {
     size_t mid_idx = arr_len / 2;
-    void *mid      = arr + (mid_idx * needle_sz);
+    uint8_t *mid   = it + (mid_idx * needle_sz);
     int res        = cmp(needle, mid);
     if (res == 0) {
       return mid;
     }
-    if (mid_idx == 0) {
-      break;
-    }
 
     if (res > 0) {
-      arr = mid;
-    } else if (res < 0) {
+      /* right half, excluding mid */
+      it = mid + needle_sz;
+      arr_len -= mid_idx + 1;
+    } else {
+      /* left half, excluding mid */
+      arr_len = mid_idx;
     }
-    arr_len -= mid_idx;
   } //while
 
   return NULL;
 }
 
+//==============================
+/* Number of entries to prefetch ahead, 16 is 4 levels down the tree */
+#define SP_EYTZINGER_PREFETCH 16
+
+static size_t
+eytzinger_fill(struct sp_util_eytzinger *self,
+               const uint8_t *sorted,
+               size_t i,
+               size_t k)
+{
+  if (k <= self->length) {
+    i = eytzinger_fill(self, sorted, i, 2 * k);
+    memcpy(self->arr + (k * self->entry_sz), sorted + (i * self->entry_sz),
+           self->entry_sz);
+    ++i;
+    i = eytzinger_fill(self, sorted, i, (2 * k) + 1);
+  }
+  return i;
+}
+
+int
+sp_util_eytzinger_init(struct sp_util_eytzinger *self,
+                       const void *sorted,
+                       size_t arr_len,
+                       size_t entry_sz,
+                       sp_util_sort_cmp_cb cmp)
+{
+  assert(self);
+  assert(entry_sz > 0);
+  assert(cmp);
+  assertx(sp_util_is_sorted(sorted, arr_len, entry_sz, cmp));
+
+  memset(self, 0, sizeof(*self));
+  if (!(self->arr = calloc(arr_len + 1, entry_sz))) {
+    return -1;
+  }
+  self->length   = arr_len;
+  self->entry_sz = entry_sz;
+  self->cmp      = cmp;
+
+  eytzinger_fill(self, sorted, 0, 1);
+
+  return 0;
+}
+
+void *
+sp_util_eytzinger_lower_bound(const struct sp_util_eytzinger *self,
+                              const void *needle)
+{
+  size_t n;
+  size_t k = 1;
+
+  assert(self);
+  n = self->length;
+
+  while (k <= n) {
+    size_t pf = sp_min(k * SP_EYTZINGER_PREFETCH, n);
+    __builtin_prefetch(self->arr + (pf * self->entry_sz));
+    k = (2 * k) + (self->cmp(self->arr + (k * self->entry_sz), needle) < 0);
+  } //while
+
+  /* Undo the right turns taken after the last left turn, the node where we
+   * last went left is the lower bound. */
+  k >>= __builtin_ffsll((long long)~k);
+  if (k == 0) {
+    return NULL;
+  }
+
+  return self->arr + (k * self->entry_sz);
+}
+
+void *
+sp_util_eytzinger_search(const struct sp_util_eytzinger *self,
+                         const void *needle)
+{
+  void *result;
+
+  if ((result = sp_util_eytzinger_lower_bound(self, needle))) {
+    if (self->cmp(result, needle) != 0) {
+      result = NULL;
+    }
+  }
+
+  return result;
+}
+
+int
+sp_util_eytzinger_free(struct sp_util_eytzinger *self)
+{
+  assert(self);
+
+  free(self->arr);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
+
 //==============================
 size_t
 sp_util_bin_insert_uniq0(void *arr,
@@ -602,6 +1014,35 @@ sp_util_bin_insert_uniq0(void *arr,
   return res;
 }
 
+/* Index of the first entry not less than $needle, $found is set if equal. */
+static size_t
+sorted_lower_bound(const uint8_t *arr,
+                   size_t arr_len,
+                   const void *needle,
+                   size_t entry_sz,
+                   sp_util_sort_cmp_cb cmp,
+                   bool *found)
+{
+  size_t left  = 0;
+  size_t right = arr_len;
+
+  *found = false;
+  while (left < right) {
+    size_t mid = left + ((right - left) / 2);
+    int eq     = cmp(needle, arr + (mid * entry_sz));
+    if (eq < 0) {
+      right = mid;
+    } else if (eq > 0) {
+      left = mid + 1;
+    } else {
+      *found = true;
+      return mid;
+    }
+  } //while
+
+  return left;
+}
+
 size_t
 sp_util_bin_insert_uniq(void *arr,
                         size_t *arr_len,
@@ -609,8 +1050,270 @@ sp_util_bin_insert_uniq(void *arr,
                         size_t in_size,
                         sp_util_sort_cmp_cb cmp)
 {
-  return sp_util_bin_insert_uniq0(arr, arr_len, in, in_size, cmp,
-                                  sp_util_swap_raw);
+  uint8_t *const start = arr;
+  bool found;
+  size_t idx;
+
+  idx = sorted_lower_bound(start, *arr_len, in, in_size, cmp, &found);
+  if (!found) {
+    uint8_t *dest = start + (idx * in_size);
+    memmove(dest + in_size, dest, (*arr_len - idx) * in_size);
+    memcpy(dest, in, in_size);
+    ++(*arr_len);
+  }
+
+  return idx;
+}
+
+//==============================
+int
+sp_util_sorted_set_init(struct sp_util_sorted_set *self,
+                        size_t entry_sz,
+                        sp_util_sort_cmp_cb cmp)
+{
+  assert(self);
+  assert(entry_sz > 0);
+  assert(cmp);
+
+  memset(self, 0, sizeof(*self));
+  self->entry_sz = entry_sz;
+  self->cmp      = cmp;
+
+  return 0;
+}
+
+int
+sp_util_sorted_set_reserve(struct sp_util_sorted_set *self, size_t capacity)
+{
+  uint8_t *tmp;
+  assert(self);
+
+  if (capacity <= self->capacity) {
+    return 0;
+  }
+
+  if (!(tmp = realloc(self->arr, capacity * self->entry_sz))) {
+    return -1;
+  }
+  self->arr      = tmp;
+  self->capacity = capacity;
+
+  return 0;
+}
+
+void *
+sp_util_sorted_set_insert(struct sp_util_sorted_set *self, const void *in)
+{
+  bool found;
+  size_t idx;
+  uint8_t *dest;
+
+  assert(self);
+
+  idx = sorted_lower_bound(self->arr, self->length, in, self->entry_sz,
+                           self->cmp, &found);
+  if (found) {
+    return self->arr + (idx * self->entry_sz);
+  }
+
+  if (self->length == self->capacity) {
+    if (sp_util_sorted_set_reserve(self, sp_max(16, self->capacity * 2)) != 0) {
+      return NULL;
+    }
+  }
+
+  dest = self->arr + (idx * self->entry_sz);
+  memmove(dest + self->entry_sz, dest, (self->length - idx) * self->entry_sz);
+  memcpy(dest, in, self->entry_sz);
+  ++self->length;
+
+  return dest;
+}
+
+void *
+sp_util_sorted_set_find(const struct sp_util_sorted_set *self,
+                        const void *needle)
+{
+  bool found;
+  size_t idx;
+
+  assert(self);
+
+  idx = sorted_lower_bound(self->arr, self->length, needle, self->entry_sz,
+                           self->cmp, &found);
+  if (!found) {
+    return NULL;
+  }
+
+  return self->arr + (idx * self->entry_sz);
+}
+
+void *
+sp_util_sorted_set_at(const struct sp_util_sorted_set *self, size_t idx)
+{
+  assert(self);
+
+  if (idx >= self->length) {
+    return NULL;
+  }
+
+  return self->arr + (idx * self->entry_sz);
+}
+
+bool
+sp_util_sorted_set_remove(struct sp_util_sorted_set *self, const void *needle)
+{
+  bool found;
+  size_t idx;
+  uint8_t *dest;
+
+  assert(self);
+
+  idx = sorted_lower_bound(self->arr, self->length, needle, self->entry_sz,
+                           self->cmp, &found);
+  if (!found) {
+    return false;
+  }
+
+  dest = self->arr + (idx * self->entry_sz);
+  memmove(dest, dest + self->entry_sz,
+          (self->length - idx - 1) * self->entry_sz);
+  --self->length;
+
+  return true;
+}
+
+/* Remove adjacent duplicates of the sorted [arr, arr_len), returns the new
+ * length. */
+static size_t
+sorted_uniq(uint8_t *arr,
+            size_t arr_len,
+            size_t entry_sz,
+            sp_util_sort_cmp_cb cmp)
+{
+  size_t i;
+  size_t length = 0;
+
+  for (i = 0; i < arr_len; ++i) {
+    uint8_t *cur = arr + (i * entry_sz);
+    if (length > 0 && cmp(arr + ((length - 1) * entry_sz), cur) == 0) {
+      continue;
+    }
+    if (length != i) {
+      memcpy(arr + (length * entry_sz), cur, entry_sz);
+    }
+    ++length;
+  } //for
+
+  return length;
+}
+
+int
+sp_util_sorted_set_build(struct sp_util_sorted_set *self,
+                         const void *arr,
+                         size_t arr_len)
+{
+  assert(self);
+
+  sp_util_sorted_set_clear(self);
+  if (arr_len == 0) {
+    return 0;
+  }
+
+  if (sp_util_sorted_set_reserve(self, arr_len) != 0) {
+    return -1;
+  }
+
+  memcpy(self->arr, arr, arr_len * self->entry_sz);
+  /* libc qsort, sp_util_sort() degrades to O(n^2) on presorted input */
+  qsort(self->arr, arr_len, self->entry_sz, self->cmp);
+  self->length = sorted_uniq(self->arr, arr_len, self->entry_sz, self->cmp);
+
+  return 0;
+}
+
+int
+sp_util_sorted_set_merge(struct sp_util_sorted_set *self,
+                         const void *sorted,
+                         size_t arr_len)
+{
+  const uint8_t *it_f;
+  const uint8_t *it_s;
+  const uint8_t *end_f;
+  const uint8_t *end_s;
+  const size_t sz = self->entry_sz;
+  uint8_t *result;
+  size_t capacity;
+  size_t length = 0;
+
+  assert(self);
+  assertx(sp_util_is_sorted(sorted, arr_len, sz, self->cmp));
+
+  if (arr_len == 0) {
+    return 0;
+  }
+
+  capacity = self->length + arr_len;
+  if (!(result = malloc(capacity * sz))) {
+    return -1;
+  }
+
+  it_f  = self->arr;
+  end_f = self->arr + (self->length * sz);
+  it_s  = sorted;
+  end_s = it_s + (arr_len * sz);
+
+  while (it_f != end_f || it_s != end_s) {
+    const uint8_t *next;
+    if (it_f == end_f) {
+      next = it_s;
+      it_s += sz;
+    } else if (it_s == end_s) {
+      next = it_f;
+      it_f += sz;
+    } else if (self->cmp(it_s, it_f) < 0) {
+      next = it_s;
+      it_s += sz;
+    } else {
+      next = it_f;
+      it_f += sz;
+    }
+
+    if (length > 0 && self->cmp(result + ((length - 1) * sz), next) == 0) {
+      continue;
+    }
+    memcpy(result + (length * sz), next, sz);
+    ++length;
+  } //while
+
+  free(self->arr);
+  self->arr      = result;
+  self->length   = length;
+  self->capacity = capacity;
+
+  return 0;
+}
+
+int
+sp_util_sorted_set_clear(struct sp_util_sorted_set *self)
+{
+  assert(self);
+  self->length = 0;
+
+  return 0;
+}
+
+int
+sp_util_sorted_set_free(struct sp_util_sorted_set *self)
+{
+  assert(self);
+
+  free(self->arr);
+  self->arr      = NULL;
+  self->length   = 0;
+  self->capacity = 0;
+
+  return 0;
 }
 
 //==============================
@@ -23,9 +23,19 @@ sp_util_hex_encode(const uint8_t *it,
                    const uint8_t *const end,
                    char *out,
                    size_t l_out);
+/* Upper and lower case hex digits are accepted. Decoding stops when $lout
+ * is full or on the first invalid digit, the returned pointer is where it
+ * stopped. */
 const char *
 sp_util_hex_decode(const char *hex, size_t lhex, uint8_t *out, size_t lout);
 
+/* Hex string of [raw, raw+len) for use in generated sp_debug_ printers,
+ * valid until SP_HEXDUMP_RING more calls from the same thread. The buffers
+ * are freed when the thread exits. */
+#define SP_HEXDUMP_RING 8
+const char *
+sp_hexdump(const void *raw, size_t len);
+
 //==============================
 void
 sp_util_swap_voidp_impl(void **, void **);
@@ -168,6 +178,41 @@ sp_util_bin_search(void *arr,
                    size_t needle_sz,
                    sp_util_sort_cmp_cb cmp);
 
+//==============================
+/* Build-once/search-many lookup table. The sorted input is copied into
+ * Eytzinger (breadth first) order, node k has its children at 2k and 2k+1,
+ * so the top levels of the implicit tree share a handful of cache lines and
+ * the descent can prefetch the grandchildren several levels ahead.
+ * The compare is used branchless to select the next node.
+ */
+struct sp_util_eytzinger {
+  /* entry 0 is unused, [1, length] are the keys */
+  uint8_t *arr;
+  size_t length;
+  size_t entry_sz;
+  sp_util_sort_cmp_cb cmp;
+};
+
+/* $sorted must be sorted in $cmp order, duplicates are allowed. */
+int
+sp_util_eytzinger_init(struct sp_util_eytzinger *,
+                       const void *sorted,
+                       size_t arr_len,
+                       size_t entry_sz,
+                       sp_util_sort_cmp_cb cmp);
+
+/* Returns the first entry equal to $needle or NULL. */
+void *
+sp_util_eytzinger_search(const struct sp_util_eytzinger *, const void *needle);
+
+/* Returns the first entry not less than $needle or NULL. */
+void *
+sp_util_eytzinger_lower_bound(const struct sp_util_eytzinger *,
+                              const void *needle);
+
+int
+sp_util_eytzinger_free(struct sp_util_eytzinger *);
+
 //==============================
 size_t
 sp_util_bin_insert_uniq0(void *arr,
@@ -183,5 +228,59 @@ sp_util_bin_insert_uniq(void *arr,
                         size_t in_size,
                         sp_util_sort_cmp_cb cmp);
 
+//==============================
+/* Ordered set of fixed size entries stored in a sorted vector. Insert
+ * shifts the tail with a single memmove, bulk build and merge of sorted
+ * runs are O(n log n) and O(n + m) respectively.
+ */
+struct sp_util_sorted_set {
+  uint8_t *arr;
+  size_t length;
+  size_t capacity;
+  size_t entry_sz;
+  sp_util_sort_cmp_cb cmp;
+};
+
+int
+sp_util_sorted_set_init(struct sp_util_sorted_set *,
+                        size_t entry_sz,
+                        sp_util_sort_cmp_cb cmp);
+
+int
+sp_util_sorted_set_reserve(struct sp_util_sorted_set *, size_t capacity);
+
+/* Returns the entry equal to $in, either the inserted copy or the already
+ * present entry. NULL on allocation failure. */
+void *
+sp_util_sorted_set_insert(struct sp_util_sorted_set *, const void *in);
+
+void *
+sp_util_sorted_set_find(const struct sp_util_sorted_set *, const void *needle);
+
+void *
+sp_util_sorted_set_at(const struct sp_util_sorted_set *, size_t idx);
+
+/* Returns true if an entry equal to $needle was removed */
+bool
+sp_util_sorted_set_remove(struct sp_util_sorted_set *, const void *needle);
+
+/* Replace the content with the unique entries of the unsorted $arr. */
+int
+sp_util_sorted_set_build(struct sp_util_sorted_set *,
+                         const void *arr,
+                         size_t arr_len);
+
+/* Merge the $sorted run into the set, duplicates are dropped. */
+int
+sp_util_sorted_set_merge(struct sp_util_sorted_set *,
+                         const void *sorted,
+                         size_t arr_len);
+
+int
+sp_util_sorted_set_clear(struct sp_util_sorted_set *);
+
+int
+sp_util_sorted_set_free(struct sp_util_sorted_set *);
+
 //==============================
 #endif
@@ -2,8 +2,10 @@
 #include <tree_sitter/api.h>
 
 #include "shared.h"
+#include "struct.h"
 #include "to_string.h"
 #include "sp_str.h"
+#include "sp_util.h"
 
 #include <string.h>
 #include <fcntl.h>
@@ -13,16 +15,11 @@
 #include <sys/stat.h>
 #include <stdint.h>
 #include <assert.h>
+#include <ctype.h>
 #include <limits.h>
 #include <errno.h>
 #include <jansson.h>
 
-extern const TSLanguage *
-tree_sitter_c(void);
-
-extern const TSLanguage *
-tree_sitter_cpp(void);
-
 static struct arg_list *
 __field_to_arg(struct sp_ts_Context *ctx,
                TSNode subject,
@@ -61,7 +58,7 @@ sp_struct_value(struct sp_ts_Context *ctx, TSNode subject)
 }
 
 static void
-debug_subtypes_rec(struct sp_ts_Context *ctx, TSNode node, size_t indent)
+print_subtypes_rec(struct sp_ts_Context *ctx, TSNode node, size_t indent)
 {
   uint32_t i;
   for (i = 0; i < ts_node_child_count(node); ++i) {
@@ -84,7 +81,15 @@ debug_subtypes_rec(struct sp_ts_Context *ctx, TSNode node, size_t indent)
     }
     fprintf(stderr, "\n");
 
-    debug_subtypes_rec(ctx, child, indent + 1);
+    print_subtypes_rec(ctx, child, indent + 1);
+  }
+}
+
+static void
+debug_subtypes_rec(struct sp_ts_Context *ctx, TSNode node, size_t indent)
+{
+  if (ctx->debug) {
+    print_subtypes_rec(ctx, node, indent);
   }
 }
 
@@ -112,7 +117,7 @@ __leafs(struct sp_ts_Context *ctx, TSNode subject, struct list_TSNode *result)
   return result;
 }
 
-static bool
+bool
 is_c_file(const char *file)
 {
   struct sp_str str;
@@ -124,7 +129,7 @@ is_c_file(const char *file)
   return result;
 }
 
-static bool
+bool
 is_cpp_file(const char *file)
 {
   struct sp_str str;
@@ -138,7 +143,7 @@ is_cpp_file(const char *file)
   return result;
 }
 
-static enum sp_ts_SourceDomain
+enum sp_ts_SourceDomain
 get_domain(const char *file)
 {
   if (strcasestr(file, "-linux-axis") != NULL)
@@ -267,7 +272,12 @@ parse_int(struct sp_ts_Context *ctx, TSNode subject, int64_t *result)
   int len         = (int)(e - s);
   char *str_end   = NULL;
 
+  if ((size_t)len >= sizeof(buffer)) {
+    return false;
+  }
+
   sprintf(buffer, "%.*s", len, &ctx->file.content[s]);
+  errno   = 0;
   *result = strtoll(buffer, &str_end, 10);
 
   if (errno == ERANGE && (*result == INT64_MAX || *result == INT64_MIN)) {
@@ -288,19 +298,23 @@ is_enum_bitmask(struct sp_ts_Context *ctx, TSNode subject)
 #define MAX_LITERALS 200
   int64_t literals[MAX_LITERALS] = {0};
   size_t n_literals              = 0;
+  char *enum_cache[MAX_LITERALS] = {NULL};
+  size_t n_enum_cache            = 0;
+  bool result                    = true;
 
   debug_subtypes_rec(ctx, subject, 0);
   enum_list = find_direct_chld_by_type(subject, "enumerator_list");
   if (!ts_node_is_null(enum_list)) {
-    char *enum_cache[MAX_LITERALS] = {NULL};
-    size_t n_enum_cache            = 0;
     uint32_t i;
 
     for (i = 0; i < ts_node_child_count(enum_list); ++i) {
       TSNode enumerator = ts_node_child(enum_list, i);
       if (strcmp(ts_node_type(enumerator), "enumerator") == 0) {
         TSNode id = ts_node_child(enumerator, 0);
-        //TODO reclaim
+        if (n_enum_cache == MAX_LITERALS) {
+          /* more enumerators than we track, $literals is bound by this too */
+          goto Lfalse;
+        }
         enum_cache[n_enum_cache++] = sp_struct_value(ctx, id);
       }
     } //for
@@ -332,21 +346,21 @@ is_enum_bitmask(struct sp_ts_Context *ctx, TSNode subject)
           TSNode node1;
 
           if (ts_node_child_count(tmp) != 3) {
-            return false;
+            goto Lfalse;
           }
 
           node0 = ts_node_child(tmp, 0);
           if (strcmp(ts_node_type(node0), "(") != 0) {
-            return false;
+            goto Lfalse;
           }
 
           op = ts_node_child(tmp, 1);
           if (strcmp(ts_node_type(op), "binary_expression") != 0) {
-            return false;
+            goto Lfalse;
           }
           node1 = ts_node_child(tmp, 2);
           if (strcmp(ts_node_type(node1), ")") != 0) {
-            return false;
+            goto Lfalse;
           }
           enumerator = tmp;
         }
@@ -369,7 +383,7 @@ is_enum_bitmask(struct sp_ts_Context *ctx, TSNode subject)
           TSNode op;
           TSNode node1;
           if (ts_node_child_count(tmp) != 3) {
-            return false;
+            goto Lfalse;
           }
 
           node0 = ts_node_child(tmp, 0);
@@ -383,22 +397,26 @@ is_enum_bitmask(struct sp_ts_Context *ctx, TSNode subject)
             int64_t literal1;
             int64_t tmp_mask = 0;
             if (!parse_int(ctx, node0, &literal0)) {
-              return false;
+              goto Lfalse;
             }
             if (!parse_int(ctx, node1, &literal1)) {
-              return false;
+              goto Lfalse;
+            }
+            if (literal0 < 0 || literal1 < 0 || literal1 > 62 ||
+                literal0 > (INT64_MAX >> literal1)) {
+              goto Lfalse;
             }
             literals[n_literals++] = literal0 << literal1;
             for (a = 0; a < n_literals; ++a) {
               if (tmp_mask & literals[a]) {
-                return false;
+                goto Lfalse;
               }
               tmp_mask |= literals[a];
             }
           } else if (strcmp(ts_node_type(op), "|") == 0) {
             //TODO
           } else {
-            return false;
+            goto Lfalse;
           }
         } else {
           tmp = find_direct_chld_by_type(enumerator, "number_literal");
@@ -408,12 +426,12 @@ is_enum_bitmask(struct sp_ts_Context *ctx, TSNode subject)
             int64_t literal;
             int64_t tmp_mask = 0;
             if (!parse_int(ctx, tmp, &literal)) {
-              return false;
+              goto Lfalse;
             }
             literals[n_literals++] = literal;
             for (a = 0; a < n_literals; ++a) {
               if (tmp_mask & literals[a]) {
-                return false;
+                goto Lfalse;
               }
               tmp_mask |= literals[a];
             }
@@ -443,29 +461,29 @@ is_enum_bitmask(struct sp_ts_Context *ctx, TSNode subject)
               TSNode op;
               TSNode node1;
               if (ts_node_child_count(enumerator) != 3) {
-                return false;
+                goto Lfalse;
               }
 
               op = ts_node_child(enumerator, 1);
               if (strcmp(ts_node_type(op), "=") != 0) {
-                return false;
+                goto Lfalse;
               }
               node1 = ts_node_child(enumerator, 2);
               if (strcmp(ts_node_type(node1), "identifier") != 0) {
-                return false;
+                goto Lfalse;
               } else {
                 size_t a;
                 char *ref  = sp_struct_value(ctx, node1);
                 bool found = false;
-                for (a = 0; a < n_enum_cache; ++a) {
-                  if (strcmp(enum_cache[a], ref) == 0) {
+                for (a = 0; ref && a < n_enum_cache; ++a) {
+                  if (enum_cache[a] && strcmp(enum_cache[a], ref) == 0) {
                     found = true;
                     break;
                   }
                 }
                 free(ref);
                 if (!found) {
-                  return false;
+                  goto Lfalse;
                 }
               }
             }
@@ -475,47 +493,70 @@ is_enum_bitmask(struct sp_ts_Context *ctx, TSNode subject)
     } //for
   }
 
-  return true;
+Lout:
+  while (n_enum_cache > 0) {
+    free(enum_cache[--n_enum_cache]);
+  }
+  return result;
+Lfalse:
+  result = false;
+  goto Lout;
+}
+
+static void
+print_json_empty_response(struct sp_ts_Context *ctx)
+{
+  ctx->inserts.responded = true;
 }
 
 static void
-print_json_empty_response(void)
+print_json_response(struct sp_ts_Context *ctx, uint32_t line, const char *data)
 {
+  sp_ts_inserts_add(&ctx->inserts, line, data);
+}
+
+json_t *
+sp_ts_inserts_to_json(const struct sp_ts_inserts *inserts)
+{
+  size_t i;
   json_t *root         = json_object();
   json_t *json_inserts = json_array();
-  json_object_set_new(root, "inserts", json_inserts);
 
-  {
-    char *r = json_dumps(root, JSON_PRESERVE_ORDER);
-    fprintf(stdout, "%s", r);
-    fflush(stdout);
-    free(r);
+  for (i = 0; i < inserts->length; ++i) {
+    json_t *json_insert = json_object();
+    json_object_set_new(json_insert, "data",
+                        json_string(inserts->arr[i].data));
+    json_object_set_new(json_insert, "line",
+                        json_integer(inserts->arr[i].line));
+    json_object_set_new(json_insert, "byte",
+                        json_integer(inserts->arr[i].byte));
+    json_array_append_new(json_inserts, json_insert);
   }
-  json_decref(root);
+  json_object_set_new(root, "inserts", json_inserts);
+  if (inserts->parse == SP_TS_PARSE_TIMEOUT) {
+    json_object_set_new(root, "timeout", json_true());
+  } else if (inserts->parse == SP_TS_PARSE_CANCELLED) {
+    json_object_set_new(root, "cancelled", json_true());
+  }
+
+  return root;
 }
 
-static void
-print_json_response(uint32_t line, const char *data)
+void
+sp_ts_print_json_response(FILE *out, const struct sp_ts_inserts *inserts)
 {
-  json_t *root = json_object();
-  {
-    json_t *json_inserts = json_array();
-    {
-      json_t *json_insert = json_object();
-      json_object_set_new(json_insert, "data", json_string(data));
-      json_object_set_new(json_insert, "line", json_integer(line));
-      json_array_append_new(json_inserts, json_insert);
-    }
-    json_object_set_new(root, "inserts", json_inserts);
-  }
+  json_t *root;
+  char *r;
 
-  {
-    char *r = json_dumps(root, JSON_PRESERVE_ORDER);
-    fprintf(stdout, "%s", r);
-    fflush(stdout);
-    free(r);
+  if (!inserts->responded) {
+    return;
   }
 
+  root = sp_ts_inserts_to_json(inserts);
+  r    = json_dumps(root, JSON_PRESERVE_ORDER);
+  fprintf(out, "%s", r);
+  fflush(out);
+  free(r);
   json_decref(root);
 }
 
@@ -643,7 +684,7 @@ sp_print_enum(struct sp_ts_Context *ctx,
   }
 
   /* fprintf(stdout, "%s", sp_str_c_str(&buf)); */
-  print_json_response(ctx->output_line, sp_str_c_str(&buf));
+  print_json_response(ctx, ctx->output_line, sp_str_c_str(&buf));
 
 Lout:
   sp_str_free(&buf);
@@ -803,18 +844,18 @@ __field_type(struct sp_ts_Context *ctx,
                 }
               } //for
 #if 0
-              fprintf(stderr, "------------enum\n");
+              sp_ts_debug(ctx, "------------enum\n");
               for (i = 0; i < ts_node_child_count(enum_list); ++i) {
                 TSNode child = ts_node_child(enum_list, i);
                 uint32_t s   = ts_node_start_byte(child);
                 uint32_t e   = ts_node_end_byte(child);
                 uint32_t len = e - s;
-                fprintf(stderr, ".%u\n", i);
-                fprintf(stderr, "children: %u\n", ts_node_child_count(child));
-                fprintf(stderr, "%.*s: %s\n", (int)len, &ctx->file.content[s],
-                        ts_node_type(child));
+                sp_ts_debug(ctx, ".%u\n", i);
+                sp_ts_debug(ctx, "children: %u\n", ts_node_child_count(child));
+                sp_ts_debug(ctx, "%.*s: %s\n", (int)len, &ctx->file.content[s],
+                            ts_node_type(child));
               }
-              fprintf(stderr, "------------enum END\n");
+              sp_ts_debug(ctx, "------------enum END\n");
 #endif
               enums_it = enum_dummy.next;
               while (enums_it) {
@@ -845,22 +886,22 @@ __field_type(struct sp_ts_Context *ctx,
           struct_spec = find_direct_chld_by_type(subject, "struct_specifier");
           if (!ts_node_is_null(struct_spec)) {
             TSNode type_id;
-            fprintf(stderr, "5\n");
+            sp_ts_debug(ctx, "5\n");
             /* debug_subtypes_rec(ctx, subject, 0); */
             type_id = find_direct_chld_by_type(struct_spec, "type_identifier");
             if (!ts_node_is_null(type_id)) {
-              fprintf(stderr, "5.1\n");
+              sp_ts_debug(ctx, "5.1\n");
               result->type = sp_struct_value(ctx, type_id);
             } else {
               TSNode field_decl_l;
-              fprintf(stderr, "5.2\n");
+              sp_ts_debug(ctx, "5.2\n");
               field_decl_l =
                 find_direct_chld_by_type(struct_spec, "field_declaration_list");
               if (!ts_node_is_null(field_decl_l)) {
                 uint32_t i;
                 struct arg_list field_dummy = {0};
                 struct arg_list *field_it   = &field_dummy;
-                fprintf(stderr, "5.2.1\n");
+                sp_ts_debug(ctx, "5.2.1\n");
                 for (i = 0; i < ts_node_child_count(field_decl_l); ++i) {
                   TSNode field = ts_node_child(field_decl_l, i);
                   /* fprintf(stderr, "i.%u\n", i); */
@@ -877,7 +918,7 @@ __field_type(struct sp_ts_Context *ctx,
                 } //for
                 result->rec = field_dummy.next;
               } else {
-                fprintf(stderr, "5.2.2\n");
+                sp_ts_debug(ctx, "5.2.2\n");
               }
             }
           } else {
@@ -920,7 +961,7 @@ __field_type(struct sp_ts_Context *ctx,
                   }
                   debug_subtypes_rec(ctx, tmp, 0);
                 } else {
-                  fprintf(stderr, "HERE\n");
+                  sp_ts_debug(ctx, "HERE\n");
                   debug_subtypes_rec(ctx, subject, 0);
                 }
               }
@@ -944,7 +985,7 @@ __field_name(struct sp_ts_Context *ctx, TSNode subject, const char *id_type)
   struct arg_list *result = NULL;
   result                  = calloc(1, sizeof(*result));
 
-  fprintf(stderr, "%s:{\n", __func__);
+  sp_ts_debug(ctx, "%s:{\n", __func__);
   debug_subtypes_rec(ctx, subject, 0);
 
   TSNode init_decl = find_direct_chld_by_type(subject, "init_declarator");
@@ -1028,7 +1069,7 @@ xx(struct sp_ts_Context *ctx,
           TSNode par_decl;
           par_decl =
             find_direct_chld_by_type(fun_decl, "parenthesized_declarator");
-          fprintf(stderr, "%s:4\n", __func__);
+          sp_ts_debug(ctx, "%s:4\n", __func__);
 
           /* fprintf(stderr, "%s: 1\n", __func__); */
           if (!ts_node_is_null(par_decl)) {
@@ -1037,7 +1078,7 @@ xx(struct sp_ts_Context *ctx,
               tmp = __rec_search(ctx, tmp, id_type, 1, &result->pointer);
               if (!ts_node_is_null(tmp)) {
                 result->variable = sp_struct_value(ctx, tmp);
-                fprintf(stderr, "||%s\n", result->variable);
+                sp_ts_debug(ctx, "||%s\n", result->variable);
                 result->function_pointer = true;
               }
             }
@@ -1089,8 +1130,12 @@ __parameter_to_arg(struct sp_ts_Context *ctx, TSNode subject)
   return result;
 }
 
-static int
-sp_do_print_function(struct sp_ts_Context *ctx, struct arg_list *const fields)
+/* One print statement of the fields [$fields, $end) appended to $out */
+static void
+sp_do_print_statement(struct sp_ts_Context *ctx,
+                      struct arg_list *const fields,
+                      const struct arg_list *end,
+                      sp_str *out)
 {
   const size_t MAX_LINE = 75;
   sp_str buf;
@@ -1121,14 +1166,14 @@ sp_do_print_function(struct sp_ts_Context *ctx, struct arg_list *const fields)
   sp_str_append(&buf, "\"%s:");
   line_length = sp_str_length(&buf);
   field_it    = fields;
-  while (field_it) {
+  while (field_it != end) {
     if (field_it->complete) {
       sp_str_appends(&line_buf, field_it->variable, "[", field_it->format, "]",
                      NULL);
       ++complete;
     } else {
-      fprintf(stderr, "%s: Incomplete: var:%s: type:%s\n", __func__,
-              field_it->variable ?: "NULL", field_it->type ?: "NULL");
+      sp_ts_debug(ctx, "%s: Incomplete: var:%s: type:%s\n", __func__,
+                  field_it->variable ?: "NULL", field_it->type ?: "NULL");
     }
     field_it = field_it->next;
     if ((line_length + sp_str_length(&line_buf)) > MAX_LINE) {
@@ -1145,7 +1190,7 @@ sp_do_print_function(struct sp_ts_Context *ctx, struct arg_list *const fields)
   }
   sp_str_append(&buf, "\", __func__");
   field_it = fields;
-  while (field_it) {
+  while (field_it != end) {
     if (field_it->complete) {
       sp_str_append(&buf, ", ");
       if (field_it->complex_printf) {
@@ -1159,10 +1204,35 @@ sp_do_print_function(struct sp_ts_Context *ctx, struct arg_list *const fields)
   } //while
   sp_str_append(&buf, ");");
 
-  print_json_response(ctx->output_line, sp_str_c_str(&buf));
+  sp_str_append_str(out, &buf);
 
   sp_str_free(&line_buf);
   sp_str_free(&buf);
+}
+
+static int
+sp_do_print_function(struct sp_ts_Context *ctx, struct arg_list *const fields)
+{
+  struct arg_list *first = fields;
+  struct arg_list *it;
+  size_t hexdumps = 0;
+  sp_str buf;
+
+  sp_str_init(&buf, 0);
+  /* a sp_hexdump() result is only valid for SP_HEXDUMP_RING calls, the
+   * fields after that many are printed by another statement */
+  for (it = fields; it; it = it->next) {
+    if (it->complete && it->hexdump && hexdumps++ == SP_HEXDUMP_RING) {
+      sp_do_print_statement(ctx, first, it, &buf);
+      sp_str_append(&buf, "\n");
+      first    = it;
+      hexdumps = 1;
+    }
+  } //for
+  sp_do_print_statement(ctx, first, NULL, &buf);
+
+  print_json_response(ctx, ctx->output_line, sp_str_c_str(&buf));
+  sp_str_free(&buf);
 
   return EXIT_SUCCESS;
 }
@@ -1206,7 +1276,7 @@ sp_print_function_args(struct sp_ts_Context *ctx, TSNode subject)
         }
       } //for
     } else {
-      fprintf(stderr, "null\n");
+      sp_ts_debug(ctx, "null\n");
     }
 
   } else {
@@ -1214,6 +1284,7 @@ sp_print_function_args(struct sp_ts_Context *ctx, TSNode subject)
   }
 
   sp_do_print_function(ctx, field_dummy.next);
+  arg_list_free(field_dummy.next);
   return res;
 }
 
@@ -1291,6 +1362,7 @@ sp_print_locals(struct sp_ts_Context *ctx, TSNode subject)
   /* fprintf(stderr, "============================\n"); */
   /* debug_subtypes_rec(ctx, it, 0); */
   sp_do_print_function(ctx, field_dummy.next);
+  arg_list_free(field_dummy.next);
 
   return res;
 }
@@ -1361,7 +1433,7 @@ sp_print_typedef(struct sp_ts_Context *ctx, TSNode type_def)
     }
 
     sp_do_print_typedef(type_name, t_type_name, &buf);
-    print_json_response(ctx->output_line, sp_str_c_str(&buf));
+    print_json_response(ctx, ctx->output_line, sp_str_c_str(&buf));
 
     res = EXIT_SUCCESS;
   } else {
@@ -1386,7 +1458,7 @@ sp_print_typedef(struct sp_ts_Context *ctx, TSNode type_def)
     }
 
     sp_do_print_typedef(type_name, t_type_name, &buf);
-    print_json_response(ctx->output_line, sp_str_c_str(&buf));
+    print_json_response(ctx, ctx->output_line, sp_str_c_str(&buf));
 
     res = EXIT_SUCCESS;
   }
@@ -1434,8 +1506,8 @@ sp_do_print_struct(struct sp_ts_Context *ctx,
                      NULL);
       ++complete;
     } else {
-      fprintf(stderr, "%s: Incomplete: %s\n", __func__,
-              field_it->variable ?: "NULL");
+      sp_ts_debug(ctx, "%s: Incomplete: %s\n", __func__,
+                  field_it->variable ?: "NULL");
     }
     field_it = field_it->next;
   } //while
@@ -1462,7 +1534,7 @@ sp_do_print_struct(struct sp_ts_Context *ctx,
     sp_do_print_typedef(type_name, t_type_name, &buf);
   }
 
-  print_json_response(ctx->output_line, sp_str_c_str(&buf));
+  print_json_response(ctx, ctx->output_line, sp_str_c_str(&buf));
 
   sp_str_free(&buf);
   return EXIT_SUCCESS;
@@ -1511,6 +1583,7 @@ sp_print_struct(struct sp_ts_Context *ctx,
   }
 
   sp_do_print_struct(ctx, type_name, t_type_name, field_dummy.next, pprefix2);
+  arg_list_free(field_dummy.next);
   res = EXIT_SUCCESS;
 Lexit:
   free(type_name);
@@ -1544,8 +1617,8 @@ sp_do_print_class(struct sp_ts_Context *ctx,
                      NULL);
       ++complete;
     } else {
-      fprintf(stderr, "%s: Incomplete: %s\n", __func__,
-              field_it->variable ?: "NULL");
+      sp_ts_debug(ctx, "%s: Incomplete: %s\n", __func__,
+                  field_it->variable ?: "NULL");
     }
     field_it = field_it->next;
   } //while
@@ -1568,7 +1641,7 @@ sp_do_print_class(struct sp_ts_Context *ctx,
   sp_str_appends(&buf, indent, "  return buf;\n", NULL);
   sp_str_appends(&buf, indent, "}\n", NULL);
 
-  print_json_response(row, sp_str_c_str(&buf));
+  print_json_response(ctx, row, sp_str_c_str(&buf));
 
   sp_str_free(&buf);
   return EXIT_SUCCESS;
@@ -1630,8 +1703,10 @@ sp_print_class(struct sp_ts_Context *ctx, TSNode subject)
     }
 
     sp_do_print_class(ctx, type_name, field_dummy.next, pprefix2, row);
+    arg_list_free(field_dummy.next);
     res = EXIT_SUCCESS;
   }
+  free(type_name);
   return res;
 }
 
@@ -1659,49 +1734,32 @@ sp_find_open_bracket(TSNode subject)
   /*             } */
 }
 
-static int
-main_print(const char *in_file, int kind)
+const TSLanguage *
+sp_ts_file_language(const char *file)
 {
-  int res                  = EXIT_FAILURE;
-  struct sp_ts_Context ctx = {0};
-  if (mmap_file(in_file, &ctx.file) == 0) {
-    TSParser *parser = ts_parser_new();
-    if (is_cpp_file(in_file)) {
-      const TSLanguage *cpplang = tree_sitter_cpp();
-      fprintf(stderr, "cpp\n");
-      ts_parser_set_language(parser, cpplang);
-    } else if (is_c_file(in_file)) {
-      const TSLanguage *clang = tree_sitter_c();
-      fprintf(stderr, "c\n");
-      ts_parser_set_language(parser, clang);
-    } else {
-      const TSLanguage *clang = tree_sitter_c();
-      fprintf(stderr, "unknown (c)\n");
-      ts_parser_set_language(parser, clang);
-    }
+  if (is_cpp_file(file)) {
+    return tree_sitter_cpp();
+  }
+  return tree_sitter_c();
+}
 
-    ctx.tree = ts_parser_parse_string(parser, NULL, ctx.file.content,
-                                      (uint32_t)ctx.file.length);
-    if (!ctx.tree) {
-      fprintf(stderr, "failed to parse\n");
-      goto Lerr;
-    }
+int
+sp_ts_print(struct sp_ts_Context *ctx, int kind)
+{
+  TSNode root = ts_tree_root_node(ctx->tree);
+  if (ts_node_is_null(root)) {
+    return EXIT_FAILURE;
+  }
 
-    if (kind == 0) {
-      TSNode root = ts_tree_root_node(ctx.tree);
-      if (!ts_node_is_null(root)) {
-        printf("%s\n", ts_node_string(root));
-      } else {
-        goto Lerr;
-      }
-    } else {
-      TSNode root = ts_tree_root_node(ctx.tree);
-      debug_subtypes_rec(&ctx, root, 0);
-    }
+  if (kind == 0) {
+    char *str = ts_node_string(root);
+    printf("%s\n", str);
+    free(str);
+  } else {
+    print_subtypes_rec(ctx, root, 0);
   }
-  res = EXIT_SUCCESS;
-Lerr:
-  return res;
+
+  return EXIT_SUCCESS;
 }
 
 static TSNode
@@ -1748,15 +1806,18 @@ new_branch_list(const char *context,
                 uint32_t depth)
 {
   struct branch_list *result;
-  char new_context_tmp[128] = {'\0'};
-  char *new_context         = NULL;
+  char *new_context = NULL;
 
+  /* unbounded, the context grows with the nesting depth */
   if (strlen(context) > 0) {
-    sprintf(new_context_tmp, "%s.%d", context, branch_id);
+    if (asprintf(&new_context, "%s.%u", context, branch_id) < 0) {
+      new_context = NULL;
+    }
   } else {
-    sprintf(new_context_tmp, "%d", branch_id);
+    if (asprintf(&new_context, "%u", branch_id) < 0) {
+      new_context = NULL;
+    }
   }
-  new_context = strdup(new_context_tmp);
 
   result  = calloc(1, sizeof(*result));
   *result = (struct branch_list){
@@ -1790,9 +1851,8 @@ sp_branches_compound_statement_rec(struct sp_ts_Context *ctx,
     const char *open_bracket_type = ts_node_type(open_bracket);
 
     if (strcmp(open_bracket_type, "{") != 0) {
-      fprintf(stderr, "%s:open_bracket_type[%s]\n", __func__,
-              open_bracket_type);
-      exit(1); //BUG
+      sp_ts_debug(ctx, "%s:open_bracket_type[%s]\n", __func__,
+                  open_bracket_type);
       return false;
     }
 
@@ -1898,7 +1958,7 @@ sp_print_branches(struct sp_ts_Context *ctx, TSNode subject)
   body = find_direct_chld_by_type(subject, "compound_statement");
   if (!ts_node_is_null(body)) {
     debug_subtypes_rec(ctx, body, 0);
-    fprintf(stderr, "\n");
+    sp_ts_debug(ctx, "\n");
     /* printf("%s:\n", __func__); */
     /* debug_subtypes_rec(ctx, body, 0); */
     if (!sp_branches_rec(ctx, body, &dummy, "", 0, 1)) {
@@ -1907,135 +1967,66 @@ sp_print_branches(struct sp_ts_Context *ctx, TSNode subject)
   }
 
   {
-    // since by adding a line above we alter what line we should insert next
-    uint32_t len = 0;
-    json_t *root = json_object();
-    {
-      json_t *json_inserts = json_array();
-      for (it = dummy.next; it; it = it->next) {
-        json_t *json_insert = json_object();
-        {
-          uint32_t i;
-
-          for (i = 0; i < it->depth; ++i) {
-            sp_str_append(&buf, "  ");
-          }
+    /* at the lines as parsed, sp_ts_inserts_finish() accounts for the lines
+     * added above */
+    for (it = dummy.next; it; it = it->next) {
+      uint32_t i;
+      bool trailing_newline = true;
 
-          bool trailing_newline = true;
-          if (ctx->domain == DEFAULT_DOMAIN) {
-            sp_str_append(&buf, "  fprintf(stderr, ");
-          } else if (ctx->domain == LOG_ERR_DOMAIN) {
-            sp_str_append(&buf, "  log_err(");
-          } else if (ctx->domain == SYSLOG_DOMAIN) {
-            sp_str_append(&buf, "syslog(LOG_ERR, ");
-          } else if (ctx->domain == F_ERROR_DOMAIN) {
-            sp_str_append(&buf, "  f_error(");
-          } else if (ctx->domain == AX_ERROR_DOMAIN) {
-            sp_str_append(&buf, "  ax_error(");
-            /* trailing_newline = false; */
-          } else if (ctx->domain == LINUX_KERNEL_DOMAIN) {
-            sp_str_append(&buf, "printk(KERN_ERR ");
-          }
+      for (i = 0; i < it->depth; ++i) {
+        sp_str_append(&buf, "  ");
+      }
 
-          sp_str_appends(&buf, "\"%s:", it->context, NULL);
-          if (trailing_newline) {
-            sp_str_append(&buf, "\\n");
-          }
-          sp_str_append(&buf, "\", __func__);");
-          json_object_set_new(json_insert, "data",
-                              json_string(sp_str_c_str(&buf)));
-        }
-        json_object_set_new(json_insert, "line", json_integer(it->line + len));
-        json_array_append_new(json_inserts, json_insert);
-        ++len;
+      if (ctx->domain == DEFAULT_DOMAIN) {
+        sp_str_append(&buf, "  fprintf(stderr, ");
+      } else if (ctx->domain == LOG_ERR_DOMAIN) {
+        sp_str_append(&buf, "  log_err(");
+      } else if (ctx->domain == SYSLOG_DOMAIN) {
+        sp_str_append(&buf, "syslog(LOG_ERR, ");
+      } else if (ctx->domain == F_ERROR_DOMAIN) {
+        sp_str_append(&buf, "  f_error(");
+      } else if (ctx->domain == AX_ERROR_DOMAIN) {
+        sp_str_append(&buf, "  ax_error(");
+        /* trailing_newline = false; */
+      } else if (ctx->domain == LINUX_KERNEL_DOMAIN) {
+        sp_str_append(&buf, "printk(KERN_ERR ");
+      }
 
-        sp_str_clear(&buf);
+      sp_str_appends(&buf, "\"%s:", it->context, NULL);
+      if (trailing_newline) {
+        sp_str_append(&buf, "\\n");
       }
-      json_object_set_new(root, "inserts", json_inserts);
-    }
+      sp_str_append(&buf, "\", __func__);");
+      print_json_response(ctx, it->line, sp_str_c_str(&buf));
 
-    {
-      char *json_response;
-      json_response = json_dumps(root, JSON_PRESERVE_ORDER);
-      fprintf(stdout, "%s", json_response);
-      fflush(stdout);
-      free(json_response);
+      sp_str_clear(&buf);
     }
-
-    json_decref(root);
+    /* an empty array is still a response */
+    print_json_empty_response(ctx);
   }
 
+  it = dummy.next;
+  while (it) {
+    struct branch_list *next = it->next;
+    free(it->context);
+    free(it);
+    it = next;
+  } //while
+
   sp_str_free(&buf);
   return EXIT_SUCCESS;
 }
 
 int
-main(int argc, const char *argv[])
+sp_ts_request(struct sp_ts_Context *ctx, const char *in_type, TSPoint pos)
 {
-  int res                  = EXIT_FAILURE;
-  struct sp_ts_Context ctx = {0};
-  const char *in_type      = NULL;
-  const char *in_file      = NULL;
-  const char *in_line      = NULL;
-  const char *in_column    = NULL;
-  TSPoint pos              = {0};
-
-  if (argc != 5) {
-    if (argc > 1) {
-      in_type = argv[1];
-      if (argc == 3 && strcmp(in_type, "print") == 0) {
-        in_file = argv[2];
-        return main_print(in_file, 0);
-      } else if (argc == 3 && strcmp(in_type, "print2") == 0) {
-        in_file = argv[2];
-        return main_print(in_file, 1);
-      }
-    }
-    fprintf(stderr, "%s crunch|line|print|branches file line column\n",
-            argv[0]);
-    return EXIT_FAILURE;
-  }
-  in_type   = argv[1];
-  in_file   = argv[2];
-  in_line   = argv[3];
-  in_column = argv[4];
-
-  if (!sp_parse_uint32_t(in_line, &pos.row)) {
-    fprintf(stderr, "failed to parse line '%s'\n", in_line);
-    return EXIT_FAILURE;
-  }
-  if (!sp_parse_uint32_t(in_column, &pos.column)) {
-    fprintf(stderr, "failed to parse column '%s'\n", in_column);
-    return EXIT_FAILURE;
-  }
-  ctx.output_line = pos.row + 1;
-
-  if (mmap_file(in_file, &ctx.file) != 0) {
-    return EXIT_FAILURE;
-  }
-  TSParser *parser = ts_parser_new();
-  if (is_cpp_file(in_file)) {
-    const TSLanguage *cpplang = tree_sitter_cpp();
-    ts_parser_set_language(parser, cpplang);
-  } else if (is_c_file(in_file)) {
-    const TSLanguage *clang = tree_sitter_c();
-    ts_parser_set_language(parser, clang);
-  } else {
-    const TSLanguage *clang = tree_sitter_c();
-    ts_parser_set_language(parser, clang);
-  }
-  ctx.domain = get_domain(in_file);
-
+  int res = EXIT_FAILURE;
   TSNode root;
-  ctx.tree = ts_parser_parse_string(parser, NULL, ctx.file.content,
-                                    (uint32_t)ctx.file.length);
-  if (!ctx.tree) {
-    fprintf(stderr, "failed to parse\n");
-    goto Lerr;
-  }
+
+  ctx->output_line = pos.row + 1;
 
   /* ts_tree_print_dot_graph(tree, stdout); */
-  root = ts_tree_root_node(ctx.tree);
+  root = ts_tree_root_node(ctx->tree);
   if (!ts_node_is_null(root)) {
     TSNode highligted;
     highligted = ts_node_descendant_for_point_range(root, pos, pos);
@@ -2045,7 +2036,7 @@ main(int argc, const char *argv[])
         TSPoint hpoint = ts_node_start_point(highligted);
         if (ts_node_is_null(fun)) {
           // we can only print locals inside a function
-          print_json_empty_response();
+          print_json_empty_response(ctx);
           return EXIT_SUCCESS;
         }
 
@@ -2053,7 +2044,7 @@ main(int argc, const char *argv[])
           TSNode closest           = {0};
           struct list_TSNode dummy = {0};
           struct list_TSNode *it;
-          __leafs(&ctx, highligted, &dummy);
+          __leafs(ctx, highligted, &dummy);
           it = dummy.next;
           while (it) {
             struct list_TSNode *tmp = it;
@@ -2069,8 +2060,8 @@ main(int argc, const char *argv[])
         if (strcmp(ts_node_type(highligted), "}") == 0) {
           highligted = ts_node_parent(highligted);
         }
-        /* debug_subtypes_rec(&ctx, highligted, 0); */
-        res = sp_print_locals(&ctx, highligted);
+        /* debug_subtypes_rec(ctx, highligted, 0); */
+        res = sp_print_locals(ctx, highligted);
       } else {
         const char *struct_spec  = "struct_specifier";
         const char *typedef_spec = "type_definition";
@@ -2085,23 +2076,23 @@ main(int argc, const char *argv[])
 
             if (strcmp(in_type, "crunch") == 0) {
               TSNode tmp;
-              debug_subtypes_rec(&ctx, found, 0);
+              debug_subtypes_rec(ctx, found, 0);
               tmp = find_direct_chld_by_type(found, "field_declaration_list");
               if (ts_node_is_null(tmp)) {
                 /* forward def:
                      *   struct type;
                      */
-                print_json_empty_response();
+                print_json_empty_response(ctx);
                 res = EXIT_SUCCESS;
               } else {
-                ctx.output_line = sp_find_last_line(found);
-                res             = sp_print_struct(&ctx, found, NULL);
+                ctx->output_line = sp_find_last_line(found);
+                res             = sp_print_struct(ctx, found, NULL);
               }
             }
           } else if (strcmp(ts_node_type(found), typedef_spec) == 0) {
             if (strcmp(in_type, "crunch") == 0) {
               TSNode tmp;
-              debug_subtypes_rec(&ctx, found, 0);
+              debug_subtypes_rec(ctx, found, 0);
 
               tmp = find_rec_chld_by_type(found, "field_declaration_list");
               if (!ts_node_is_null(tmp)) {
@@ -2109,16 +2100,16 @@ main(int argc, const char *argv[])
                 tmp = find_direct_chld_by_type(found, "type_identifier");
                 if (!ts_node_is_null(tmp)) {
                   /* typedef struct ... { ... } t_type_name; */
-                  t_type_name = sp_struct_value(&ctx, tmp);
+                  t_type_name = sp_struct_value(ctx, tmp);
                 }
                 /* fprintf(stderr, "%s:t_type_name[%s]\n", __func__, */
                 /*         t_type_name); */
-                /* debug_subtypes_rec(&ctx, found, 0); */
+                /* debug_subtypes_rec(ctx, found, 0); */
 
                 tmp = find_direct_chld_by_type(found, struct_spec);
                 if (!ts_node_is_null(tmp)) {
-                  ctx.output_line = sp_find_last_line(found);
-                  res             = sp_print_struct(&ctx, tmp, t_type_name);
+                  ctx->output_line = sp_find_last_line(found);
+                  res             = sp_print_struct(ctx, tmp, t_type_name);
                 }
 
                 free(t_type_name);
@@ -2129,28 +2120,28 @@ main(int argc, const char *argv[])
                   tmp = find_direct_chld_by_type(found, "type_identifier");
                   if (!ts_node_is_null(tmp)) {
                     /* typedef enum ... { ... } t_type_name; */
-                    t_type_name = sp_struct_value(&ctx, tmp);
+                    t_type_name = sp_struct_value(ctx, tmp);
                   }
                   tmp = find_direct_chld_by_type(found, enum_spec);
                   if (!ts_node_is_null(tmp)) {
-                    ctx.output_line = sp_find_last_line(found);
-                    res             = sp_print_enum(&ctx, tmp, t_type_name);
+                    ctx->output_line = sp_find_last_line(found);
+                    res             = sp_print_enum(ctx, tmp, t_type_name);
                   }
 
                   free(t_type_name);
                 } else {
-                  ctx.output_line = sp_find_last_line(found);
-                  res             = sp_print_typedef(&ctx, found);
+                  ctx->output_line = sp_find_last_line(found);
+                  res             = sp_print_typedef(ctx, found);
                 }
               }
             }
           } else if (strcmp(ts_node_type(found), class_spec) == 0) {
             if (strcmp(in_type, "crunch") == 0) {
-              ctx.output_line = sp_find_last_line(found);
-              res             = sp_print_class(&ctx, found);
+              ctx->output_line = sp_find_last_line(found);
+              res             = sp_print_class(ctx, found);
             }
           } else if (strcmp(ts_node_type(found), enum_spec) == 0) {
-            /* debug_subtypes_rec(&ctx, found, 0); */
+            /* debug_subtypes_rec(ctx, found, 0); */
             if (strcmp(in_type, "crunch") == 0) {
               TSNode tmp;
               tmp = find_direct_chld_by_type(found, "enumerator_list");
@@ -2158,41 +2149,378 @@ main(int argc, const char *argv[])
                 /* forward def:
                      *   enum type;
                      */
-                print_json_empty_response();
+                print_json_empty_response(ctx);
                 res = EXIT_SUCCESS;
               } else {
-                ctx.output_line = sp_find_last_line(found);
-                res             = sp_print_enum(&ctx, found, NULL);
+                ctx->output_line = sp_find_last_line(found);
+                res             = sp_print_enum(ctx, found, NULL);
               }
             }
           } else if (strcmp(ts_node_type(found), fun_def) == 0) {
             if (strcmp(in_type, "crunch") == 0) {
               /* printf("%s\n", ts_node_string(found)); */
-              ctx.output_line = sp_find_open_bracket(found);
-              res             = sp_print_function_args(&ctx, found);
+              ctx->output_line = sp_find_open_bracket(found);
+              res             = sp_print_function_args(ctx, found);
             } else if (strcmp(in_type, "branches") == 0) {
-              res = sp_print_branches(&ctx, found);
+              res = sp_print_branches(ctx, found);
             }
           }
         } else {
-          fprintf(stderr, "not inside a scope\n");
+          sp_ts_debug(ctx, "not inside a scope\n");
         }
       }
     } else {
-      fprintf(stderr, "out of range %u,%u\n", pos.row, pos.column);
+      sp_ts_debug(ctx, "out of range %u,%u\n", pos.row, pos.column);
     }
   } else {
-    fprintf(stderr, "Tree is empty \n");
+    sp_ts_debug(ctx, "Tree is empty \n");
   }
-  ts_tree_delete(ctx.tree);
 
-Lerr:
-  ts_parser_delete(parser);
-  /* munmap(file, flength); */
+  return res;
+}
+
+/* ======================================== */
+static char *
+sp_extract_function_name(struct sp_ts_Context *ctx, TSNode fun)
+{
+  const char *field = "declarator";
+  uint32_t l_field  = (uint32_t)strlen(field);
+  TSNode it         = ts_node_child_by_field_name(fun, field, l_field);
+
+  /* int *(*fun(int))[]: unwrap pointer/parenthesized declarators */
+  while (!ts_node_is_null(it)) {
+    if (strcmp(ts_node_type(it), "function_declarator") == 0) {
+      TSNode id = ts_node_child_by_field_name(it, field, l_field);
+      return ts_node_is_null(id) ? NULL : sp_struct_value(ctx, id);
+    }
+    it = ts_node_child_by_field_name(it, field, l_field);
+  } //while
+
+  return NULL;
+}
+
+static char *
+sp_extract_type_name(struct sp_ts_Context *ctx, TSNode subject)
+{
+  TSNode tmp = find_direct_chld_by_type(subject, "type_identifier");
+  if (ts_node_is_null(tmp)) {
+    /* typedef struct { ... } type_t; */
+    TSNode parent = ts_node_parent(subject);
+    if (!ts_node_is_null(parent) &&
+        strcmp(ts_node_type(parent), "type_definition") == 0) {
+      tmp = find_direct_chld_by_type(parent, "type_identifier");
+    }
+  }
+
+  return ts_node_is_null(tmp) ? NULL : sp_struct_value(ctx, tmp);
+}
+
+static int
+sp_extract_args(struct sp_ts_Context *ctx,
+                TSNode subject,
+                const char *id_type,
+                struct sp_ts_entry *entry,
+                sp_ts_entry_cb cb,
+                void *closure)
+{
+  int res = 0;
+  struct arg_list *args;
+  struct arg_list *it;
+
+  if (!(args = __field_name(ctx, subject, id_type))) {
+    return 0;
+  }
+
+  entry->line = ts_node_start_point(subject).row;
+  for (it = args; it && res == 0; it = it->next) {
+    __field_type(ctx, subject, it, "");
+    if (!it->dead && it->variable) {
+      entry->name             = it->variable;
+      entry->type             = it->type;
+      entry->pointer          = it->pointer;
+      entry->array_length     = it->is_array ? it->variable_array_length : NULL;
+      entry->function_pointer = it->function_pointer;
+      res                     = cb(closure, entry);
+    }
+  } //for
+  arg_list_free(args);
+
+  return res;
+}
+
+static int
+sp_extract_fields(struct sp_ts_Context *ctx,
+                  TSNode subject,
+                  sp_ts_entry_cb cb,
+                  void *closure)
+{
+  int res                  = 0;
+  struct sp_ts_entry entry = {.kind = SP_TS_FIELD};
+  char *scope              = NULL;
+  TSNode list;
+  uint32_t i;
+
+  list = find_direct_chld_by_type(subject, "field_declaration_list");
+  if (ts_node_is_null(list)) {
+    /* a reference: struct type *var; */
+    return 0;
+  }
+
+  entry.scope = scope = sp_extract_type_name(ctx, subject);
+  for (i = 0; i < ts_node_child_count(list) && res == 0; ++i) {
+    TSNode field = ts_node_child(list, i);
+    if (strcmp(ts_node_type(field), "field_declaration") == 0) {
+      res = sp_extract_args(ctx, field, "field_identifier", &entry, cb,
+                            closure);
+    }
+  } //for
+  free(scope);
 
   return res;
 }
 
+static int
+sp_extract_enums(struct sp_ts_Context *ctx,
+                 TSNode subject,
+                 sp_ts_entry_cb cb,
+                 void *closure)
+{
+  int res                  = 0;
+  struct sp_ts_entry entry = {.kind = SP_TS_ENUM};
+  char *scope              = NULL;
+  TSNode list;
+  uint32_t i;
+
+  list = find_direct_chld_by_type(subject, "enumerator_list");
+  if (ts_node_is_null(list)) {
+    return 0;
+  }
+
+  entry.scope = scope = sp_extract_type_name(ctx, subject);
+  for (i = 0; i < ts_node_child_count(list) && res == 0; ++i) {
+    TSNode enumerator = ts_node_child(list, i);
+    if (strcmp(ts_node_type(enumerator), "enumerator") == 0 &&
+        ts_node_child_count(enumerator) > 0) {
+      char *name = sp_struct_value(ctx, ts_node_child(enumerator, 0));
+      if (name) {
+        entry.name = name;
+        entry.line = ts_node_start_point(enumerator).row;
+        res        = cb(closure, &entry);
+      }
+      free(name);
+    }
+  } //for
+  free(scope);
+
+  return res;
+}
+
+static bool
+sp_extract_is_record(const char *type)
+{
+  return strcmp(type, "struct_specifier") == 0 ||
+         strcmp(type, "union_specifier") == 0 ||
+         strcmp(type, "class_specifier") == 0 ||
+         strcmp(type, "enum_specifier") == 0;
+}
+
+/* typedef $type $name, *$name...; function pointer and array typedefs are
+ * not reported */
+static int
+sp_extract_typedef(struct sp_ts_Context *ctx,
+                   TSNode subject,
+                   sp_ts_entry_cb cb,
+                   void *closure)
+{
+  int res                  = 0;
+  struct sp_ts_entry entry = {.kind = SP_TS_TYPEDEF};
+  char *type_name          = NULL;
+  TSNode type;
+  uint32_t i;
+
+  type = ts_node_child_by_field_name(subject, "type", 4);
+  if (ts_node_is_null(type)) {
+    return 0;
+  }
+  if (sp_extract_is_record(ts_node_type(type))) {
+    TSNode name = ts_node_child_by_field_name(type, "name", 4);
+    if (!ts_node_is_null(name)) {
+      type_name = sp_struct_value(ctx, name);
+    }
+  } else if ((type_name = sp_struct_value(ctx, type))) {
+    /* unsigned   long: as __field_type() spells it */
+    char *it;
+    char *out = type_name;
+    for (it = type_name; *it; ++it) {
+      if (!isspace((unsigned char)*it)) {
+        *out++ = *it;
+      } else if (out != type_name && out[-1] != ' ') {
+        *out++ = ' ';
+      }
+    } //for
+    *out = '\0';
+  }
+
+  entry.type = type_name;
+  entry.line = ts_node_start_point(subject).row;
+  for (i = 0; i < ts_node_child_count(subject) && res == 0; ++i) {
+    TSNode it = ts_node_child(subject, i);
+
+    if (ts_node_eq(it, type)) {
+      continue;
+    }
+    entry.pointer = 0;
+    while (strcmp(ts_node_type(it), "pointer_declarator") == 0) {
+      ++entry.pointer;
+      it = ts_node_child_by_field_name(it, "declarator", 10);
+      if (ts_node_is_null(it)) {
+        break;
+      }
+    } //while
+    if (!ts_node_is_null(it) &&
+        strcmp(ts_node_type(it), "type_identifier") == 0) {
+      char *name = sp_struct_value(ctx, it);
+      if (name) {
+        entry.name = name;
+        res        = cb(closure, &entry);
+      }
+      free(name);
+    }
+  } //for
+  free(type_name);
+
+  return res;
+}
+
+int
+sp_ts_extract(struct sp_ts_Context *ctx, sp_ts_entry_cb cb, void *closure)
+{
+  int res         = 0;
+  uint32_t depth  = 0;
+  uint32_t fdepth = 0;
+  char *fun       = NULL;
+  bool in_fun     = false;
+  TSTreeCursor cursor;
+  TSNode root;
+
+  root = ts_tree_root_node(ctx->tree);
+  if (ts_node_is_null(root)) {
+    return -1;
+  }
+
+  /* iterative walk, the tree can be deeper than we want to recurse */
+  cursor = ts_tree_cursor_new(root);
+  while (res == 0) {
+    TSNode node      = ts_tree_cursor_current_node(&cursor);
+    const char *type = ts_node_type(node);
+
+    if (strcmp(type, "function_definition") == 0) {
+      if (!in_fun) {
+        in_fun = true;
+        fdepth = depth;
+        fun    = sp_extract_function_name(ctx, node);
+      }
+    } else if (strcmp(type, "struct_specifier") == 0 ||
+               strcmp(type, "union_specifier") == 0 ||
+               strcmp(type, "class_specifier") == 0) {
+      res = sp_extract_fields(ctx, node, cb, closure);
+    } else if (strcmp(type, "enum_specifier") == 0) {
+      res = sp_extract_enums(ctx, node, cb, closure);
+    } else if (strcmp(type, "type_definition") == 0) {
+      res = sp_extract_typedef(ctx, node, cb, closure);
+    } else if (strcmp(type, "declaration") == 0) {
+      struct sp_ts_entry entry = {0};
+      entry.kind               = in_fun ? SP_TS_LOCAL : SP_TS_GLOBAL;
+      entry.scope              = in_fun ? fun : NULL;
+      res = sp_extract_args(ctx, node, "identifier", &entry, cb, closure);
+    }
+
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      ++depth;
+      continue;
+    }
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if (!ts_tree_cursor_goto_parent(&cursor)) {
+        goto Lout;
+      }
+      --depth;
+      if (in_fun && depth == fdepth) {
+        /* back at the function_definition, leaving it */
+        in_fun = false;
+        free(fun);
+        fun = NULL;
+      }
+    } //while
+  } //while
+
+Lout:
+  ts_tree_cursor_delete(&cursor);
+  free(fun);
+  return res;
+}
+
+/* #include can only appear at file scope or inside preprocessor blocks */
+static bool
+sp_includes_may_contain(const char *type)
+{
+  return strcmp(type, "translation_unit") == 0 ||
+         strncmp(type, "preproc_", 8) == 0 ||
+         strcmp(type, "linkage_specification") == 0 ||
+         strcmp(type, "declaration_list") == 0;
+}
+
+int
+sp_ts_includes(struct sp_ts_Context *ctx, sp_ts_include_cb cb, void *closure)
+{
+  int res = 0;
+  TSTreeCursor cursor;
+  TSNode root;
+
+  root = ts_tree_root_node(ctx->tree);
+  if (ts_node_is_null(root)) {
+    return -1;
+  }
+
+  cursor = ts_tree_cursor_new(root);
+  while (res == 0) {
+    TSNode node      = ts_tree_cursor_current_node(&cursor);
+    const char *type = ts_node_type(node);
+
+    if (strcmp(type, "preproc_include") == 0) {
+      TSNode path = ts_node_child_by_field_name(node, "path", 4);
+      uint32_t start;
+      uint32_t end;
+
+      if (!ts_node_is_null(path)) {
+        start = ts_node_start_byte(path);
+        end   = ts_node_end_byte(path);
+        /* without the "" or <> */
+        if (end - start >= 2 && end <= ctx->file.length) {
+          char *str = strndup(ctx->file.content + start + 1, end - start - 2);
+          if (str) {
+            res = cb(closure, str,
+                     strcmp(ts_node_type(path), "system_lib_string") == 0);
+            free(str);
+          }
+        }
+      }
+    } else if (sp_includes_may_contain(type) &&
+               ts_tree_cursor_goto_first_child(&cursor)) {
+      continue;
+    }
+
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if (!ts_tree_cursor_goto_parent(&cursor)) {
+        goto Lout;
+      }
+    } //while
+  } //while
+
+Lout:
+  ts_tree_cursor_delete(&cursor);
+  return res;
+}
+
 //TODO when we make assumption example (unsigned char*xxx, size_t l_xxx) make a comment in the debug function
 // example: NOTE: assumes xxx and l_xxx is related
 
@@ -2204,6 +2532,3 @@ Lerr:
 //   struct dummy_list *rec;
 // };
 // TODO what to do with c++ template arguments: vector<int>, map<int,int>
-
-// Example:
-// ./sp_struct_to_string crunch ./test7.c 2 0
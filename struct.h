@@ -0,0 +1,93 @@
+#ifndef SP_TS_STRUCT_H
+#define SP_TS_STRUCT_H
+
+#include <stdio.h>
+
+#include <jansson.h>
+
+#include "shared.h"
+
+/* ======================================== */
+extern const TSLanguage *
+tree_sitter_c(void);
+
+extern const TSLanguage *
+tree_sitter_cpp(void);
+
+/* ======================================== */
+bool
+is_c_file(const char *file);
+
+bool
+is_cpp_file(const char *file);
+
+enum sp_ts_SourceDomain
+get_domain(const char *file);
+
+const TSLanguage *
+sp_ts_file_language(const char *file);
+
+/* ======================================== */
+/* $in_type: crunch|locals|branches, $ctx->tree must be parsed from
+ * $ctx->file. The result is collected in $ctx->inserts at lines of
+ * $ctx->file, sp_ts_inserts_finish() makes it a response. */
+int
+sp_ts_request(struct sp_ts_Context *ctx, const char *in_type, TSPoint pos);
+
+/* $kind: 0 s-expression, 1 indented node types */
+int
+sp_ts_print(struct sp_ts_Context *ctx, int kind);
+
+/* ======================================== */
+enum sp_ts_entry_kind {
+  SP_TS_FIELD = 0,
+  SP_TS_ENUM,
+  SP_TS_LOCAL,
+  SP_TS_GLOBAL,
+  /* $name the typedef, $type what it names */
+  SP_TS_TYPEDEF,
+};
+
+struct sp_ts_entry {
+  enum sp_ts_entry_kind kind;
+  /* struct/union/class/enum or function name, NULL if anonymous or global */
+  const char *scope;
+  const char *name;
+  /* NULL for enumerators and typedefs of an anonymous struct/union/enum, a
+   * named one without its keyword */
+  const char *type;
+  uint32_t pointer;
+  /* $name[$array_length], NULL when not an array */
+  const char *array_length;
+  /* $type is what the function pointer $name returns */
+  bool function_pointer;
+  /* 0-based */
+  uint32_t line;
+};
+
+/* the strings in $entry are only valid for the duration of the call */
+typedef int (*sp_ts_entry_cb)(void *closure, const struct sp_ts_entry *entry);
+
+/* Report every field, enumerator, function local, global declaration and
+ * typedef in $ctx->tree. The walk stops at the first non 0 return of $cb, which is
+ * returned. */
+int
+sp_ts_extract(struct sp_ts_Context *ctx, sp_ts_entry_cb cb, void *closure);
+
+/* $path is the text between the quotes or angle brackets, only valid for the
+ * duration of the call. $system for <path>. */
+typedef int (*sp_ts_include_cb)(void *closure, const char *path, bool system);
+
+/* Report every #include of $ctx->tree, also those under a conditional. Stops
+ * at the first non 0 return of $cb, which is returned. */
+int
+sp_ts_includes(struct sp_ts_Context *ctx, sp_ts_include_cb cb, void *closure);
+
+/* ======================================== */
+json_t *
+sp_ts_inserts_to_json(const struct sp_ts_inserts *);
+
+void
+sp_ts_print_json_response(FILE *out, const struct sp_ts_inserts *);
+
+#endif
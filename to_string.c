@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "sp_str.h"
+#include "struct.h"
 
 static void
 __format_numeric(struct arg_list *result,
@@ -17,7 +18,8 @@ __format_numeric(struct arg_list *result,
     sp_str buf_tmp;
 
     sprintf(buffer, "%s%s", format, "%s");
-    result->format = strdup(buffer);
+    free(result->format_alloc);
+    result->format = result->format_alloc = strdup(buffer);
 
     sp_str_init(&buf_tmp, 0);
     sp_str_appends(&buf_tmp, pprefix, result->variable, " ? *", pprefix,
@@ -28,7 +30,8 @@ __format_numeric(struct arg_list *result,
     result->complex_printf = true;
     sp_str_free(&buf_tmp);
   } else {
-    result->format = strdup(format);
+    free(result->format_alloc);
+    result->format = result->format_alloc = strdup(format);
   }
 }
 
@@ -2594,12 +2597,128 @@ __format_cutil(struct sp_ts_Context *ctx,
   return true;
 }
 
+/* typedef chains longer than this are taken to be a cycle */
+#define SP_TS_TYPEDEF_DEPTH 8
+/* struct members of other files are printed this many levels down */
+#define SP_TS_FIELD_DEPTH 4
+
+/* struct $type.name $field_identifier;, printed member by member like an
+ * inline struct is: $result is replaced by the $result.member list */
+static bool
+__format_fields(struct sp_ts_Context *ctx,
+                struct arg_list *result,
+                const char *pprefix,
+                const struct sp_ts_type *type)
+{
+  struct arg_list field_dummy = {0};
+  struct arg_list *field_it   = &field_dummy;
+  size_t i;
+
+  if (result->nested >= SP_TS_FIELD_DEPTH) {
+    return false;
+  }
+  for (i = 0; i < type->n_fields; ++i) {
+    const struct sp_ts_type_field *field = &type->fields[i];
+    struct arg_list *arg;
+
+    if (!(arg = calloc(1, sizeof(*arg)))) {
+      goto Lerr;
+    }
+    field_it = field_it->next = arg;
+    if (!(arg->variable = strdup(field->name)) ||
+        (field->type && !(arg->type = strdup(field->type)))) {
+      goto Lerr;
+    }
+    if (field->array_length) {
+      if (!(arg->variable_array_length = strdup(field->array_length))) {
+        goto Lerr;
+      }
+      arg->is_array = true;
+    }
+    arg->pointer          = field->pointer;
+    arg->function_pointer = field->function_pointer;
+    arg->nested           = result->nested + 1;
+  } //for
+
+  result->rec = field_dummy.next;
+  __format(ctx, result, pprefix);
+  return true;
+
+Lerr:
+  arg_list_free(field_dummy.next);
+  return false;
+}
+
+/* A type declared in another file, through $ctx->type_cb */
+static bool
+__format_resolved(struct sp_ts_Context *ctx,
+                  struct arg_list *result,
+                  const char *pprefix)
+{
+  struct sp_ts_type type = {0};
+
+  if (!ctx->type_cb || ctx->type_depth >= SP_TS_TYPEDEF_DEPTH ||
+      !ctx->type_cb(ctx->type_closure, result->type, &type)) {
+    return false;
+  }
+
+  /* before the typedef, typedef struct $name {...} $name;. Not in C++, the
+   * members of a class need not be public */
+  if (type.n_fields > 0 && !result->pointer && !result->is_array &&
+      !result->macro_type && ctx->tree &&
+      ts_tree_language(ctx->tree) != tree_sitter_cpp()) {
+    return __format_fields(ctx, result, pprefix, &type);
+  }
+
+  if (type.type && strcmp(type.type, result->type) != 0) {
+    /* typedef $type.type $result->type;, formatted as $type.type */
+    char *macro_type = result->macro_type;
+    char *tmp;
+
+    if (!(tmp = strdup(type.type))) {
+      return false;
+    }
+    free(result->type);
+    result->type = tmp;
+
+    result->pointer += type.pointer;
+    /* already accounted for */
+    result->macro_type = NULL;
+
+    ++ctx->type_depth;
+    __format(ctx, result, pprefix);
+    --ctx->type_depth;
+    result->macro_type = macro_type;
+    return true;
+  }
+
+  if (type.enumerators && type.enumerators[0] && !result->pointer) {
+    const char *const *it;
+    sp_str buf_tmp;
+    sp_str_init(&buf_tmp, 0);
+
+    /* enum type $field_identifier; */
+    for (it = type.enumerators; *it; ++it) {
+      sp_str_appends(&buf_tmp, pprefix, result->variable, " == ", *it, " ? \"",
+                     *it, "\" : ", NULL);
+    } //for
+    sp_str_append(&buf_tmp, "\"__UNDEF\"");
+    result->format = "%s";
+    free(result->complex_raw);
+    result->complex_raw    = strdup(sp_str_c_str(&buf_tmp));
+    result->complex_printf = true;
+    sp_str_free(&buf_tmp);
+    return true;
+  }
+
+  return false;
+}
+
 void
 __format(struct sp_ts_Context *ctx,
          struct arg_list *result,
          const char *pprefix)
 {
-  (void)ctx;
   /* https://developer.gnome.org/glib/stable/glib-Basic-Types.html */
   /* https://en.cppreference.com/w/cpp/types/integer */
   //TODO strdup
@@ -2615,7 +2734,7 @@ __format(struct sp_ts_Context *ctx,
         sp_str buf_tmp;
         sp_str_init(&buf_tmp, 0);
 
-        fprintf(stderr, "__%s:%s\n", it->variable, it->type);
+        sp_ts_debug(ctx, "__%s:%s\n", it->variable, it->type);
         sp_str_appends(&buf_tmp, result->variable, ".", it->variable, NULL);
 
         free(it->variable);
@@ -2749,7 +2868,41 @@ __format(struct sp_ts_Context *ctx,
         /* TODO if pointer hex? */
         result->format = "%p";
       } else if (result->is_array) {
-        /* TODO if pointer hex? */
+        sp_str buf_tmp;
+
+        sp_str_init(&buf_tmp, 0);
+        /* uint8_t $field_identifier[$array_len] */
+        if (ctx->domain == LINUX_KERNEL_DOMAIN) {
+          const char *length = result->variable_array_length;
+          char *end;
+          unsigned long n = strtoul(length, &end, 0);
+
+          /* no sp_hexdump() in the kernel, printk() has its own which prints
+           * at most 64 bytes: longer arrays are cut there and end in "..." */
+          if (end != length && *end == '\0' && n <= 64) {
+            result->format = "%*phN";
+            sp_str_appends(&buf_tmp, "(int)(", length, "), ", pprefix,
+                           result->variable, NULL);
+          } else if (end != length && *end == '\0') {
+            result->format = "%*phN...";
+            sp_str_appends(&buf_tmp, "64, ", pprefix, result->variable, NULL);
+          } else {
+            result->format = "%*phN%s";
+            sp_str_appends(&buf_tmp, "min_t(int, ", length, ", 64), ", pprefix,
+                           result->variable, ", (", length,
+                           ") > 64 ? \"...\" : \"\"", NULL);
+          }
+        } else {
+          result->format  = "%s";
+          result->hexdump = true;
+          sp_str_appends(&buf_tmp, "sp_hexdump(", pprefix, result->variable,
+                         ", ", result->variable_array_length, ")", NULL);
+        }
+        free(result->complex_raw);
+        result->complex_raw    = strdup(sp_str_c_str(&buf_tmp));
+        result->complex_printf = true;
+
+        sp_str_free(&buf_tmp);
       } else {
         result->format = "%d";
       }
@@ -2862,6 +3015,7 @@ __format(struct sp_ts_Context *ctx,
     } else if (__format_libcpp(ctx, result, pprefix)) {
     } else if (__format_cutil(ctx, result, pprefix)) {
     } else if (__format_jansson(ctx, result, pprefix)) {
+    } else if (__format_resolved(ctx, result, pprefix)) {
     } else {
       if (strchr(result->type, ' ') == NULL) {
         const char *prefix = "&";
@@ -0,0 +1,609 @@
+#define _GNU_SOURCE
+#include "types.h"
+
+#include <sys/stat.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* the include graph of a file is cut off here, an interactive request must
+ * not end up parsing a whole project */
+#define SP_TS_TYPES_MAX_HEADERS 512
+
+struct sp_ts_types_name {
+  char *name;
+  bool found;
+  /* see struct sp_ts_type */
+  char *type;
+  uint32_t pointer;
+  char **enumerators;
+  size_t n_enumerators;
+  struct sp_ts_type_field *fields;
+  size_t n_fields;
+};
+
+/* A header as it was when walked, a change of it invalidates the file */
+struct sp_ts_types_stamp {
+  bool exists;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  off_t size;
+};
+
+struct sp_ts_types_file {
+  char *path;
+  /* $path first, then its headers in the order they are reached, all
+   * sp_ts_path_canonical() */
+  char **headers;
+  struct sp_ts_types_stamp *stamps;
+  size_t n_headers;
+  /* struct sp_ts_types_name sorted by name, hits and misses */
+  struct sp_util_sorted_set names;
+
+  /* held by requests */
+  size_t refs;
+  /* in $files, an unlinked file is freed when no longer held */
+  bool linked;
+};
+
+struct sp_ts_types_walk {
+  struct sp_ts_types *self;
+  struct sp_ts_types_file *file;
+  const struct sp_ts_compdb_unit *unit;
+  const char *includer;
+  /* char * of $file->headers, sorted */
+  struct sp_util_sorted_set seen;
+};
+
+static int
+sp_ts_types_file_cmp(const void *f, const void *s)
+{
+  const struct sp_ts_types_file *first  = *(const void *const *)f;
+  const struct sp_ts_types_file *second = *(const void *const *)s;
+  return strcmp(first->path, second->path);
+}
+
+static int
+sp_ts_types_name_cmp(const void *f, const void *s)
+{
+  const struct sp_ts_types_name *first  = f;
+  const struct sp_ts_types_name *second = s;
+  return strcmp(first->name, second->name);
+}
+
+static int
+sp_ts_types_path_cmp(const void *f, const void *s)
+{
+  return strcmp(*(const char *const *)f, *(const char *const *)s);
+}
+
+/* the strings of $field are ours */
+static void
+sp_ts_types_field_free(struct sp_ts_type_field *field)
+{
+  free((char *)(uintptr_t)field->name);
+  free((char *)(uintptr_t)field->type);
+  free((char *)(uintptr_t)field->array_length);
+}
+
+static void
+sp_ts_types_name_free(struct sp_ts_types_name *name)
+{
+  size_t i;
+
+  for (i = 0; i < name->n_enumerators; ++i) {
+    free(name->enumerators[i]);
+  }
+  free(name->enumerators);
+  for (i = 0; i < name->n_fields; ++i) {
+    sp_ts_types_field_free(&name->fields[i]);
+  }
+  free(name->fields);
+  free(name->type);
+  free(name->name);
+}
+
+static void
+sp_ts_types_file_free(struct sp_ts_types_file *file)
+{
+  size_t i;
+
+  for (i = 0; i < file->names.length; ++i) {
+    sp_ts_types_name_free(sp_util_sorted_set_at(&file->names, i));
+  }
+  sp_util_sorted_set_free(&file->names);
+  for (i = 0; i < file->n_headers; ++i) {
+    free(file->headers[i]);
+  }
+  free(file->headers);
+  free(file->stamps);
+  free(file->path);
+  free(file);
+}
+
+/* sp_ts_cache_get() of a header that is then watched for changes */
+static struct sp_ts_cache_entry *
+sp_ts_types_get(struct sp_ts_types *self,
+                const char *path,
+                const struct sp_ts_limits *limits,
+                enum sp_ts_parse_res *parse,
+                TSTree **tree)
+{
+  struct sp_ts_cache_entry *result;
+
+  result = sp_ts_cache_get(self->cache, path, limits, parse, tree);
+  if (result && self->watch) {
+    self->watch(self->watch_closure, result->path);
+  }
+  return result;
+}
+
+static void
+sp_ts_types_stamp(struct sp_ts_types_stamp *stamp, const struct stat *st)
+{
+  stamp->exists = true;
+  stamp->dev    = st->st_dev;
+  stamp->ino    = st->st_ino;
+  stamp->mtime  = st->st_mtim;
+  stamp->size   = st->st_size;
+}
+
+/* Whether the headers of $file are still what was walked, a header that was
+ * missing then must be missing still. Checked without the cache, which may
+ * have evicted them. */
+static bool
+sp_ts_types_is_valid(const struct sp_ts_types_file *file)
+{
+  size_t i;
+
+  for (i = 0; i < file->n_headers; ++i) {
+    const struct sp_ts_types_stamp *it = &file->stamps[i];
+    struct stat st;
+
+    if (stat(file->headers[i], &st) != 0) {
+      if (it->exists) {
+        return false;
+      }
+    } else if (!it->exists || it->dev != st.st_dev || it->ino != st.st_ino ||
+               it->size != st.st_size ||
+               it->mtime.tv_sec != st.st_mtim.tv_sec ||
+               it->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+      return false;
+    }
+  } //for
+
+  return true;
+}
+
+/* Release a hold of $file, unlinked files are freed with the last */
+static void
+sp_ts_types_put(struct sp_ts_types *self, struct sp_ts_types_file *file)
+{
+  bool unused;
+
+  pthread_mutex_lock(&self->lock);
+  unused = --file->refs == 0 && !file->linked;
+  pthread_mutex_unlock(&self->lock);
+
+  if (unused) {
+    sp_ts_types_file_free(file);
+  }
+}
+
+/* sp_ts_include_cb */
+static int
+sp_ts_types_include(void *closure, const char *path, bool system)
+{
+  struct sp_ts_types_walk *walk = closure;
+  struct sp_ts_types_file *file = walk->file;
+  struct sp_ts_types_stamp *stamps;
+  char **tmp;
+  char *resolved;
+  char *header;
+
+  if (file->n_headers >= SP_TS_TYPES_MAX_HEADERS) {
+    return 0;
+  }
+  if (!(resolved = sp_ts_compdb_resolve(walk->self->compdb, walk->unit,
+                                        walk->includer, path, system))) {
+    return 0;
+  }
+  /* the spelling of the cache and the watcher */
+  header = sp_ts_path_canonical(resolved);
+  free(resolved);
+  if (!header) {
+    return -1;
+  }
+  if (sp_util_sorted_set_find(&walk->seen, &header)) {
+    free(header);
+    return 0;
+  }
+
+  if (!(tmp = realloc(file->headers,
+                      (file->n_headers + 1) * sizeof(*file->headers)))) {
+    free(header);
+    return -1;
+  }
+  file->headers = tmp;
+  if (!(stamps = realloc(file->stamps,
+                         (file->n_headers + 1) * sizeof(*file->stamps)))) {
+    free(header);
+    return -1;
+  }
+  file->stamps = stamps;
+  if (!sp_util_sorted_set_insert(&walk->seen, &header)) {
+    free(header);
+    return -1;
+  }
+  file->headers[file->n_headers++] = header;
+
+  return 0;
+}
+
+/* Collect the headers $file sees breadth first. False when a parse did not
+ * complete (timeout, cancelled) and some may be missing. */
+static bool
+sp_ts_types_walk(struct sp_ts_types *self,
+                 struct sp_ts_types_file *file,
+                 const struct sp_ts_limits *limits)
+{
+  struct sp_ts_types_walk walk = {0};
+  bool complete                = true;
+  size_t i;
+
+  walk.self = self;
+  walk.file = file;
+  walk.unit = sp_ts_compdb_unit(self->compdb, file->path);
+  sp_util_sorted_set_init(&walk.seen, sizeof(char *), sp_ts_types_path_cmp);
+  if (!(file->headers = calloc(1, sizeof(*file->headers))) ||
+      !(file->stamps = calloc(1, sizeof(*file->stamps))) ||
+      !(file->headers[0] = strdup(file->path))) {
+    complete = false;
+    goto Lout;
+  }
+  file->n_headers = 1;
+  sp_util_sorted_set_insert(&walk.seen, &file->headers[0]);
+
+  /* $file->headers grows while it is walked */
+  for (i = 0; i < file->n_headers; ++i) {
+    enum sp_ts_parse_res parse = SP_TS_PARSED;
+    struct sp_ts_Context ctx   = {0};
+    struct sp_ts_cache_entry *entry;
+    struct stat st;
+
+    memset(&file->stamps[i], 0, sizeof(file->stamps[i]));
+    entry = sp_ts_types_get(self, file->headers[i], limits, &parse,
+                            &ctx.tree);
+    if (!entry) {
+      if (parse == SP_TS_PARSE_TIMEOUT || parse == SP_TS_PARSE_CANCELLED) {
+        complete = false;
+      }
+      /* unreadable, changes of it still count */
+      if (stat(file->headers[i], &st) == 0) {
+        sp_ts_types_stamp(&file->stamps[i], &st);
+      }
+      continue;
+    }
+    /* what was parsed, not what is there by now */
+    file->stamps[i].exists = true;
+    file->stamps[i].dev    = entry->dev;
+    file->stamps[i].ino    = entry->ino;
+    file->stamps[i].mtime  = entry->mtime;
+    file->stamps[i].size   = entry->size;
+    ctx.file               = entry->file;
+    walk.includer = file->headers[i];
+    sp_ts_includes(&ctx, sp_ts_types_include, &walk);
+    ts_tree_delete(ctx.tree);
+    sp_ts_cache_release(self->cache, entry);
+  } //for
+
+Lout:
+  sp_util_sorted_set_free(&walk.seen);
+  return complete;
+}
+
+/* The held memo of $request->path, walked on first use and again once one of
+ * its headers changed. One that could not be walked completely is used by
+ * this request only. */
+static struct sp_ts_types_file *
+sp_ts_types_file(struct sp_ts_types_request *request)
+{
+  struct sp_ts_types *self       = request->types;
+  struct sp_ts_types_file needle = {0};
+  struct sp_ts_types_file *result = NULL;
+  struct sp_ts_types_file *p      = &needle;
+  struct sp_ts_types_file **it;
+  bool complete;
+
+  if (!(needle.path = sp_ts_path_canonical(request->path))) {
+    return NULL;
+  }
+  pthread_mutex_lock(&self->lock);
+  if ((it = sp_util_sorted_set_find(&self->files, &p))) {
+    result = *it;
+    ++result->refs;
+  }
+  pthread_mutex_unlock(&self->lock);
+  /* also without inotify, or for a header it missed */
+  if (result && !sp_ts_types_is_valid(result)) {
+    pthread_mutex_lock(&self->lock);
+    if (result->linked) {
+      sp_util_sorted_set_remove(&self->files, &result);
+      result->linked = false;
+    }
+    pthread_mutex_unlock(&self->lock);
+    sp_ts_types_put(self, result);
+    result = NULL;
+  }
+  if (result) {
+    free(needle.path);
+    return result;
+  }
+
+  /* outside of the lock, a concurrent walk of the same file is dropped */
+  if (!(result = calloc(1, sizeof(*result)))) {
+    free(needle.path);
+    return NULL;
+  }
+  result->path = needle.path;
+  result->refs = 1;
+  sp_util_sorted_set_init(&result->names, sizeof(struct sp_ts_types_name),
+                          sp_ts_types_name_cmp);
+  complete = sp_ts_types_walk(self, result, request->limits);
+
+  pthread_mutex_lock(&self->lock);
+  if ((it = sp_util_sorted_set_find(&self->files, &result))) {
+    p = *it;
+    ++p->refs;
+    pthread_mutex_unlock(&self->lock);
+    sp_ts_types_file_free(result);
+    return p;
+  }
+  if (complete && sp_util_sorted_set_insert(&self->files, &result)) {
+    result->linked = true;
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  return result;
+}
+
+static int
+sp_ts_types_enumerator(struct sp_ts_types_name *name, const char *enumerator)
+{
+  char **tmp;
+
+  /* kept NULL terminated */
+  if (!(tmp = realloc(name->enumerators,
+                      (name->n_enumerators + 2) * sizeof(*tmp)))) {
+    return -1;
+  }
+  name->enumerators = tmp;
+  if (!(tmp[name->n_enumerators] = strdup(enumerator))) {
+    return -1;
+  }
+  tmp[++name->n_enumerators] = NULL;
+
+  return 0;
+}
+
+static int
+sp_ts_types_field(struct sp_ts_types_name *name, const struct sp_ts_decl *decl)
+{
+  struct sp_ts_type_field *tmp;
+  struct sp_ts_type_field *it;
+
+  if (!(tmp = realloc(name->fields, (name->n_fields + 1) * sizeof(*tmp)))) {
+    return -1;
+  }
+  name->fields = tmp;
+  it           = &tmp[name->n_fields];
+  memset(it, 0, sizeof(*it));
+  if (!(it->name = strdup(decl->name)) ||
+      (decl->type && !(it->type = strdup(decl->type))) ||
+      (decl->array_length &&
+       !(it->array_length = strdup(decl->array_length)))) {
+    sp_ts_types_field_free(it);
+    return -1;
+  }
+  it->pointer          = decl->pointer;
+  it->function_pointer = decl->function_pointer;
+  ++name->n_fields;
+
+  return 0;
+}
+
+/* $result->name in the headers of $file, the first declaring it wins. False
+ * when a parse did not complete. */
+static bool
+sp_ts_types_search(struct sp_ts_types *self,
+                   struct sp_ts_types_file *file,
+                   const struct sp_ts_limits *limits,
+                   struct sp_ts_types_name *result)
+{
+  bool complete = true;
+  size_t h;
+
+  for (h = 0; h < file->n_headers && !result->found; ++h) {
+    enum sp_ts_parse_res parse = SP_TS_PARSED;
+    const struct sp_ts_decls *decls;
+    struct sp_ts_cache_entry *entry;
+    TSTree *tree;
+    size_t i;
+
+    entry = sp_ts_types_get(self, file->headers[h], limits, &parse, &tree);
+    if (!entry) {
+      if (parse == SP_TS_PARSE_TIMEOUT || parse == SP_TS_PARSE_CANCELLED) {
+        complete = false;
+      }
+      continue;
+    }
+
+    if ((decls = sp_ts_cache_decls(self->cache, entry, tree))) {
+      for (i = 0; i < decls->length; ++i) {
+        const struct sp_ts_decl *it = &decls->arr[i];
+
+        if (it->kind == SP_TS_TYPEDEF && !result->found && it->name &&
+            strcmp(it->name, result->name) == 0) {
+          /* typedef struct { ... } $name; has no $type */
+          result->found   = true;
+          result->type    = it->type ? strdup(it->type) : NULL;
+          result->pointer = it->pointer;
+        } else if (it->kind == SP_TS_ENUM && it->scope &&
+                   strcmp(it->scope, result->name) == 0) {
+          result->found = true;
+          sp_ts_types_enumerator(result, it->name);
+        } else if (it->kind == SP_TS_FIELD && it->scope && it->name &&
+                   strcmp(it->scope, result->name) == 0) {
+          result->found = true;
+          sp_ts_types_field(result, it);
+        }
+      } //for
+    }
+    ts_tree_delete(tree);
+    sp_ts_cache_release(self->cache, entry);
+  } //for
+
+  return complete;
+}
+
+static bool
+sp_ts_types_out(const struct sp_ts_types_name *name, struct sp_ts_type *out)
+{
+  out->type        = name->type;
+  out->pointer     = name->pointer;
+  out->enumerators = (const char *const *)name->enumerators;
+  out->fields      = name->fields;
+  out->n_fields    = name->n_fields;
+  return name->found;
+}
+
+int
+sp_ts_types_init(struct sp_ts_types *self,
+                 struct sp_ts_cache *cache,
+                 const struct sp_ts_compdb *compdb,
+                 sp_ts_types_watch_cb watch,
+                 void *watch_closure)
+{
+  memset(self, 0, sizeof(*self));
+  pthread_mutex_init(&self->lock, NULL);
+  sp_util_sorted_set_init(&self->files, sizeof(struct sp_ts_types_file *),
+                          sp_ts_types_file_cmp);
+  self->cache         = cache;
+  self->compdb        = compdb;
+  self->watch         = watch;
+  self->watch_closure = watch_closure;
+  return 0;
+}
+
+void
+sp_ts_types_begin(struct sp_ts_types *self,
+                  struct sp_ts_types_request *request,
+                  const char *path,
+                  const struct sp_ts_limits *limits)
+{
+  memset(request, 0, sizeof(*request));
+  request->types  = self;
+  request->path   = path;
+  request->limits = limits;
+}
+
+bool
+sp_ts_types_lookup(void *closure, const char *name, struct sp_ts_type *out)
+{
+  struct sp_ts_types_request *request = closure;
+  struct sp_ts_types *self            = request->types;
+  struct sp_ts_types_name needle      = {0};
+  struct sp_ts_types_name *it;
+  bool result = false;
+
+  if (!request->file && !(request->file = sp_ts_types_file(request))) {
+    return false;
+  }
+  if (!(needle.name = strdup(name))) {
+    return false;
+  }
+
+  pthread_mutex_lock(&self->lock);
+  if ((it = sp_util_sorted_set_find(&request->file->names, &needle))) {
+    result = sp_ts_types_out(it, out);
+  }
+  pthread_mutex_unlock(&self->lock);
+  if (it) {
+    free(needle.name);
+    return result;
+  }
+
+  /* outside of the lock, parsing a header can take a while */
+  if (!sp_ts_types_search(self, request->file, request->limits, &needle)) {
+    /* not remembered, the next request tries again */
+    sp_ts_types_name_free(&needle);
+    return false;
+  }
+
+  pthread_mutex_lock(&self->lock);
+  if (!(it = sp_util_sorted_set_insert(&request->file->names, &needle))) {
+    sp_ts_types_name_free(&needle);
+  } else {
+    if (it->name != needle.name) {
+      /* a concurrent lookup of it won */
+      sp_ts_types_name_free(&needle);
+    }
+    result = sp_ts_types_out(it, out);
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  return result;
+}
+
+void
+sp_ts_types_end(struct sp_ts_types_request *request)
+{
+  if (request->file) {
+    sp_ts_types_put(request->types, request->file);
+    request->file = NULL;
+  }
+}
+
+void
+sp_ts_types_invalidate(struct sp_ts_types *self, const char *path)
+{
+  char *canonical = NULL;
+  size_t i;
+
+  if (path) {
+    /* NULL when out of memory, all is forgotten then which is never stale */
+    path = canonical = sp_ts_path_canonical(path);
+  }
+  pthread_mutex_lock(&self->lock);
+  for (i = self->files.length; i-- > 0;) {
+    struct sp_ts_types_file *file =
+      *(struct sp_ts_types_file **)sp_util_sorted_set_at(&self->files, i);
+    bool stale = path == NULL;
+    size_t h;
+
+    for (h = 0; h < file->n_headers && !stale; ++h) {
+      stale = strcmp(file->headers[h], path) == 0;
+    }
+    if (stale) {
+      sp_util_sorted_set_remove(&self->files, &file);
+      file->linked = false;
+      if (file->refs == 0) {
+        sp_ts_types_file_free(file);
+      }
+    }
+  } //for
+  pthread_mutex_unlock(&self->lock);
+  free(canonical);
+}
+
+int
+sp_ts_types_free(struct sp_ts_types *self)
+{
+  sp_ts_types_invalidate(self, NULL);
+  sp_util_sorted_set_free(&self->files);
+  pthread_mutex_destroy(&self->lock);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef SP_TS_TYPES_H
+#define SP_TS_TYPES_H
+
+#include <pthread.h>
+
+#include "shared.h"
+#include "cache.h"
+#include "compdb.h"
+#include "sp_util.h"
+
+/* ======================================== */
+/* Type names of a file looked up in the headers it #include:s, for
+ * __format() to know what a typedef, enum or struct declared in another file
+ * is.
+ *
+ * The headers a file sees (itself and its includes, transitively, found as
+ * the compiler would with $compdb) are collected on the first lookup of a
+ * name of it and remembered. So is every name looked up, found or not, so
+ * interactive requests neither walk the include graph nor the declarations
+ * again. Headers are parsed into the shared cache, once for all files
+ * including them, and handed to $watch.
+ *
+ * What is remembered of a file is forgotten with sp_ts_types_invalidate()
+ * when it or one of its headers changes. Without that (no inotify, a missed
+ * event) the headers are also stat()ed on the first lookup of a request and
+ * the file is walked again when one was changed, created or removed since.
+ */
+struct sp_ts_types_file;
+
+/* $path a header that was parsed, to be watched for changes */
+typedef void (*sp_ts_types_watch_cb)(void *closure, const char *path);
+
+struct sp_ts_types {
+  pthread_mutex_t lock;
+  /* struct sp_ts_types_file * sorted by path */
+  struct sp_util_sorted_set files;
+  struct sp_ts_cache *cache;
+  const struct sp_ts_compdb *compdb;
+  /* may be NULL */
+  sp_ts_types_watch_cb watch;
+  void *watch_closure;
+};
+
+/* The lookups of one request, the closure of sp_ts_types_lookup() */
+struct sp_ts_types_request {
+  struct sp_ts_types *types;
+  const char *path;
+  const struct sp_ts_limits *limits;
+  /* held until sp_ts_types_end(), NULL until the first lookup */
+  struct sp_ts_types_file *file;
+};
+
+int
+sp_ts_types_init(struct sp_ts_types *,
+                 struct sp_ts_cache *cache,
+                 const struct sp_ts_compdb *compdb,
+                 sp_ts_types_watch_cb watch,
+                 void *watch_closure);
+
+/* Lookups of the file $path, parses of headers are bounded by $limits (may
+ * be NULL) */
+void
+sp_ts_types_begin(struct sp_ts_types *,
+                  struct sp_ts_types_request *,
+                  const char *path,
+                  const struct sp_ts_limits *limits);
+
+/* sp_ts_type_cb of a struct sp_ts_types_request, thread safe. The strings
+ * of $out stay valid until sp_ts_types_end(). */
+bool
+sp_ts_types_lookup(void *closure, const char *name, struct sp_ts_type *out);
+
+void
+sp_ts_types_end(struct sp_ts_types_request *);
+
+/* Forget what is known of $path and of the files including it, of every
+ * file when NULL */
+void
+sp_ts_types_invalidate(struct sp_ts_types *, const char *path);
+
+int
+sp_ts_types_free(struct sp_ts_types *);
+
+#endif
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include "watch.h"
+#include "shared.h"
+
+#include <sys/inotify.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SP_TS_WATCH_MASK                                                       \
+  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR)
+
+struct sp_ts_watch_dir {
+  char *path;
+  int wd;
+};
+
+static int
+sp_ts_watch_cmp(const void *f, const void *s)
+{
+  const struct sp_ts_watch_dir *first  = f;
+  const struct sp_ts_watch_dir *second = s;
+  return strcmp(first->path, second->path);
+}
+
+int
+sp_ts_watch_init(struct sp_ts_watch *self)
+{
+  memset(self, 0, sizeof(*self));
+  pthread_mutex_init(&self->lock, NULL);
+  sp_util_sorted_set_init(&self->dirs, sizeof(struct sp_ts_watch_dir),
+                          sp_ts_watch_cmp);
+  if ((self->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+    fprintf(stderr, "%s: inotify_init1: %m\n", __func__);
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+sp_ts_watch_file(struct sp_ts_watch *self, const char *file)
+{
+  struct sp_ts_watch_dir dir = {0};
+  const char *slash;
+  char *canonical;
+  int res = 0;
+
+  /* events are reported with the canonical spelling the cache keys on */
+  if (!(canonical = sp_ts_path_canonical(file))) {
+    return -1;
+  }
+  file  = canonical;
+  slash = strrchr(file, '/');
+  if (!slash) {
+    dir.path = strdup(".");
+  } else if (slash == file) {
+    dir.path = strdup("/");
+  } else {
+    dir.path = strndup(file, (size_t)(slash - file));
+  }
+  free(canonical);
+  if (!dir.path) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&self->lock);
+  if (self->full || sp_util_sorted_set_find(&self->dirs, &dir)) {
+    goto Lout;
+  }
+  if ((dir.wd = inotify_add_watch(self->fd, dir.path, SP_TS_WATCH_MASK)) < 0) {
+    if (errno == ENOSPC) {
+      fprintf(stderr, "%s: out of inotify watches, not watching '%s'\n",
+              __func__, dir.path);
+      self->full = true;
+    }
+    res = -1;
+    goto Lout;
+  }
+  if (sp_util_sorted_set_insert(&self->dirs, &dir)) {
+    /* owned by the set */
+    dir.path = NULL;
+  }
+
+Lout:
+  pthread_mutex_unlock(&self->lock);
+  free(dir.path);
+  return res;
+}
+
+/* $name in $dir, which is canonical unless it did not exist when watched */
+static char *
+sp_ts_watch_path(const char *dir, const char *name)
+{
+  char *result;
+
+  if (strcmp(dir, ".") == 0) {
+    return strdup(name);
+  }
+  if (asprintf(&result, "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, name) < 0) {
+    return NULL;
+  }
+  return result;
+}
+
+/* The changed paths of $ev. Several spellings of a directory share its
+ * $wd, each gets its own path. */
+static char **
+sp_ts_watch_event(struct sp_ts_watch *self,
+                  const struct inotify_event *ev,
+                  size_t *n_paths)
+{
+  char **result = NULL;
+  size_t i      = 0;
+
+  *n_paths = 0;
+  pthread_mutex_lock(&self->lock);
+  while (i < self->dirs.length) {
+    struct sp_ts_watch_dir *it = sp_util_sorted_set_at(&self->dirs, i);
+    char **tmp;
+    char *path;
+
+    if (it->wd != ev->wd) {
+      ++i;
+      continue;
+    }
+    if (ev->mask & IN_IGNORED) {
+      /* the directory is gone */
+      char *dir_path = it->path;
+      sp_util_sorted_set_remove(&self->dirs, it);
+      free(dir_path);
+      continue;
+    }
+    ++i;
+    if (ev->len == 0 || (ev->mask & IN_ISDIR)) {
+      continue;
+    }
+    if (!(path = sp_ts_watch_path(it->path, ev->name))) {
+      continue;
+    }
+    if (!(tmp = realloc(result, (*n_paths + 1) * sizeof(*tmp)))) {
+      free(path);
+      continue;
+    }
+    result               = tmp;
+    result[(*n_paths)++] = path;
+  } //while
+  pthread_mutex_unlock(&self->lock);
+
+  return result;
+}
+
+int
+sp_ts_watch_read(struct sp_ts_watch *self, sp_ts_watch_cb cb, void *closure)
+{
+  char buf[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t bytes;
+
+  while ((bytes = read(self->fd, buf, sizeof(buf))) > 0) {
+    const char *it = buf;
+
+    while (it < buf + bytes) {
+      const struct inotify_event *ev = (const struct inotify_event *)it;
+      char **paths;
+      size_t n_paths;
+      size_t i;
+      bool removed;
+
+      it += sizeof(*ev) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        cb(closure, NULL, false);
+        continue;
+      }
+      removed = (ev->mask & (IN_MOVED_FROM | IN_DELETE)) != 0;
+
+      paths = sp_ts_watch_event(self, ev, &n_paths);
+      for (i = 0; i < n_paths; ++i) {
+        cb(closure, paths[i], removed);
+        free(paths[i]);
+      } //for
+      free(paths);
+    } //while
+  } //while
+
+  if (bytes < 0 && errno != EAGAIN && errno != EINTR) {
+    fprintf(stderr, "%s: read: %m\n", __func__);
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+sp_ts_watch_free(struct sp_ts_watch *self)
+{
+  size_t i;
+
+  for (i = 0; i < self->dirs.length; ++i) {
+    struct sp_ts_watch_dir *it = sp_util_sorted_set_at(&self->dirs, i);
+    free(it->path);
+  } //for
+  sp_util_sorted_set_free(&self->dirs);
+  if (self->fd >= 0) {
+    close(self->fd);
+  }
+  pthread_mutex_destroy(&self->lock);
+  memset(self, 0, sizeof(*self));
+
+  return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef SP_TS_WATCH_H
+#define SP_TS_WATCH_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "sp_util.h"
+
+/* ======================================== */
+/* inotify over the directories of the files we have parsed. A file counts as
+ * changed when it is written and closed, renamed over or away, or deleted,
+ * so a writer still in the middle of writing is not reported.
+ *
+ * Watches are limited (fs.inotify.max_user_watches), once they run out
+ * further directories are not watched. A cache validating what it hands out
+ * (see cache.h) stays correct without, only the eager invalidation is lost.
+ */
+struct sp_ts_watch {
+  int fd;
+  pthread_mutex_t lock;
+  /* struct sp_ts_watch_dir sorted by path */
+  struct sp_util_sorted_set dirs;
+  /* out of watches, logged once */
+  bool full;
+};
+
+/* $path a file in a watched directory, $removed when it is gone */
+typedef void (*sp_ts_watch_cb)(void *closure, const char *path, bool removed);
+
+int
+sp_ts_watch_init(struct sp_ts_watch *);
+
+/* Watch the directory $file is in, thread safe. Changes are reported with
+ * the sp_ts_path_canonical() spelling. */
+int
+sp_ts_watch_file(struct sp_ts_watch *, const char *file);
+
+/* Drain the pending events of $self->fd (non-blocking) into $cb. $cb is
+ * called with a NULL $path when events were lost, anything may have
+ * changed. */
+int
+sp_ts_watch_read(struct sp_ts_watch *, sp_ts_watch_cb cb, void *closure);
+
+int
+sp_ts_watch_free(struct sp_ts_watch *);
+
+#endif